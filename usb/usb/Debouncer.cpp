@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb.aidl-service"
+
+#include "Debouncer.h"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+Debouncer::Debouncer(std::chrono::milliseconds window, std::function<void()> action)
+    : mWindow(window),
+      mAction(std::move(action)),
+      mTimerFd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) {
+    if (!mTimerFd.ok()) {
+        ALOGE("timerfd_create failed; errno=%d", errno);
+    }
+}
+
+void Debouncer::mark() {
+    if (mPending) {
+        return;
+    }
+
+    itimerspec spec{};
+    spec.it_value.tv_sec = mWindow.count() / 1000;
+    spec.it_value.tv_nsec = mWindow.count() % 1000 * 1000000;
+    // a zero value would disarm the timer
+    if (mWindow.count() <= 0) {
+        spec.it_value.tv_nsec = 1;
+    }
+
+    if (timerfd_settime(mTimerFd, 0, &spec, nullptr) == -1) {
+        // better to refresh right away than not at all
+        ALOGE("timerfd_settime failed; errno=%d", errno);
+        mAction();
+        return;
+    }
+    mPending = true;
+}
+
+void Debouncer::fire() {
+    uint64_t expirations;
+
+    if (TEMP_FAILURE_RETRY(read(mTimerFd, &expirations, sizeof(expirations))) !=
+        sizeof(expirations)) {
+        return;
+    }
+
+    mPending = false;
+    mAction();
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
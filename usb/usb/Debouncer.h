@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+
+#include <chrono>
+#include <functional>
+#include <optional>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// Coalesces a burst of events into a single call of an action, made once a
+// window has passed since the first event of the burst. The window is not
+// extended by later events, so a steady stream still gets through.
+//
+// Meant to be driven from an epoll loop: add fd() for EPOLLIN and call fire()
+// when it is readable. Not thread-safe; mark() and fire() must be called from
+// the thread running the loop.
+class Debouncer {
+  public:
+    Debouncer(std::chrono::milliseconds window, std::function<void()> action);
+
+    int fd() const { return mTimerFd.get(); }
+
+    // Records an event, starting the window unless one is already running.
+    void mark();
+    // Runs the action if the window has closed.
+    void fire();
+
+    bool pending() const { return mPending; }
+
+  private:
+    const std::chrono::milliseconds mWindow;
+    const std::function<void()> mAction;
+    ::android::base::unique_fd mTimerFd;
+    bool mPending = false;
+};
+
+// Remembers the last value reported, so that reports of an unchanged value
+// can be dropped.
+template <typename T>
+class ChangeFilter {
+  public:
+    // Returns true if |value| differs from the last one passed in.
+    bool changed(const T &value) {
+        if (mLast && *mLast == value) {
+            return false;
+        }
+        mLast = value;
+        return true;
+    }
+
+    // Forgets the last value, e.g. for a new listener that has seen none.
+    void reset() { mLast.reset(); }
+
+  private:
+    std::optional<T> mLast;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
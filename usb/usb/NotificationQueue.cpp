@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb.aidl-service"
+
+#include "NotificationQueue.h"
+
+#include <utils/Log.h>
+
+#include <cinttypes>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+NotificationQueue::NotificationQueue(size_t maxPending)
+    : mMaxPending(maxPending > 0 ? maxPending : 1) {
+    mThread = std::thread(&NotificationQueue::run, this);
+}
+
+NotificationQueue::~NotificationQueue() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mStopping = true;
+    }
+    mQueued.notify_all();
+    mThread.join();
+}
+
+void NotificationQueue::post(std::function<void()> notification, bool latestOnly) {
+    std::unique_lock<std::mutex> lock(mLock);
+
+    mPosted++;
+    if (latestOnly) {
+        for (auto it = mQueue.begin(); it != mQueue.end(); ++it) {
+            if (it->latestOnly) {
+                mQueue.erase(it);
+                mReplaced++;
+                mDone.notify_all();
+                break;
+            }
+        }
+    }
+
+    if (mQueue.size() >= mMaxPending) {
+        // a result is stale sooner than the one status still queued
+        auto victim = mQueue.begin();
+        while (victim != mQueue.end() && victim->latestOnly) {
+            ++victim;
+        }
+        mQueue.erase(victim != mQueue.end() ? victim : mQueue.begin());
+        mDropped++;
+        mDone.notify_all();
+        ALOGW("notification queue full, dropped the oldest (%" PRIu64 " so far)", mDropped);
+    }
+
+    mQueue.push_back({std::move(notification), latestOnly});
+    mQueued.notify_one();
+}
+
+void NotificationQueue::flush() {
+    std::unique_lock<std::mutex> lock(mLock);
+
+    mDone.wait(lock, [this] { return mDelivered + mReplaced + mDropped >= mPosted; });
+}
+
+size_t NotificationQueue::pending() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mQueue.size();
+}
+
+uint64_t NotificationQueue::delivered() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mDelivered;
+}
+
+uint64_t NotificationQueue::replaced() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mReplaced;
+}
+
+uint64_t NotificationQueue::dropped() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mDropped;
+}
+
+void NotificationQueue::run() {
+    std::unique_lock<std::mutex> lock(mLock);
+
+    while (true) {
+        mQueued.wait(lock, [this] { return !mQueue.empty() || mStopping; });
+        if (mQueue.empty()) {
+            break;
+        }
+
+        Entry entry = std::move(mQueue.front());
+        mQueue.pop_front();
+
+        lock.unlock();
+        entry.notification();
+        // drop what the notification holds, e.g. the callback, before
+        // counting it as delivered
+        entry.notification = nullptr;
+        lock.lock();
+
+        mDelivered++;
+        mDone.notify_all();
+    }
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// Makes the calls into the framework's callback from a thread of its own, so
+// that a slow callback holds up neither the binder threads nor the uevent
+// loop. Notifications are delivered one at a time, in the order they were
+// queued.
+//
+// The queue is bounded, yet posting never waits: callers hold mStatusLock or
+// run on the uevent loop. Once the queue is full, the oldest queued
+// notification is dropped to make room, and counted. A port status is only
+// worth delivering if it is the latest, so a status replaces the one still
+// queued rather than adding to the queue, and is the last to be dropped.
+class NotificationQueue {
+  public:
+    explicit NotificationQueue(size_t maxPending);
+    // Delivers whatever is still queued, then stops the thread.
+    ~NotificationQueue();
+
+    // Queues |notification| behind those queued before it. With |latestOnly|
+    // set, it replaces any such notification that is still queued, taking
+    // its place at the back. Never blocks; see above for a full queue.
+    void post(std::function<void()> notification, bool latestOnly = false);
+
+    // Waits until nothing is queued or being delivered, including anything
+    // posted meanwhile.
+    void flush();
+
+    size_t pending();
+    uint64_t delivered();
+    uint64_t replaced();
+    uint64_t dropped();
+
+  private:
+    struct Entry {
+        std::function<void()> notification;
+        bool latestOnly;
+    };
+
+    void run();
+
+  private:
+    const size_t mMaxPending;
+    std::mutex mLock;
+    // signalled when a notification is queued, or when stopping
+    std::condition_variable mQueued;
+    // signalled when one is delivered, replaced or dropped
+    std::condition_variable mDone;
+    std::deque<Entry> mQueue;
+    uint64_t mPosted = 0;
+    uint64_t mDelivered = 0;
+    uint64_t mReplaced = 0;
+    uint64_t mDropped = 0;
+    bool mStopping = false;
+    std::thread mThread;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb.aidl-service"
+
+#include "Reactor.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::unique_fd;
+
+constexpr int kMaxEvents = 64;
+
+Reactor::Reactor()
+    : mEpollFd(epoll_create1(EPOLL_CLOEXEC)), mWakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    if (!mEpollFd.ok()) {
+        ALOGE("epoll_create1 failed; errno=%d", errno);
+    }
+    if (!mWakeFd.ok()) {
+        ALOGE("eventfd failed; errno=%d", errno);
+    }
+}
+
+Reactor::~Reactor() {
+    stop();
+}
+
+bool Reactor::add(int fd, Handler handler, uint32_t events) {
+    std::lock_guard<std::mutex> lock(mLock);
+    struct epoll_event ev {};
+
+    if (mStarted || !mEpollFd.ok() || fd < 0) {
+        return false;
+    }
+
+    mSources.push_back({fd, std::move(handler)});
+    ev.events = events;
+    ev.data.ptr = &mSources.back();
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        ALOGE("epoll_ctl failed; errno=%d", errno);
+        mSources.pop_back();
+        return false;
+    }
+
+    return true;
+}
+
+bool Reactor::add(unique_fd fd, Handler handler, uint32_t events) {
+    if (!add(fd.get(), std::move(handler), events)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+    mOwned.push_back(std::move(fd));
+    return true;
+}
+
+bool Reactor::start(std::function<void()> onExit) {
+    std::lock_guard<std::mutex> lock(mLock);
+    struct epoll_event ev {};
+
+    if (mStarted || !mEpollFd.ok() || !mWakeFd.ok()) {
+        return false;
+    }
+
+    // the wakeup is told apart from the sources by its null pointer
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &ev) == -1) {
+        ALOGE("epoll_ctl failed; errno=%d", errno);
+        return false;
+    }
+
+    mStarted = true;
+    mRunning = true;
+    mThread = std::thread(&Reactor::loop, this, std::move(onExit));
+    return true;
+}
+
+void Reactor::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mThread.joinable()) {
+            return;
+        }
+        mStopping = true;
+    }
+
+    wake();
+    // a handler stopping its own loop; it exits once the handler returns
+    if (mThread.get_id() == std::this_thread::get_id()) {
+        return;
+    }
+    mThread.join();
+}
+
+bool Reactor::running() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mRunning && !mStopping;
+}
+
+void Reactor::wake() {
+    uint64_t one = 1;
+
+    if (TEMP_FAILURE_RETRY(write(mWakeFd, &one, sizeof(one))) != sizeof(one)) {
+        ALOGE("eventfd write failed; errno=%d", errno);
+    }
+}
+
+void Reactor::loop(std::function<void()> onExit) {
+    struct epoll_event events[kMaxEvents];
+    bool running = true;
+
+    ALOGI("reactor started");
+    while (running) {
+        int nevents = epoll_wait(mEpollFd, events, kMaxEvents, -1);
+        if (nevents == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ALOGE("usb epoll_wait failed; errno=%d", errno);
+            break;
+        }
+
+        for (int n = 0; n < nevents && running; ++n) {
+            Source *source = static_cast<Source *>(events[n].data.ptr);
+            if (source) {
+                source->handler(events[n].events);
+            } else {
+                // only stop() wakes the loop
+                uint64_t count;
+                TEMP_FAILURE_RETRY(read(mWakeFd, &count, sizeof(count)));
+                std::lock_guard<std::mutex> lock(mLock);
+                running = !mStopping;
+            }
+        }
+
+        // stopping wins over anything else that was ready
+        std::lock_guard<std::mutex> lock(mLock);
+        running = running && !mStopping;
+    }
+    ALOGI("reactor exiting");
+
+    if (onExit) {
+        onExit();
+    }
+
+    std::lock_guard<std::mutex> lock(mLock);
+    mRunning = false;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
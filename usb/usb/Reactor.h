@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+#include <sys/epoll.h>
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// An epoll loop on a thread of its own, for the uevent socket and the timers
+// of the HAL. The loop is woken through an eventfd to stop, so no signal is
+// needed to shut it down.
+//
+// Sources are added before the loop is started and stay until it is
+// destroyed. Handlers all run on the loop thread, one at a time.
+class Reactor {
+  public:
+    using Handler = std::function<void(uint32_t events)>;
+
+    Reactor();
+    // Stops the loop if it is still running.
+    ~Reactor();
+
+    // Calls |handler| whenever |fd| is ready for |events|. The second form
+    // also takes ownership of |fd|, closing it once the reactor is destroyed.
+    // Returns false if the loop is already running or epoll refused the fd.
+    bool add(int fd, Handler handler, uint32_t events = EPOLLIN);
+    bool add(::android::base::unique_fd fd, Handler handler, uint32_t events = EPOLLIN);
+
+    // Starts the loop thread. |onExit| runs on it as the loop exits, whether
+    // stopped or failed. Returns false if the reactor could not be set up or
+    // was started before.
+    bool start(std::function<void()> onExit = nullptr);
+
+    // Stops the loop and waits for the thread to exit. No handler runs once
+    // this returns. From a handler, the loop exits once the handler returns
+    // and is joined by the next stop().
+    void stop();
+
+    bool running();
+
+  private:
+    struct Source {
+        int fd;
+        Handler handler;
+    };
+
+    void loop(std::function<void()> onExit);
+    void wake();
+
+  private:
+    ::android::base::unique_fd mEpollFd;
+    ::android::base::unique_fd mWakeFd;
+    std::vector<::android::base::unique_fd> mOwned;
+    // epoll hands back pointers into the list, which never moves its nodes
+    std::list<Source> mSources;
+    std::thread mThread;
+
+    std::mutex mLock;
+    bool mStarted = false;
+    bool mRunning = false;
+    bool mStopping = false;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RoleTransition.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+bool RoleTransition::Target::matches(const TypeCTopology::Port &other) const {
+    return other.name == port && (powerRole.empty() || other.powerRole == powerRole) &&
+           (dataRole.empty() || other.dataRole == dataRole) && (!connected || other.connected);
+}
+
+void RoleTransition::begin(Target target) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    // a waiter on the replaced transition gives up on it
+    if (mState == State::PENDING) {
+        mState = State::CANCELLED;
+        mCv.notify_all();
+    }
+
+    mTarget = std::move(target);
+    mStart = Clock::now();
+    mState = State::PENDING;
+}
+
+void RoleTransition::observe(const std::vector<TypeCTopology::Port> &ports) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    if (mState != State::PENDING) {
+        return;
+    }
+
+    for (auto &port : ports) {
+        if (mTarget.matches(port)) {
+            mEnd = Clock::now();
+            mState = State::DONE;
+            mCv.notify_all();
+            return;
+        }
+    }
+}
+
+void RoleTransition::cancel() {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    if (mState == State::PENDING) {
+        mState = State::CANCELLED;
+        mCv.notify_all();
+    }
+}
+
+bool RoleTransition::pending() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mState == State::PENDING;
+}
+
+RoleTransition::Result RoleTransition::wait(std::chrono::milliseconds timeout,
+                                            std::chrono::microseconds *latency) {
+    std::unique_lock<std::mutex> lock(mLock);
+    auto start = mStart;
+    auto end = start;
+    Result result;
+
+    mCv.wait_until(lock, start + timeout, [&] {
+        return mState != State::PENDING || mStart != start;
+    });
+
+    if (mStart == start && mState == State::DONE) {
+        result = Result::DONE;
+        end = mEnd;
+    } else if (mStart != start || mState == State::CANCELLED) {
+        // cancelled, or replaced by another transition
+        result = Result::CANCELLED;
+        end = Clock::now();
+    } else {
+        result = Result::TIMED_OUT;
+        end = Clock::now();
+        mState = State::IDLE;
+    }
+
+    if (latency) {
+        *latency = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+    }
+
+    return result;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "TypeCTopology.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// Tracks a role change on a Type-C port until the port is seen in the
+// requested state, which completes it right away instead of at the end of a
+// fixed wait. The port state comes from the topology as uevents update it.
+//
+// One transition is tracked at a time; role switches are serialized anyway.
+class RoleTransition {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    // The state a port should reach. Empty roles match any.
+    struct Target {
+        std::string port;
+        std::string powerRole;
+        std::string dataRole;
+        // A partner must be attached, e.g. after a port type change.
+        bool connected = false;
+
+        bool matches(const TypeCTopology::Port &port) const;
+    };
+
+    enum class Result {
+        DONE,
+        TIMED_OUT,
+        CANCELLED,
+    };
+
+    // Starts tracking |target|, replacing any transition in progress. Call
+    // before writing the new role so that none of its uevents are missed.
+    void begin(Target target);
+
+    // Completes the transition in progress if one of |ports| matches it.
+    void observe(const std::vector<TypeCTopology::Port> &ports);
+
+    // Ends the transition in progress, waking up its waiter.
+    void cancel();
+
+    // Reports whether a transition is being tracked and not yet resolved.
+    bool pending();
+
+    // Waits up to |timeout| for the transition to complete. Reports how long
+    // it took since begin() in |latency|, or how long was waited.
+    Result wait(std::chrono::milliseconds timeout, std::chrono::microseconds *latency = nullptr);
+
+  private:
+    enum class State {
+        IDLE,
+        PENDING,
+        DONE,
+        CANCELLED,
+    };
+
+    std::mutex mLock;
+    std::condition_variable mCv;
+    State mState = State::IDLE;
+    Target mTarget;
+    Clock::time_point mStart;
+    Clock::time_point mEnd;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb.aidl-service"
+
+#include "SysfsReader.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+static constexpr std::string_view kWhitespace = " \t\n\r\f\v";
+
+SysfsReader::SysfsReader(std::vector<Node> nodes) {
+    mEntries.reserve(nodes.size());
+    for (auto &node : nodes) {
+        mEntries.push_back({std::move(node), {}, {}, std::nullopt});
+    }
+}
+
+size_t SysfsReader::read() {
+    size_t count = 0;
+
+    for (auto &entry : mEntries) {
+        count += readEntry(&entry);
+    }
+
+    return count;
+}
+
+size_t SysfsReader::read(std::initializer_list<size_t> indices) {
+    size_t count = 0;
+
+    for (size_t i : indices) {
+        count += i < mEntries.size() && readEntry(&mEntries[i]);
+    }
+
+    return count;
+}
+
+std::optional<std::string_view> SysfsReader::value(size_t i) const {
+    return i < mEntries.size() ? mEntries[i].value : std::nullopt;
+}
+
+bool SysfsReader::open(Entry *entry) {
+    mSyscalls++;
+    entry->fd.reset(TEMP_FAILURE_RETRY(::open(entry->node.path.c_str(), O_RDONLY | O_CLOEXEC)));
+    return entry->fd.ok();
+}
+
+ssize_t SysfsReader::pread(Entry *entry) {
+    mSyscalls++;
+    return TEMP_FAILURE_RETRY(::pread(entry->fd, entry->buf.data(), entry->buf.size(), 0));
+}
+
+bool SysfsReader::readEntry(Entry *entry) {
+    ssize_t n = -1;
+
+    entry->value.reset();
+
+    if (entry->fd.ok()) {
+        n = pread(entry);
+        // the node was removed and perhaps recreated since it was opened
+        if (n < 0) {
+            entry->fd.reset();
+            mSyscalls++;
+        }
+    }
+    if (n < 0) {
+        if (!open(entry)) {
+            return false;
+        }
+        n = pread(entry);
+    }
+    if (!entry->node.stable) {
+        entry->fd.reset();
+        mSyscalls++;
+    }
+    if (n < 0) {
+        ALOGE("Failed to read filesystem node: %s", entry->node.path.c_str());
+        return false;
+    }
+
+    std::string_view value(entry->buf.data(), n);
+    auto first = value.find_first_not_of(kWhitespace);
+    if (first == std::string_view::npos) {
+        entry->value = std::string_view();
+        return true;
+    }
+    value = value.substr(first, value.find_last_not_of(kWhitespace) - first + 1);
+
+    entry->value = value;
+    return true;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/unique_fd.h>
+
+#include <array>
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// Reads a declared set of small sysfs nodes in one call, into fixed buffers,
+// rather than opening each node into a fresh string every time.
+//
+// Stable nodes, those that last as long as their device, are opened once
+// and re-read with pread() from offset 0, which has sysfs show the current
+// value again. Should one of them be recreated under the same path, the
+// stale fd fails and the node is reopened. Transient nodes, such as those of
+// a Type-C partner, are opened for each read so that no fd pins a device
+// that has gone.
+//
+// Not thread-safe; the values are only valid until the next read.
+class SysfsReader {
+  public:
+    // Longer values are cut short.
+    static constexpr size_t kValueSize = 64;
+
+    struct Node {
+        std::string path;
+        bool stable = true;
+    };
+
+    explicit SysfsReader(std::vector<Node> nodes);
+
+    // Reads every node, or the nodes at the given indices. Returns how many
+    // could be read.
+    size_t read();
+    size_t read(std::initializer_list<size_t> indices);
+
+    // The value of node |i| from its last read, without surrounding
+    // whitespace, or nullopt if it could not be read.
+    std::optional<std::string_view> value(size_t i) const;
+
+    // The open, pread and close calls made so far.
+    uint64_t syscalls() const { return mSyscalls; }
+
+  private:
+    struct Entry {
+        Node node;
+        ::android::base::unique_fd fd;
+        std::array<char, kValueSize> buf;
+        std::optional<std::string_view> value;
+    };
+
+    bool readEntry(Entry *entry);
+    bool open(Entry *entry);
+    ssize_t pread(Entry *entry);
+
+  private:
+    std::vector<Entry> mEntries;
+    uint64_t mSyscalls = 0;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
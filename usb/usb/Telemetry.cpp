@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Telemetry.h"
+
+#include <cstring>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+void LatencyHistogram::reset() {
+    for (auto &bucket : mBuckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    mMaxNs.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const {
+    uint64_t count = 0;
+    for (auto &bucket : mBuckets) {
+        count += bucket.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+uint64_t LatencyHistogram::percentileNs(double fraction) const {
+    uint64_t total = count();
+    uint64_t target = std::ceil(fraction * total);
+    uint64_t seen = 0;
+
+    if (total == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < kBuckets; i++) {
+        seen += mBuckets[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return std::min(i ? uint64_t{1} << i : 0, maxNs());
+        }
+    }
+    return maxNs();
+}
+
+void LatencyHistogram::dump(int fd, const char *name) const {
+    dprintf(fd, "    %-24s %8" PRIu64 " %10.1f %10.1f %10.1f %10.1f\n", name, count(),
+            percentileNs(0.50) / 1000.0, percentileNs(0.90) / 1000.0,
+            percentileNs(0.99) / 1000.0, maxNs() / 1000.0);
+}
+
+void LatencyHistogram::dumpHeader(int fd, const char *title) {
+    dprintf(fd, "  %-26s %8s %10s %10s %10s %10s\n", title, "count", "p50 us", "p90 us",
+            "p99 us", "max us");
+}
+
+// Copies as much of the end of |value| as fits, NUL-terminated.
+template <size_t N>
+static void copyTail(char (&dst)[N], std::string_view value) {
+    if (value.size() >= N) {
+        value.remove_prefix(value.size() - (N - 1));
+    }
+    value.copy(dst, N - 1);
+    dst[value.size()] = '\0';
+}
+
+void UeventLog::record(const Uevent &event) {
+    uint64_t index = mHead.load(std::memory_order_relaxed);
+    Entry &e = mEntries[index % kSize];
+
+    e.seq.store(index * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    e.time = Clock::now();
+    copyTail(e.action, event.action());
+    copyTail(e.devtype, event.devtype());
+    copyTail(e.devpath, event.devpath());
+
+    e.seq.store(index * 2 + 2, std::memory_order_release);
+    mHead.store(index + 1, std::memory_order_release);
+}
+
+void UeventLog::dump(int fd) const {
+    uint64_t head = mHead.load(std::memory_order_acquire);
+
+    dprintf(fd, "  Recent Uevents:\n");
+    for (uint64_t index = head > kSize ? head - kSize : 0; index < head; index++) {
+        const Entry &e = mEntries[index % kSize];
+        uint64_t seq = e.seq.load(std::memory_order_acquire);
+        Clock::time_point time = e.time;
+        char action[sizeof(e.action)];
+        char devtype[sizeof(e.devtype)];
+        char devpath[sizeof(e.devpath)];
+
+        std::memcpy(action, e.action, sizeof(action));
+        std::memcpy(devtype, e.devtype, sizeof(devtype));
+        std::memcpy(devpath, e.devpath, sizeof(devpath));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // the copy is only good if uevent |index| was published before and after it
+        if (seq != index * 2 + 2 || e.seq.load(std::memory_order_relaxed) != seq) {
+            continue;
+        }
+
+        dprintf(fd, "    [%.3f] %s %s%s%s\n",
+                std::chrono::duration<double, std::milli>(time.time_since_epoch()).count(),
+                action, devpath, devtype[0] ? " " : "", devtype);
+    }
+}
+
+void Telemetry::resetLatencies() {
+    ueventLatency.reset();
+    statusLatency.reset();
+    roleSwitchLatency.reset();
+    callbackQueueLatency.reset();
+    callbackLatency.reset();
+}
+
+void Telemetry::dump(int fd) const {
+    double uptime = std::chrono::duration<double>(Clock::now() - start).count();
+
+    dprintf(fd, "  Uptime: %.1f s\n", uptime);
+    dprintf(fd,
+            "  Uevents: %" PRIu64 " received (%.2f/s), %" PRIu64 " for ports, %" PRIu64
+            " lost\n",
+            uevents.get(), uptime > 0 ? uevents.get() / uptime : 0.0, portUevents.get(),
+            ueventsLost.get());
+    dprintf(fd, "  Port Status Refreshes: %" PRIu64 "\n", refreshes.get());
+    dprintf(fd,
+            "  Role Switches: %" PRIu64 " done, %" PRIu64 " timed out, %" PRIu64
+            " cancelled\n",
+            roleSwitchesDone.get(), roleSwitchesTimedOut.get(), roleSwitchesCancelled.get());
+
+    LatencyHistogram::dumpHeader(fd, "Latency:");
+    ueventLatency.dump(fd, "uevent");
+    statusLatency.dump(fd, "port status");
+    roleSwitchLatency.dump(fd, "role switch");
+    callbackQueueLatency.dump(fd, "callback queued");
+    callbackLatency.dump(fd, "callback");
+
+    recentUevents.dump(fd);
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
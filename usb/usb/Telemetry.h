@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+
+#include "Uevent.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using Clock = std::chrono::steady_clock;
+
+// A count that any thread may bump without locking.
+class Counter {
+  public:
+    void inc() { mValue.fetch_add(1, std::memory_order_relaxed); }
+    uint64_t get() const { return mValue.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint64_t> mValue{0};
+};
+
+// Log2 histogram of latencies, recorded lock-free from the uevent loop and
+// the callback paths alike.
+class LatencyHistogram {
+  public:
+    // up to 2^39 ns, about nine minutes, which no USB operation should approach
+    static constexpr size_t kBuckets = 40;
+
+  public:
+    void record(Clock::duration latency) {
+        uint64_t ns = std::max<int64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count(), 0);
+        size_t bucket = std::min<size_t>(ns ? 64 - __builtin_clzll(ns) : 0, kBuckets - 1);
+        uint64_t max = mMaxNs.load(std::memory_order_relaxed);
+
+        mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        while (ns > max && !mMaxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    void reset();
+    uint64_t count() const;
+    uint64_t maxNs() const { return mMaxNs.load(std::memory_order_relaxed); }
+    // Bucket-resolution percentile; 0.5 is the median.
+    uint64_t percentileNs(double fraction) const;
+
+    // One line per histogram, under the columns of dumpHeader().
+    void dump(int fd, const char *name) const;
+    static void dumpHeader(int fd, const char *title);
+
+  private:
+    std::array<std::atomic<uint64_t>, kBuckets> mBuckets{};
+    std::atomic<uint64_t> mMaxNs{0};
+};
+
+// Times a block, e.g. one role switch or one callback.
+class ScopedLatency {
+  public:
+    explicit ScopedLatency(LatencyHistogram *histogram)
+        : mHistogram(histogram), mStart(Clock::now()) {}
+    ~ScopedLatency() { mHistogram->record(Clock::now() - mStart); }
+
+  private:
+    LatencyHistogram *mHistogram;
+    Clock::time_point mStart;
+};
+
+// A ring of the last kSize uevents, each truncated into fixed char arrays, so
+// the uevent loop can log every message without taking a lock or touching
+// the heap. The loop is the only writer; dump() runs on a binder thread and
+// leaves out any entry the loop overwrote while it was being copied.
+class UeventLog {
+  public:
+    static constexpr size_t kSize = 32;
+
+    void record(const Uevent &event);
+    void dump(int fd) const;
+
+  private:
+    struct Entry {
+        // version of the entry: uevent n is written under 2n + 1 and
+        // published as 2n + 2
+        std::atomic<uint64_t> seq;
+        Clock::time_point time;
+        char action[8];
+        char devtype[24];
+        // the end of the path, which tells the devices apart
+        char devpath[64];
+    };
+
+    std::array<Entry, kSize> mEntries{};
+    std::atomic<uint64_t> mHead{0};
+};
+
+// What the HAL has been doing, for the dump. Everything is updated lock-free
+// from whichever thread it happens on.
+struct Telemetry {
+    const Clock::time_point start = Clock::now();
+
+    Counter uevents;
+    // of which about Type-C or the moisture state, and so refreshing the status
+    Counter portUevents;
+    // dropped by the socket or too long to read
+    Counter ueventsLost;
+    Counter refreshes;
+    Counter roleSwitchesDone;
+    Counter roleSwitchesTimedOut;
+    Counter roleSwitchesCancelled;
+
+    LatencyHistogram ueventLatency;
+    LatencyHistogram statusLatency;
+    LatencyHistogram roleSwitchLatency;
+    // from queuing a callback to making it, and the call itself
+    LatencyHistogram callbackQueueLatency;
+    LatencyHistogram callbackLatency;
+
+    UeventLog recentUevents;
+
+    void resetLatencies();
+    void dump(int fd) const;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
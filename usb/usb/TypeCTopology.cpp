@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "android.hardware.usb.aidl-service"
+
+#include "TypeCTopology.h"
+
+#include <dirent.h>
+#include <utils/Log.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+static constexpr std::string_view kPartnerSuffix = "-partner";
+
+// The nodes read for each port, in the order they are declared in nodes().
+enum PortNode : size_t {
+    POWER_ROLE,
+    DATA_ROLE,
+    PARTNER_PD,
+    PARTNER_ACCESSORY,
+};
+
+// Keeps the bracketed choice of a value that lists several.
+static std::string choice(std::string_view value) {
+    auto first = value.find('[');
+    auto last = value.find(']');
+    if (first != std::string_view::npos && last != std::string_view::npos && first < last) {
+        value = value.substr(first + 1, last - first - 1);
+    }
+
+    return std::string(value);
+}
+
+// The last component of a DEVPATH.
+static std::string_view basename(std::string_view devpath) {
+    return devpath.substr(devpath.find_last_of('/') + 1);
+}
+
+bool TypeCTopology::Port::operator==(const Port &other) const {
+    return name == other.name && connected == other.connected && pd == other.pd &&
+           powerRole == other.powerRole && dataRole == other.dataRole &&
+           accessory == other.accessory;
+}
+
+TypeCTopology::TypeCTopology(std::string root) : mRoot(std::move(root)) {}
+
+void TypeCTopology::track(bool enable) {
+    std::lock_guard<std::mutex> lock(mLock);
+    mTracking = enable;
+    mStale = true;
+}
+
+void TypeCTopology::invalidate() {
+    std::lock_guard<std::mutex> lock(mLock);
+    mStale = true;
+}
+
+void TypeCTopology::update(const Uevent &event) {
+    static constexpr Exactly kPort{"typec_port"};
+    static constexpr Exactly kPartner{"typec_partner"};
+    auto action = event.action();
+    auto name = std::string(basename(event.devpath()));
+    std::lock_guard<std::mutex> lock(mLock);
+
+    if (mStale || !mTracking) {
+        return;
+    }
+
+    if (kPort(event.devtype())) {
+        if (action == "remove") {
+            mPorts.erase(name);
+            mNodes.erase(name);
+            return;
+        }
+
+        // a new port may already have a partner; let a rescan find out
+        if (action == "add") {
+            mStale = true;
+            return;
+        }
+
+        auto port = find(name);
+        if (port == nullptr || !readPort(port)) {
+            mStale = true;
+        }
+    } else if (kPartner(event.devtype())) {
+        if (!EndsWith{kPartnerSuffix}(name)) {
+            mStale = true;
+            return;
+        }
+
+        auto port = find(name.substr(0, name.size() - kPartnerSuffix.size()));
+        if (port == nullptr) {
+            mStale = true;
+            return;
+        }
+
+        if (action == "remove") {
+            port->connected = false;
+            port->pd = false;
+            port->accessory.clear();
+        } else {
+            port->connected = true;
+            if (!readPartner(port)) {
+                mStale = true;
+                return;
+            }
+        }
+        // the roles are settled by the time the partner comes or goes
+        if (!readPort(port)) {
+            mStale = true;
+        }
+    }
+}
+
+bool TypeCTopology::snapshot(std::vector<Port> *ports) {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    if ((mStale || !mTracking) && !rescanLocked()) {
+        return false;
+    }
+
+    ports->clear();
+    ports->reserve(mPorts.size());
+    for (auto &[name, port] : mPorts) {
+        ports->push_back(port);
+    }
+
+    return true;
+}
+
+uint64_t TypeCTopology::rescans() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mRescans;
+}
+
+bool TypeCTopology::rescanLocked() {
+    std::vector<std::string> partners;
+    DIR *dp;
+
+    mRescans++;
+    mPorts.clear();
+
+    dp = opendir(mRoot.c_str());
+    if (dp == NULL) {
+        ALOGE("Failed to open %s", mRoot.c_str());
+        return false;
+    }
+
+    while (auto ep = readdir(dp)) {
+        if (ep->d_type != DT_LNK) {
+            continue;
+        }
+
+        std::string name = ep->d_name;
+        if (EndsWith{kPartnerSuffix}(name)) {
+            partners.push_back(name.substr(0, name.size() - kPartnerSuffix.size()));
+        } else {
+            mPorts[name].name = name;
+        }
+    }
+    closedir(dp);
+
+    for (auto &name : partners) {
+        if (auto port = find(name)) {
+            port->connected = true;
+        }
+    }
+
+    // keep the nodes of the ports that are still there open
+    for (auto it = mNodes.begin(); it != mNodes.end();) {
+        it = mPorts.count(it->first) ? std::next(it) : mNodes.erase(it);
+    }
+
+    for (auto &[name, port] : mPorts) {
+        if (!readPort(&port) || (port.connected && !readPartner(&port))) {
+            return false;
+        }
+    }
+
+    mStale = false;
+    return true;
+}
+
+SysfsReader *TypeCTopology::nodes(const std::string &name) {
+    auto it = mNodes.find(name);
+
+    if (it == mNodes.end()) {
+        auto port = mRoot + "/" + name;
+        auto partner = port + std::string(kPartnerSuffix);
+        SysfsReader reader({
+                {port + "/power_role"},
+                {port + "/data_role"},
+                {partner + "/supports_usb_power_delivery", false},
+                {partner + "/accessory_mode", false},
+        });
+        it = mNodes.emplace(name, std::move(reader)).first;
+    }
+
+    return &it->second;
+}
+
+bool TypeCTopology::readPort(Port *port) {
+    auto nodes = this->nodes(port->name);
+
+    if (nodes->read({POWER_ROLE, DATA_ROLE}) != 2) {
+        ALOGE("Failed to read the roles of %s", port->name.c_str());
+        return false;
+    }
+
+    port->powerRole = choice(*nodes->value(POWER_ROLE));
+    port->dataRole = choice(*nodes->value(DATA_ROLE));
+    return true;
+}
+
+bool TypeCTopology::readPartner(Port *port) {
+    auto nodes = this->nodes(port->name);
+
+    nodes->read({PARTNER_PD, PARTNER_ACCESSORY});
+    // a partner that does not say is taken not to support PD
+    port->pd = nodes->value(PARTNER_PD) == "yes";
+
+    if (!nodes->value(PARTNER_ACCESSORY)) {
+        ALOGE("Failed to read the accessory mode of %s", port->name.c_str());
+        return false;
+    }
+
+    port->accessory = choice(*nodes->value(PARTNER_ACCESSORY));
+    return true;
+}
+
+TypeCTopology::Port *TypeCTopology::find(const std::string &name) {
+    auto port = mPorts.find(name);
+    return port == mPorts.end() ? nullptr : &port->second;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "SysfsReader.h"
+#include "Uevent.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// A cache of the Type-C ports in sysfs and what is attached to them, kept
+// current from typec uevents so that reading the port status does not walk
+// sysfs. Anything the uevents do not account for, such as a port that is not
+// known or a node that cannot be read, drops the cache and the next snapshot
+// rescans sysfs.
+//
+// Uevents are only seen while they are being tracked; until then, every
+// snapshot rescans.
+class TypeCTopology {
+  public:
+    struct Port {
+        std::string name;
+        // A partner is attached.
+        bool connected = false;
+        // The partner supports USB Power Delivery.
+        bool pd = false;
+        // The selected roles, e.g. "sink" out of "source [sink]".
+        std::string powerRole;
+        std::string dataRole;
+        // The accessory mode of the partner, e.g. "none" or "analog_audio".
+        std::string accessory;
+
+        bool operator==(const Port &other) const;
+    };
+
+    // |root| is the class directory, normally /sys/class/typec.
+    explicit TypeCTopology(std::string root);
+
+    // Starts or stops keeping up with uevents. Starting should follow opening
+    // the uevent socket, so that no change goes unseen.
+    void track(bool enable);
+
+    // Applies a uevent, ignoring any that is not about a Type-C port or
+    // partner.
+    void update(const Uevent &event);
+
+    // Drops the cache, e.g. after writing a role or losing uevents.
+    void invalidate();
+
+    // Copies out the ports, sorted by name, rescanning first if needed.
+    // Returns false if sysfs could not be read.
+    bool snapshot(std::vector<Port> *ports);
+
+    // How many times sysfs was walked in full.
+    uint64_t rescans();
+
+  private:
+    bool rescanLocked();
+    bool readPort(Port *port);
+    bool readPartner(Port *port);
+    Port *find(const std::string &name);
+    // The nodes of a port and its partner, opened on first use.
+    SysfsReader *nodes(const std::string &name);
+
+  private:
+    const std::string mRoot;
+    std::mutex mLock;
+    std::map<std::string, Port> mPorts;
+    std::map<std::string, SysfsReader> mNodes;
+    bool mTracking = false;
+    bool mStale = true;
+    uint64_t mRescans = 0;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
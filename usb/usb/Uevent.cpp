@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Uevent.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+bool Uevent::parse(const char *msg, size_t len) {
+    const char *end = msg + len;
+    std::string_view header;
+
+    mSize = 0;
+    mRest = {};
+    mAction = mDevpath = mDevtype = {};
+
+    for (const char *cp = msg; cp < end;) {
+        auto nul = static_cast<const char *>(memchr(cp, '\0', end - cp));
+        std::string_view field(cp, (nul ? nul : end) - cp);
+
+        cp += field.size() + 1;
+        if (field.empty()) {
+            continue;
+        }
+
+        if (header.empty()) {
+            header = field;
+            continue;
+        }
+
+        if (mSize < kMaxFields) {
+            mFields[mSize++] = field;
+        } else if (mRest.empty()) {
+            mRest = std::string_view(field.data(), end - field.data());
+        }
+
+        auto eq = field.find('=');
+        if (eq == std::string_view::npos) {
+            continue;
+        }
+        auto key = field.substr(0, eq);
+        auto value = field.substr(eq + 1);
+
+        if (key == "ACTION") {
+            mAction = value;
+        } else if (key == "DEVPATH") {
+            mDevpath = value;
+        } else if (key == "DEVTYPE") {
+            mDevtype = value;
+        }
+    }
+
+    auto at = header.find('@');
+    if (at == std::string_view::npos) {
+        return false;
+    }
+
+    if (mAction.empty()) {
+        mAction = header.substr(0, at);
+    }
+    if (mDevpath.empty()) {
+        mDevpath = header.substr(at + 1);
+    }
+
+    return true;
+}
+
+namespace {
+
+std::optional<std::string_view> valueOf(std::string_view field, std::string_view key) {
+    if (field.size() > key.size() && field[key.size()] == '=' &&
+        field.substr(0, key.size()) == key) {
+        return field.substr(key.size() + 1);
+    }
+
+    return std::nullopt;
+}
+
+}  // namespace
+
+std::optional<std::string_view> Uevent::get(std::string_view key) const {
+    for (size_t i = 0; i < mSize; i++) {
+        if (auto value = valueOf(mFields[i], key)) {
+            return value;
+        }
+    }
+
+    // the rare message with more fields than kept
+    for (auto rest = mRest; !rest.empty();) {
+        auto field = rest.substr(0, rest.find('\0'));
+        rest.remove_prefix(std::min(field.size() + 1, rest.size()));
+        if (auto value = valueOf(field, key)) {
+            return value;
+        }
+    }
+
+    return std::nullopt;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
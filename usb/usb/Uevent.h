@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// A kernel uevent, split once into views of its NUL-separated fields:
+//
+//   add@/devices/.../typec/port0/port0-partner
+//   ACTION=add
+//   DEVPATH=/devices/.../typec/port0/port0-partner
+//   DEVTYPE=typec_partner
+//   ...
+//
+// Parsing neither copies nor allocates, so the views are only valid as long
+// as the message buffer.
+class Uevent {
+  public:
+    // Fields kept as views; typical Type-C and power supply uevents have well
+    // under this many. Those past it are not listed, though get() still finds
+    // them by scanning the rest of the message.
+    static constexpr size_t kMaxFields = 64;
+
+    // Parses |len| bytes of |msg|. Returns false if there is no header.
+    bool parse(const char *msg, size_t len);
+
+    // The ACTION and DEVPATH keys, or the header when they are absent.
+    std::string_view action() const { return mAction; }
+    std::string_view devpath() const { return mDevpath; }
+    std::string_view devtype() const { return mDevtype; }
+
+    // Returns the value of |key|, if the message has it.
+    std::optional<std::string_view> get(std::string_view key) const;
+
+    // The first kMaxFields KEY=value fields, without the header.
+    size_t size() const { return mSize; }
+    std::string_view operator[](size_t i) const { return mFields[i]; }
+
+  private:
+    std::array<std::string_view, kMaxFields> mFields;
+    size_t mSize = 0;
+    // the part of the message after the last field kept in mFields
+    std::string_view mRest;
+    std::string_view mAction;
+    std::string_view mDevpath;
+    std::string_view mDevtype;
+};
+
+// Allocation-free predicates on field values, built once at compile time.
+struct Exactly {
+    std::string_view value;
+
+    constexpr bool operator()(std::string_view s) const { return s == value; }
+};
+
+struct StartsWith {
+    std::string_view prefix;
+
+    constexpr bool operator()(std::string_view s) const {
+        return s.size() >= prefix.size() && s.substr(0, prefix.size()) == prefix;
+    }
+};
+
+struct EndsWith {
+    std::string_view suffix;
+
+    constexpr bool operator()(std::string_view s) const {
+        return s.size() >= suffix.size() && s.substr(s.size() - suffix.size()) == suffix;
+    }
+};
+
+// A Type-C partner was registered, e.g. after a role swap.
+inline bool isPartnerAdded(const Uevent &event) {
+    static constexpr Exactly kAdd{"add"};
+    static constexpr EndsWith kPartner{"-partner"};
+
+    return kAdd(event.action()) && kPartner(event.devpath());
+}
+
+// Something changed that may leave a disconnected port out of DRP mode.
+inline bool isPortChanged(const Uevent &event) {
+    static constexpr StartsWith kTypec{"typec_"};
+
+    return kTypec(event.devtype()) || event.get("POWER_SUPPLY_MOISTURE_DETECTED").has_value();
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
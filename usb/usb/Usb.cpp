@@ -23,18 +23,25 @@
 #include <dirent.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <chrono>
-#include <regex>
 #include <thread>
-#include <unordered_map>
 
 #include <cutils/uevent.h>
 #include <sys/epoll.h>
 #include <utils/Errors.h>
 #include <utils/StrongPointer.h>
 
+#include "Debouncer.h"
+#include "NotificationQueue.h"
+#include "Reactor.h"
+#include "RoleTransition.h"
+#include "SysfsReader.h"
+#include "Telemetry.h"
+#include "TypeCTopology.h"
+#include "Uevent.h"
 #include "Usb.h"
 
 using android::base::GetProperty;
@@ -45,17 +52,56 @@ namespace android {
 namespace hardware {
 namespace usb {
 
-// Set by the signal handler to destroy the thread
-volatile bool destroyThread;
-
 constexpr char kConsole[] = "init.svc.console";
 constexpr char kDetectedPath[] = "/sys/class/power_supply/usb/moisture_detected";
 constexpr char kDisableContatminantDetection[] = "vendor.usb.contaminantdisable";
 constexpr char kEnabledPath[] = "/sys/class/power_supply/usb/moisture_detection_enabled";
 constexpr char kTypecPath[] = "/sys/class/typec";
+// A plug or unplug raises a dozen or so uevents over a few tens of ms
+constexpr auto kPortStatusDebounce = std::chrono::milliseconds(50);
+// Data and power role swaps have completed by the time the write returns,
+// short of the roles being updated late
+constexpr auto kRoleSwapTimeout = std::chrono::milliseconds(1000);
+// Notifications are few and far between; this many queued means the
+// framework has stopped taking them
+constexpr size_t kMaxPendingNotifications = 32;
+
+// The nodes read for every port status, in the order given to mStatusNodes
+enum StatusNode : size_t {
+    MOISTURE_DETECTION_ENABLED,
+    MOISTURE_DETECTED,
+    SINK_LIMIT_ENABLED,
+};
 
 void queryVersionHelper(android::hardware::usb::Usb *usb,
-                        std::vector<PortStatus> *currentPortStatus);
+                        std::vector<PortStatus> *currentPortStatus,
+                        bool onlyIfChanged = false);
+static bool startWorker(android::hardware::usb::Usb *usb);
+
+// Queues |call| for the callback set now, to be made on the notification
+// thread. |name| identifies the call in the log if it fails.
+static void notifyCallback(android::hardware::usb::Usb *usb, const char *name,
+                           std::function<ScopedAStatus(IUsbCallback *)> call,
+                           bool latestOnly = false) {
+    pthread_mutex_lock(&usb->mLock);
+    shared_ptr<IUsbCallback> callback = usb->mCallback;
+    pthread_mutex_unlock(&usb->mLock);
+
+    if (callback == NULL) {
+        ALOGE("Not notifying the userspace. Callback is not set");
+        return;
+    }
+
+    usb->mNotifications.post(
+            [usb, callback, name, call = std::move(call), queued = Clock::now()] {
+                usb->mTelemetry.callbackQueueLatency.record(Clock::now() - queued);
+                ScopedLatency latency(&usb->mTelemetry.callbackLatency);
+                ScopedAStatus ret = call(callback.get());
+                if (!ret.isOk())
+                    ALOGE("%s error %s", name, ret.getDescription().c_str());
+            },
+            latestOnly);
+}
 
 ScopedAStatus Usb::enableUsbData(const string& in_portName, bool in_enable,
         int64_t in_transactionId) {
@@ -101,16 +147,10 @@ ScopedAStatus Usb::enableUsbData(const string& in_portName, bool in_enable,
     if (result) {
         mUsbDataEnabled = in_enable;
     }
-    pthread_mutex_lock(&mLock);
-    if (mCallback != NULL) {
-        ScopedAStatus ret = mCallback->notifyEnableUsbDataStatus(
+    notifyCallback(this, "notifyEnableUsbDataStatus", [=](IUsbCallback *callback) {
+        return callback->notifyEnableUsbDataStatus(
             in_portName, in_enable, result ? Status::SUCCESS : Status::ERROR, in_transactionId);
-        if (!ret.isOk())
-            ALOGE("notifyEnableUsbDataStatus error %s", ret.getDescription().c_str());
-    } else {
-        ALOGE("Not notifying the userspace. Callback is not set");
-    }
-    pthread_mutex_unlock(&mLock);
+    });
     queryVersionHelper(this, &currentPortStatus);
 
     return ScopedAStatus::ok();
@@ -122,16 +162,10 @@ ScopedAStatus Usb::enableUsbDataWhileDocked(const string& in_portName,
 
     ALOGI("Userspace enableUsbDataWhileDocked  opID:%ld", in_transactionId);
 
-    pthread_mutex_lock(&mLock);
-    if (mCallback != NULL) {
-        ScopedAStatus ret = mCallback->notifyEnableUsbDataWhileDockedStatus(
+    notifyCallback(this, "notifyEnableUsbDataWhileDockedStatus", [=](IUsbCallback *callback) {
+        return callback->notifyEnableUsbDataWhileDockedStatus(
                 in_portName, Status::NOT_SUPPORTED, in_transactionId);
-        if (!ret.isOk())
-            ALOGE("notifyEnableUsbDataStatus error %s", ret.getDescription().c_str());
-    } else {
-        ALOGE("Not notifying the userspace. Callback is not set");
-    }
-    pthread_mutex_unlock(&mLock);
+    });
     queryVersionHelper(this, &currentPortStatus);
 
     return ScopedAStatus::ok();
@@ -148,16 +182,10 @@ ScopedAStatus Usb::resetUsbPort(const std::string& in_portName, int64_t in_trans
         result = false;
     }
 
-    pthread_mutex_lock(&mLock);
-    if (mCallback != NULL) {
-        ::ndk::ScopedAStatus ret = mCallback->notifyResetUsbPortStatus(
+    notifyCallback(this, "notifyTransactionStatus", [=](IUsbCallback *callback) {
+        return callback->notifyResetUsbPortStatus(
             in_portName, result ? Status::SUCCESS : Status::ERROR, in_transactionId);
-        if (!ret.isOk())
-            ALOGE("notifyTransactionStatus error %s", ret.getDescription().c_str());
-    } else {
-        ALOGE("Not notifying the userspace. Callback is not set");
-    }
-    pthread_mutex_unlock(&mLock);
+    });
 
     return ::ndk::ScopedAStatus::ok();
 }
@@ -190,24 +218,23 @@ ScopedAStatus Usb::limitPowerTransfer(const string& in_portName, bool in_limit,
         sessionFail = true;
     }
 
-    if (mCallback != NULL && in_transactionId >= 0) {
-        ScopedAStatus ret = mCallback->notifyLimitPowerTransferStatus(
-                in_portName, in_limit, sessionFail ? Status::ERROR : Status::SUCCESS,
-                in_transactionId);
-        if (!ret.isOk())
-            ALOGE("limitPowerTransfer error %s", ret.getDescription().c_str());
-    } else {
-        ALOGE("Not notifying the userspace. Callback is not set");
-    }
-
     pthread_mutex_unlock(&mLock);
+
+    if (in_transactionId >= 0) {
+        notifyCallback(this, "limitPowerTransfer", [=](IUsbCallback *callback) {
+            return callback->notifyLimitPowerTransferStatus(
+                    in_portName, in_limit, sessionFail ? Status::ERROR : Status::SUCCESS,
+                    in_transactionId);
+        });
+    }
     queryVersionHelper(this, &currentPortStatus);
 
     return ScopedAStatus::ok();
 }
 
-Status queryMoistureDetectionStatus(std::vector<PortStatus> *currentPortStatus) {
-    string enabled, status, path, DetectedPath;
+Status queryMoistureDetectionStatus(const SysfsReader &nodes,
+                                   std::vector<PortStatus> *currentPortStatus) {
+    std::optional<std::string_view> enabled, status;
 
     (*currentPortStatus)[0].supportedContaminantProtectionModes
             .push_back(ContaminantProtectionMode::FORCE_DISABLE);
@@ -216,19 +243,19 @@ Status queryMoistureDetectionStatus(std::vector<PortStatus> *currentPortStatus)
     (*currentPortStatus)[0].supportsEnableContaminantPresenceDetection = true;
     (*currentPortStatus)[0].supportsEnableContaminantPresenceProtection = false;
 
-    if (!ReadFileToString(kEnabledPath, &enabled)) {
+    enabled = nodes.value(MOISTURE_DETECTION_ENABLED);
+    if (!enabled) {
         ALOGE("Failed to open moisture_detection_enabled");
         return Status::ERROR;
     }
 
-    enabled = Trim(enabled);
-    if (enabled == "1") {
-        if (!ReadFileToString(kDetectedPath, &status)) {
+    if (*enabled == "1") {
+        status = nodes.value(MOISTURE_DETECTED);
+        if (!status) {
             ALOGE("Failed to open moisture_detected");
             return Status::ERROR;
         }
-        status = Trim(status);
-        if (status == "1") {
+        if (*status == "1") {
             (*currentPortStatus)[0].contaminantDetectionStatus =
                 ContaminantDetectionStatus::DETECTED;
             (*currentPortStatus)[0].contaminantProtectionStatus =
@@ -239,7 +266,7 @@ Status queryMoistureDetectionStatus(std::vector<PortStatus> *currentPortStatus)
         }
     }
 
-    ALOGI("ContaminantDetectionStatus:%d ContaminantProtectionStatus:%d",
+    ALOGV("ContaminantDetectionStatus:%d ContaminantProtectionStatus:%d",
             (*currentPortStatus)[0].contaminantDetectionStatus,
             (*currentPortStatus)[0].contaminantProtectionStatus);
 
@@ -281,17 +308,6 @@ string convertRoletoString(PortRole role) {
     return "none";
 }
 
-void extractRole(string *roleName) {
-    std::size_t first, last;
-
-    first = roleName->find("[");
-    last = roleName->find("]");
-
-    if (first != string::npos && last != string::npos) {
-        *roleName = roleName->substr(first + 1, last - first - 1);
-    }
-}
-
 void switchToDrp(const string &portName) {
     string filename = appendRoleNodeHelper(string(portName.c_str()), PortRole::mode);
     FILE *fp;
@@ -311,9 +327,41 @@ void switchToDrp(const string &portName) {
     }
 }
 
+// Waits for the role transition in progress to complete. The write may have
+// taken effect already, so sysfs is checked first.
+static bool waitForRole(struct Usb *usb, std::chrono::milliseconds timeout) {
+    std::vector<TypeCTopology::Port> ports;
+    std::chrono::microseconds latency;
+
+    usb->mTopology.invalidate();
+    if (usb->mTopology.snapshot(&ports))
+        usb->mRoleTransition.observe(ports);
+
+    RoleTransition::Result result = usb->mRoleTransition.wait(timeout, &latency);
+    usb->mTelemetry.roleSwitchLatency.record(latency);
+
+    switch (result) {
+        case RoleTransition::Result::DONE:
+            usb->mTelemetry.roleSwitchesDone.inc();
+            ALOGI("role transition done in %lld us", static_cast<long long>(latency.count()));
+            return true;
+        case RoleTransition::Result::TIMED_OUT:
+            usb->mTelemetry.roleSwitchesTimedOut.inc();
+            ALOGI("role transition timed out after %lld us",
+                  static_cast<long long>(latency.count()));
+            return false;
+        case RoleTransition::Result::CANCELLED:
+            usb->mTelemetry.roleSwitchesCancelled.inc();
+            ALOGI("role transition cancelled after %lld us",
+                  static_cast<long long>(latency.count()));
+            return false;
+    }
+
+    return false;
+}
+
 bool switchMode(const string &portName, const PortRole &in_role, struct Usb *usb) {
     string filename = appendRoleNodeHelper(string(portName.c_str()), in_role.getTag());
-    string written;
     FILE *fp;
     bool roleSwitch = false;
 
@@ -324,38 +372,22 @@ bool switchMode(const string &portName, const PortRole &in_role, struct Usb *usb
 
     fp = fopen(filename.c_str(), "w");
     if (fp != NULL) {
-        // Hold the lock here to prevent loosing connected signals
-        // as once the file is written the partner added signal
-        // can arrive anytime.
-        pthread_mutex_lock(&usb->mPartnerLock);
-        usb->mPartnerUp = false;
+        // Start tracking before the write, as once the file is written the
+        // partner can come back in the new role anytime.
+        usb->mRoleTransition.begin({
+                .port = portName,
+                .powerRole = convertRoletoString(in_role),
+                .connected = true,
+        });
         int ret = fputs(convertRoletoString(in_role).c_str(), fp);
         fclose(fp);
 
         if (ret != EOF) {
-            struct timespec to;
-            struct timespec now;
-
-        wait_again:
-            clock_gettime(CLOCK_MONOTONIC, &now);
-            to.tv_sec = now.tv_sec + PORT_TYPE_TIMEOUT;
-            to.tv_nsec = now.tv_nsec;
-
-            int err = pthread_cond_timedwait(&usb->mPartnerCV, &usb->mPartnerLock, &to);
-            // There are no uevent signals which implies role swap timed out.
-            if (err == ETIMEDOUT) {
-                ALOGI("uevents wait timedout");
-                // Validity check.
-            } else if (!usb->mPartnerUp) {
-                goto wait_again;
-                // Role switch succeeded since usb->mPartnerUp is true.
-            } else {
-                roleSwitch = true;
-            }
+            roleSwitch = waitForRole(usb, std::chrono::seconds(PORT_TYPE_TIMEOUT));
         } else {
+            usb->mRoleTransition.cancel();
             ALOGI("Role switch failed while wrting to file");
         }
-        pthread_mutex_unlock(&usb->mPartnerLock);
     }
 
     if (!roleSwitch)
@@ -367,32 +399,18 @@ bool switchMode(const string &portName, const PortRole &in_role, struct Usb *usb
 Usb::Usb()
     : mLock(PTHREAD_MUTEX_INITIALIZER),
       mRoleSwitchLock(PTHREAD_MUTEX_INITIALIZER),
-      mPartnerLock(PTHREAD_MUTEX_INITIALIZER),
-      mPartnerUp(false),
-      mUsbDataEnabled(true) {
-    pthread_condattr_t attr;
-    if (pthread_condattr_init(&attr)) {
-        ALOGE("pthread_condattr_init failed: %s", strerror(errno));
-        abort();
-    }
-    if (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC)) {
-        ALOGE("pthread_condattr_setclock failed: %s", strerror(errno));
-        abort();
-    }
-    if (pthread_cond_init(&mPartnerCV, &attr)) {
-        ALOGE("pthread_cond_init failed: %s", strerror(errno));
-        abort();
-    }
-    if (pthread_condattr_destroy(&attr)) {
-        ALOGE("pthread_condattr_destroy failed: %s", strerror(errno));
-        abort();
-    }
+      mStatusLock(PTHREAD_MUTEX_INITIALIZER),
+      mUsbDataEnabled(true),
+      mTopology(kTypecPath),
+      mStatusNodes({{kEnabledPath}, {kDetectedPath}, {SINK_LIMIT_ENABLE_PATH}}),
+      mNotifications(kMaxPendingNotifications) {
+    if (!startWorker(this))
+        ALOGE("uevent worker failed to start; port status will not be updated");
 }
 
 ScopedAStatus Usb::switchRole(const string& in_portName, const PortRole& in_role,
         int64_t in_transactionId) {
     string filename = appendRoleNodeHelper(string(in_portName.c_str()), in_role.getTag());
-    string written;
     FILE *fp;
     bool roleSwitch = false;
 
@@ -410,18 +428,22 @@ ScopedAStatus Usb::switchRole(const string& in_portName, const PortRole& in_role
     } else {
         fp = fopen(filename.c_str(), "w");
         if (fp != NULL) {
-            int ret = fputs(convertRoletoString(in_role).c_str(), fp);
+            string role = convertRoletoString(in_role);
+            bool power = in_role.getTag() == PortRole::powerRole;
+
+            mRoleTransition.begin({
+                    .port = in_portName,
+                    .powerRole = power ? role : "",
+                    .dataRole = power ? "" : role,
+            });
+            int ret = fputs(role.c_str(), fp);
             fclose(fp);
-            if ((ret != EOF) && ReadFileToString(filename, &written)) {
-                written = Trim(written);
-                extractRole(&written);
-                ALOGI("written: %s", written.c_str());
-                if (written == convertRoletoString(in_role)) {
-                    roleSwitch = true;
-                } else {
+            if (ret != EOF) {
+                roleSwitch = waitForRole(this, kRoleSwapTimeout);
+                if (!roleSwitch)
                     ALOGE("Role switch failed");
-                }
             } else {
+                mRoleTransition.cancel();
                 ALOGE("failed to update the new role");
             }
         } else {
@@ -429,75 +451,47 @@ ScopedAStatus Usb::switchRole(const string& in_portName, const PortRole& in_role
         }
     }
 
-    pthread_mutex_lock(&mLock);
-    if (mCallback != NULL) {
-         ScopedAStatus ret = mCallback->notifyRoleSwitchStatus(
+    // the new roles are read back rather than waiting for their uevents
+    mTopology.invalidate();
+
+    notifyCallback(this, "RoleSwitchStatus", [=](IUsbCallback *callback) {
+        return callback->notifyRoleSwitchStatus(
             in_portName, in_role, roleSwitch ? Status::SUCCESS : Status::ERROR, in_transactionId);
-        if (!ret.isOk())
-            ALOGE("RoleSwitchStatus error %s", ret.getDescription().c_str());
-    } else {
-        ALOGE("Not notifying the userspace. Callback is not set");
-    }
-    pthread_mutex_unlock(&mLock);
+    });
     pthread_mutex_unlock(&mRoleSwitchLock);
 
     return ScopedAStatus::ok();
 }
 
-Status getAccessoryConnected(const string &portName, string *accessory) {
-    string filename = "/sys/class/typec/" + portName + "-partner/accessory_mode";
-
-    if (!ReadFileToString(filename, accessory)) {
-        ALOGE("getAccessoryConnected: Failed to open filesystem node: %s", filename.c_str());
-        return Status::ERROR;
-    }
-    *accessory = Trim(*accessory);
-
-    return Status::SUCCESS;
-}
-
-Status getCurrentRoleHelper(const string &portName, bool connected, PortRole *currentRole) {
-    string filename;
+Status getCurrentRoleHelper(const TypeCTopology::Port &port, PortRole *currentRole) {
     string roleName;
-    string accessory;
 
     if (currentRole->getTag() == PortRole::powerRole) {
-        filename = "/sys/class/typec/" + portName + "/power_role";
+        roleName = port.powerRole;
         currentRole->set<PortRole::powerRole>(PortPowerRole::NONE);
     } else if (currentRole->getTag() == PortRole::dataRole) {
-        filename = "/sys/class/typec/" + portName + "/data_role";
+        roleName = port.dataRole;
         currentRole->set<PortRole::dataRole>(PortDataRole::NONE);
     } else if (currentRole->getTag() == PortRole::mode) {
-        filename = "/sys/class/typec/" + portName + "/data_role";
+        roleName = port.dataRole;
         currentRole->set<PortRole::mode>(PortMode::NONE);
     } else {
         return Status::ERROR;
     }
 
-    if (!connected)
+    if (!port.connected)
         return Status::SUCCESS;
 
     if (currentRole->getTag() == PortRole::mode) {
-        if (getAccessoryConnected(portName, &accessory) != Status::SUCCESS) {
-            return Status::ERROR;
-        }
-        if (accessory == "analog_audio") {
+        if (port.accessory == "analog_audio") {
             currentRole->set<PortRole::mode>(PortMode::AUDIO_ACCESSORY);
             return Status::SUCCESS;
-        } else if (accessory == "debug") {
+        } else if (port.accessory == "debug") {
             currentRole->set<PortRole::mode>(PortMode::DEBUG_ACCESSORY);
             return Status::SUCCESS;
         }
     }
 
-    if (!ReadFileToString(filename, &roleName)) {
-        ALOGE("getCurrentRole: Failed to open filesystem node: %s", filename.c_str());
-        return Status::ERROR;
-    }
-
-    roleName = Trim(roleName);
-    extractRole(&roleName);
-
     if (roleName == "source") {
         currentRole->set<PortRole::powerRole>(PortPowerRole::SOURCE);
     } else if (roleName == "sink") {
@@ -521,64 +515,21 @@ Status getCurrentRoleHelper(const string &portName, bool connected, PortRole *cu
     return Status::SUCCESS;
 }
 
-Status getTypeCPortNamesHelper(std::unordered_map<string, bool> *names) {
-    DIR *dp;
-
-    dp = opendir(kTypecPath);
-    if (dp != NULL) {
-        struct dirent *ep;
-
-        while ((ep = readdir(dp))) {
-            if (ep->d_type == DT_LNK) {
-                if (string::npos == string(ep->d_name).find("-partner")) {
-                    std::unordered_map<string, bool>::const_iterator portName =
-                        names->find(ep->d_name);
-                    if (portName == names->end()) {
-                        names->insert({ep->d_name, false});
-                    }
-                } else {
-                    (*names)[std::strtok(ep->d_name, "-")] = true;
-                }
-            }
-        }
-        closedir(dp);
-        return Status::SUCCESS;
-    }
-
-    ALOGE("Failed to open /sys/class/typec");
-    return Status::ERROR;
-}
-
-bool canSwitchRoleHelper(const string &portName) {
-    string filename = "/sys/class/typec/" + portName + "-partner/supports_usb_power_delivery";
-    string supportsPD;
-
-    if (ReadFileToString(filename, &supportsPD)) {
-        supportsPD = Trim(supportsPD);
-        if (supportsPD == "yes") {
-            return true;
-        }
-    }
-
-    return false;
-}
-
 Status getPortStatusHelper(android::hardware::usb::Usb *usb,
         std::vector<PortStatus> *currentPortStatus) {
-    std::unordered_map<string, bool> names;
-    Status result = getTypeCPortNamesHelper(&names);
+    std::vector<TypeCTopology::Port> ports;
     int i = -1;
 
-    if (result == Status::SUCCESS) {
-        currentPortStatus->resize(names.size());
-        for (std::pair<string, bool> port : names) {
+    if (usb->mTopology.snapshot(&ports)) {
+        currentPortStatus->resize(ports.size());
+        for (const TypeCTopology::Port &port : ports) {
             i++;
-            ALOGI("%s", port.first.c_str());
-            (*currentPortStatus)[i].portName = port.first;
+            ALOGV("%s", port.name.c_str());
+            (*currentPortStatus)[i].portName = port.name;
 
             PortRole currentRole;
             currentRole.set<PortRole::powerRole>(PortPowerRole::NONE);
-            if (getCurrentRoleHelper(port.first, port.second, &currentRole) == Status::SUCCESS){
+            if (getCurrentRoleHelper(port, &currentRole) == Status::SUCCESS){
                 (*currentPortStatus)[i].currentPowerRole = currentRole.get<PortRole::powerRole>();
             } else {
                 ALOGE("Error while retrieving portNames");
@@ -586,7 +537,7 @@ Status getPortStatusHelper(android::hardware::usb::Usb *usb,
             }
 
             currentRole.set<PortRole::dataRole>(PortDataRole::NONE);
-            if (getCurrentRoleHelper(port.first, port.second, &currentRole) == Status::SUCCESS) {
+            if (getCurrentRoleHelper(port, &currentRole) == Status::SUCCESS) {
                 (*currentPortStatus)[i].currentDataRole = currentRole.get<PortRole::dataRole>();
             } else {
                 ALOGE("Error while retrieving current port role");
@@ -594,7 +545,7 @@ Status getPortStatusHelper(android::hardware::usb::Usb *usb,
             }
 
             currentRole.set<PortRole::mode>(PortMode::NONE);
-            if (getCurrentRoleHelper(port.first, port.second, &currentRole) == Status::SUCCESS) {
+            if (getCurrentRoleHelper(port, &currentRole) == Status::SUCCESS) {
                 (*currentPortStatus)[i].currentMode = currentRole.get<PortRole::mode>();
             } else {
                 ALOGE("Error while retrieving current data role");
@@ -602,10 +553,8 @@ Status getPortStatusHelper(android::hardware::usb::Usb *usb,
             }
 
             (*currentPortStatus)[i].canChangeMode = true;
-            (*currentPortStatus)[i].canChangeDataRole =
-                port.second ? canSwitchRoleHelper(port.first) : false;
-            (*currentPortStatus)[i].canChangePowerRole =
-                port.second ? canSwitchRoleHelper(port.first) : false;
+            (*currentPortStatus)[i].canChangeDataRole = port.connected ? port.pd : false;
+            (*currentPortStatus)[i].canChangePowerRole = port.connected ? port.pd : false;
 
             (*currentPortStatus)[i].supportedModes.push_back(PortMode::DRP);
 
@@ -616,9 +565,9 @@ Status getPortStatusHelper(android::hardware::usb::Usb *usb,
             }
             (*currentPortStatus)[i].powerBrickStatus = PowerBrickStatus::UNKNOWN;
 
-            ALOGI("%d:%s connected:%d canChangeMode:%d canChagedata:%d canChangePower:%d "
+            ALOGV("%d:%s connected:%d canChangeMode:%d canChagedata:%d canChangePower:%d "
                 "usbDataEnabled:%d",
-                i, port.first.c_str(), port.second,
+                i, port.name.c_str(), port.connected,
                 (*currentPortStatus)[i].canChangeMode,
                 (*currentPortStatus)[i].canChangeDataRole,
                 (*currentPortStatus)[i].canChangePowerRole,
@@ -630,53 +579,62 @@ done:
     return Status::ERROR;
 }
 
-Status queryPowerTransferStatus(std::vector<PortStatus> *currentPortStatus) {
-    string enabled;
+Status queryPowerTransferStatus(const SysfsReader &nodes,
+                                std::vector<PortStatus> *currentPortStatus) {
+    std::optional<std::string_view> enabled = nodes.value(SINK_LIMIT_ENABLED);
 
-    if (!ReadFileToString(SINK_LIMIT_ENABLE_PATH, &enabled)) {
+    if (!enabled) {
         ALOGE("Failed to open limit_sink_enable");
         return Status::ERROR;
     }
 
-    enabled = Trim(enabled);
-    (*currentPortStatus)[0].powerTransferLimited = enabled == "1";
+    (*currentPortStatus)[0].powerTransferLimited = *enabled == "1";
 
-    ALOGI("powerTransferLimited:%d", (*currentPortStatus)[0].powerTransferLimited ? 1 : 0);
+    ALOGV("powerTransferLimited:%d", (*currentPortStatus)[0].powerTransferLimited ? 1 : 0);
     return Status::SUCCESS;
 }
 
 void queryVersionHelper(android::hardware::usb::Usb *usb,
-                        std::vector<PortStatus> *currentPortStatus) {
+                        std::vector<PortStatus> *currentPortStatus,
+                        bool onlyIfChanged) {
     Status status;
+    bool changed;
+
+    // sysfs is read without mLock, so that no callback waits on it, but one
+    // query at a time, so that the statuses are queued in the order read
+    pthread_mutex_lock(&usb->mStatusLock);
+    {
+        ScopedLatency latency(&usb->mTelemetry.statusLatency);
+        status = getPortStatusHelper(usb, currentPortStatus);
+        // all in one go, as they are read for every status
+        usb->mStatusNodes.read();
+        queryMoistureDetectionStatus(usb->mStatusNodes, currentPortStatus);
+        queryPowerTransferStatus(usb->mStatusNodes, currentPortStatus);
+    }
+
     pthread_mutex_lock(&usb->mLock);
-    status = getPortStatusHelper(usb, currentPortStatus);
-    queryMoistureDetectionStatus(currentPortStatus);
-    queryPowerTransferStatus(currentPortStatus);
-    if (usb->mCallback != NULL) {
-        ScopedAStatus ret = usb->mCallback->notifyPortStatusChange(*currentPortStatus,
-            status);
-        if (!ret.isOk())
-            ALOGE("queryPortStatus error %s", ret.getDescription().c_str());
+    changed = usb->mPortStatusFilter.changed({status, *currentPortStatus});
+    pthread_mutex_unlock(&usb->mLock);
+
+    if (onlyIfChanged && !changed) {
+        ALOGV("Notifying userspace skipped. Port status unchanged");
     } else {
-        ALOGI("Notifying userspace skipped. Callback is NULL");
+        notifyCallback(usb, "queryPortStatus",
+                       [ports = *currentPortStatus, status](IUsbCallback *callback) {
+                           return callback->notifyPortStatusChange(ports, status);
+                       },
+                       true);
     }
-    pthread_mutex_unlock(&usb->mLock);
+    pthread_mutex_unlock(&usb->mStatusLock);
 }
 
 ScopedAStatus Usb::queryPortStatus(int64_t in_transactionId) {
     std::vector<PortStatus> currentPortStatus;
 
     queryVersionHelper(this, &currentPortStatus);
-    pthread_mutex_lock(&mLock);
-    if (mCallback != NULL) {
-        ScopedAStatus ret = mCallback->notifyQueryPortStatus(
-            "all", Status::SUCCESS, in_transactionId);
-        if (!ret.isOk())
-            ALOGE("notifyQueryPortStatus error %s", ret.getDescription().c_str());
-    } else {
-        ALOGE("Not notifying the userspace. Callback is not set");
-    }
-    pthread_mutex_unlock(&mLock);
+    notifyCallback(this, "notifyQueryPortStatus", [=](IUsbCallback *callback) {
+        return callback->notifyQueryPortStatus("all", Status::SUCCESS, in_transactionId);
+    });
 
     return ScopedAStatus::ok();
 }
@@ -691,183 +649,176 @@ ScopedAStatus Usb::enableContaminantPresenceDetection(const string& in_portName,
     if (status != "running" && disable != "true")
         success = WriteStringToFile(in_enable ? "1" : "0", kEnabledPath);
 
-    pthread_mutex_lock(&mLock);
-    if (mCallback != NULL) {
-        ScopedAStatus ret = mCallback->notifyContaminantEnabledStatus(
+    notifyCallback(this, "notifyContaminantEnabledStatus", [=](IUsbCallback *callback) {
+        return callback->notifyContaminantEnabledStatus(
             in_portName, in_enable, success ? Status::SUCCESS : Status::ERROR, in_transactionId);
-        if (!ret.isOk())
-            ALOGE("notifyContaminantEnabledStatus error %s", ret.getDescription().c_str());
-    } else {
-        ALOGE("Not notifying the userspace. Callback is not set");
-    }
-    pthread_mutex_unlock(&mLock);
+    });
 
     queryVersionHelper(this, &currentPortStatus);
     return ScopedAStatus::ok();
 }
 
-struct data {
-    int uevent_fd;
-    ::aidl::android::hardware::usb::Usb *usb;
-};
-
-static void uevent_event(uint32_t /*epevents*/, struct data *payload) {
-    char msg[UEVENT_MSG_LEN + 2];
-    char *cp;
-    int n;
-
-    n = uevent_kernel_multicast_recv(payload->uevent_fd, msg, UEVENT_MSG_LEN);
-    if (n <= 0)
-        return;
-    if (n >= UEVENT_MSG_LEN) /* overflow -- discard */
-        return;
-
-    msg[n] = '\0';
-    msg[n + 1] = '\0';
-    cp = msg;
-
-    while (*cp) {
-        if (std::regex_match(cp, std::regex("(add)(.*)(-partner)"))) {
-            ALOGI("partner added");
-            pthread_mutex_lock(&payload->usb->mPartnerLock);
-            payload->usb->mPartnerUp = true;
-            pthread_cond_signal(&payload->usb->mPartnerCV);
-            pthread_mutex_unlock(&payload->usb->mPartnerLock);
-        } else if (!strncmp(cp, "DEVTYPE=typec_", strlen("DEVTYPE=typec_")) ||
-                   !strncmp(cp, "POWER_SUPPLY_MOISTURE_DETECTED",
-                            strlen("POWER_SUPPLY_MOISTURE_DETECTED"))) {
-            std::vector<PortStatus> currentPortStatus;
-            queryVersionHelper(payload->usb, &currentPortStatus);
-
-            // Role switch is not in progress and port is in disconnected state
-            if (!pthread_mutex_trylock(&payload->usb->mRoleSwitchLock)) {
-                for (unsigned long i = 0; i < currentPortStatus.size(); i++) {
-                    DIR *dp =
-                        opendir(string("/sys/class/typec/" +
-                                            string(currentPortStatus[i].portName.c_str()) +
-                                            "-partner").c_str());
-                    if (dp == NULL) {
-                        switchToDrp(currentPortStatus[i].portName);
-                    } else {
-                        closedir(dp);
-                    }
-                }
-                pthread_mutex_unlock(&payload->usb->mRoleSwitchLock);
+// Runs once a burst of port uevents has settled.
+static void refreshPortStatus(::aidl::android::hardware::usb::Usb *usb) {
+    std::vector<PortStatus> currentPortStatus;
+    usb->mTelemetry.refreshes.inc();
+    queryVersionHelper(usb, &currentPortStatus, true);
+
+    // Role switch is not in progress and port is in disconnected state
+    if (!pthread_mutex_trylock(&usb->mRoleSwitchLock)) {
+        for (unsigned long i = 0; i < currentPortStatus.size(); i++) {
+            DIR *dp = opendir(string("/sys/class/typec/" +
+                                     string(currentPortStatus[i].portName.c_str()) +
+                                     "-partner").c_str());
+            if (dp == NULL) {
+                switchToDrp(currentPortStatus[i].portName);
+                usb->mTopology.invalidate();
+            } else {
+                closedir(dp);
             }
-            break;
-        }
-        /* advance to after the next \0 */
-        while (*cp++) {
         }
+        pthread_mutex_unlock(&usb->mRoleSwitchLock);
     }
 }
 
-void *work(void *param) {
-    int epoll_fd, uevent_fd;
-    struct epoll_event ev;
-    int nevents = 0;
-    struct data payload;
-
-    ALOGE("creating thread");
-
-    uevent_fd = uevent_open_socket(64 * 1024, true);
+static void uevent_event(::aidl::android::hardware::usb::Usb *usb, int uevent_fd,
+                         Debouncer *refresh) {
+    char msg[UEVENT_MSG_LEN + 2];
+    Uevent event;
+    int n;
 
-    if (uevent_fd < 0) {
-        ALOGE("uevent_init: uevent_open_socket failed\n");
-        return NULL;
+    n = uevent_kernel_multicast_recv(uevent_fd, msg, UEVENT_MSG_LEN);
+    if (n <= 0) {
+        /* uevents were dropped, the port topology may have missed some */
+        if (errno == ENOBUFS) {
+            usb->mTelemetry.ueventsLost.inc();
+            usb->mTopology.invalidate();
+        }
+        return;
     }
 
-    payload.uevent_fd = uevent_fd;
-    payload.usb = (::aidl::android::hardware::usb::Usb *)param;
+    ScopedLatency latency(&usb->mTelemetry.ueventLatency);
+    usb->mTelemetry.uevents.inc();
+    if (n >= UEVENT_MSG_LEN) { /* overflow -- discard */
+        usb->mTelemetry.ueventsLost.inc();
+        usb->mTopology.invalidate();
+        return;
+    }
+    if (!event.parse(msg, n))
+        return;
 
-    fcntl(uevent_fd, F_SETFL, O_NONBLOCK);
+    usb->mTelemetry.recentUevents.record(event);
+    usb->mTopology.update(event);
 
-    ev.events = EPOLLIN;
-    ev.data.ptr = (void *)uevent_event;
+    if (isPartnerAdded(event))
+        ALOGV("partner added");
 
-    epoll_fd = epoll_create(64);
-    if (epoll_fd == -1) {
-        ALOGE("epoll_create failed; errno=%d", errno);
-        goto error;
+    if (usb->mRoleTransition.pending()) {
+        std::vector<TypeCTopology::Port> ports;
+        if (usb->mTopology.snapshot(&ports))
+            usb->mRoleTransition.observe(ports);
     }
 
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, uevent_fd, &ev) == -1) {
-        ALOGE("epoll_ctl failed; errno=%d", errno);
-        goto error;
+    if (isPortChanged(event)) {
+        usb->mTelemetry.portUevents.inc();
+        refresh->mark();
     }
+}
 
-    while (!destroyThread) {
-        struct epoll_event events[64];
-
-        nevents = epoll_wait(epoll_fd, events, 64, -1);
-        if (nevents == -1) {
-            if (errno == EINTR)
-                continue;
-            ALOGE("usb epoll_wait failed; errno=%d", errno);
-            break;
-        }
+// Sets up the uevent socket and the port status refresh on the worker, which
+// runs for as long as the service does, whether or not a callback is set.
+static bool startWorker(::aidl::android::hardware::usb::Usb *usb) {
+    ::android::base::unique_fd uevent_fd(uevent_open_socket(64 * 1024, true));
 
-        for (int n = 0; n < nevents; ++n) {
-            if (events[n].data.ptr)
-                (*(void (*)(int, struct data *payload))events[n].data.ptr)(events[n].events,
-                                                                           &payload);
-        }
+    if (uevent_fd < 0) {
+        ALOGE("uevent_init: uevent_open_socket failed\n");
+        return false;
     }
+    fcntl(uevent_fd, F_SETFL, O_NONBLOCK);
 
-    ALOGI("exiting worker thread");
-error:
-    close(uevent_fd);
-
-    if (epoll_fd >= 0)
-        close(epoll_fd);
+    // shared by the handlers, which the worker keeps until it is destroyed
+    auto refresh = std::make_shared<Debouncer>(kPortStatusDebounce,
+                                               [usb] { refreshPortStatus(usb); });
+    int fd = uevent_fd.get();
 
-    return NULL;
-}
+    if (!usb->mWorker.add(std::move(uevent_fd), [usb, fd, refresh](uint32_t) {
+            uevent_event(usb, fd, refresh.get());
+        }))
+        return false;
+    if (!usb->mWorker.add(refresh->fd(), [refresh](uint32_t) { refresh->fire(); }))
+        return false;
 
-void sighandler(int sig) {
-    if (sig == SIGUSR1) {
-        destroyThread = true;
-        ALOGI("destroy set");
-        return;
+    usb->mTopology.track(true);
+    if (!usb->mWorker.start([usb] {
+            ALOGI("exiting worker thread");
+            usb->mTopology.track(false);
+            // no more uevents will tell how a role switch went
+            usb->mRoleTransition.cancel();
+        })) {
+        usb->mTopology.track(false);
+        return false;
     }
-    signal(SIGUSR1, sighandler);
+
+    return true;
 }
 
 ScopedAStatus Usb::setCallback(const shared_ptr<IUsbCallback>& in_callback) {
     pthread_mutex_lock(&mLock);
-    if ((mCallback == NULL && in_callback == NULL) ||
-            (mCallback != NULL && in_callback != NULL)) {
-        mCallback = in_callback;
-        pthread_mutex_unlock(&mLock);
-        return ScopedAStatus::ok();
-    }
-
+    // a new callback has not been told the port status yet
+    mPortStatusFilter.reset();
+    // the worker keeps running either way, only who gets told changes
+    if ((mCallback == NULL) != (in_callback == NULL))
+        ALOGI("%s callback", in_callback == NULL ? "unregistering" : "registering");
     mCallback = in_callback;
-    ALOGI("registering callback");
+    pthread_mutex_unlock(&mLock);
+    return ScopedAStatus::ok();
+}
 
-    if (mCallback == NULL) {
-        if  (!pthread_kill(mPoll, SIGUSR1)) {
-            pthread_join(mPoll, NULL);
-            ALOGI("pthread destroyed");
-        }
-        pthread_mutex_unlock(&mLock);
-        return ScopedAStatus::ok();
-    }
+binder_status_t Usb::dump(int fd, const char **args, uint32_t numArgs) {
+    std::vector<TypeCTopology::Port> ports;
 
-    destroyThread = false;
-    signal(SIGUSR1, sighandler);
+    if (fd < 0) {
+        ALOGE("Called debug() with invalid fd.");
+        return STATUS_OK;
+    }
 
-    /*
-     * Create a background thread if the old callback value is NULL
-     * and being updated with a new value.
-     */
-    if (pthread_create(&mPoll, NULL, work, this)) {
-        ALOGE("pthread creation failed %d", errno);
-        mCallback = NULL;
+    for (uint32_t i = 0; i < numArgs; i++) {
+        if (!strcmp(args[i], "--reset-latency")) {
+            mTelemetry.resetLatencies();
+            dprintf(fd, "Latency histograms reset\n");
+            return STATUS_OK;
+        }
     }
 
+    dprintf(fd, "USB HAL:\n");
+    dprintf(fd, "  Worker: %s\n", mWorker.running() ? "running" : "stopped");
+    pthread_mutex_lock(&mLock);
+    dprintf(fd, "  Callback: %s\n", mCallback != NULL ? "set" : "not set");
     pthread_mutex_unlock(&mLock);
-    return ScopedAStatus::ok();
+    dprintf(fd, "  Usb Data Enabled: %d\n", mUsbDataEnabled ? 1 : 0);
+
+    dprintf(fd, "  Ports:\n");
+    if (mTopology.snapshot(&ports)) {
+        for (const TypeCTopology::Port &port : ports) {
+            dprintf(fd, "    %s: power %s, data %s, %s\n", port.name.c_str(),
+                    port.powerRole.c_str(), port.dataRole.c_str(),
+                    !port.connected ? "disconnected"
+                    : port.pd       ? "pd partner"
+                                    : "non-pd partner");
+        }
+    }
+    dprintf(fd, "  Topology Rescans: %" PRIu64 "\n", mTopology.rescans());
+    dprintf(fd, "  Role Switch Pending: %d\n", mRoleTransition.pending() ? 1 : 0);
+    dprintf(fd,
+            "  Notifications: %" PRIu64 " delivered, %" PRIu64 " replaced, %" PRIu64
+            " dropped, %zu pending\n",
+            mNotifications.delivered(), mNotifications.replaced(), mNotifications.dropped(),
+            mNotifications.pending());
+
+    mTelemetry.dump(fd);
+
+    fsync(fd);
+    return STATUS_OK;
 }
 
 } // namespace usb
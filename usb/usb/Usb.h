@@ -21,6 +21,14 @@
 #include <aidl/android/hardware/usb/BnUsbCallback.h>
 #include <utils/Log.h>
 
+#include "Debouncer.h"
+#include "NotificationQueue.h"
+#include "Reactor.h"
+#include "RoleTransition.h"
+#include "SysfsReader.h"
+#include "Telemetry.h"
+#include "TypeCTopology.h"
+
 #define UEVENT_MSG_LEN 2048
 // The type-c stack waits for 4.5 - 5.5 secs before declaring a port non-pd.
 // The -partner directory would not be created until this is done.
@@ -69,22 +77,33 @@ struct Usb : public BnUsb {
             int64_t in_transactionId) override;
     ScopedAStatus resetUsbPort(const string& in_portName, int64_t in_transactionId) override;
 
+    binder_status_t dump(int fd, const char **args, uint32_t numArgs) override;
+
     std::shared_ptr<::aidl::android::hardware::usb::IUsbCallback> mCallback;
     // Protects mCallback variable
     pthread_mutex_t mLock;
     // Protects roleSwitch operation
     pthread_mutex_t mRoleSwitchLock;
-    // Threads waiting for the partner to come back wait here
-    pthread_cond_t mPartnerCV;
-    // lock protecting mPartnerCV
-    pthread_mutex_t mPartnerLock;
-    // Variable to signal partner coming back online after type switch
-    bool mPartnerUp;
+    // Serializes port status queries, so that they are reported in order
+    pthread_mutex_t mStatusLock;
+    // Role switch in progress, completed from uevents
+    RoleTransition mRoleTransition;
     // Usb Data status
     bool mUsbDataEnabled;
+    // Last port status notified, protected by mLock
+    ChangeFilter<std::pair<Status, std::vector<PortStatus>>> mPortStatusFilter;
+    // Type-C ports and partners, kept up to date from uevents
+    TypeCTopology mTopology;
+    // Moisture and power limit nodes, protected by mStatusLock
+    SysfsReader mStatusNodes;
+    // Counters and latencies for the dump
+    Telemetry mTelemetry;
+    // Delivers the callbacks, off the threads making them
+    NotificationQueue mNotifications;
 
-  private:
-    pthread_t mPoll;
+    // Runs the uevent loop for the lifetime of the service. Declared last so
+    // that it stops before anything its handlers use is destroyed.
+    Reactor mWorker;
 };
 
 } // namespace usb
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "benchmark/benchmark.h"
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "SysfsReader.h"
+#include "Uevent.h"
+#include "../tests/uevent_message.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// What the socket delivers while a cable is plugged in: the Type-C port and
+// partner come up, and the charger and battery report in a burst.
+static const std::vector<std::string> kStorm = {
+        message({
+                "change@/devices/platform/soc/soc:qcom,pmic_glink/typec/port0",
+                "ACTION=change",
+                "DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/typec/port0",
+                "SUBSYSTEM=typec",
+                "DEVTYPE=typec_port",
+                "SEQNUM=4527",
+        }),
+        message({
+                "add@/devices/platform/soc/soc:qcom,pmic_glink/typec/port0/port0-partner",
+                "ACTION=add",
+                "DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/typec/port0/port0-partner",
+                "SUBSYSTEM=typec",
+                "DEVTYPE=typec_partner",
+                "SEQNUM=4528",
+        }),
+        message({
+                "change@/devices/platform/soc/c440000.qcom,spmi/power_supply/usb",
+                "ACTION=change",
+                "DEVPATH=/devices/platform/soc/c440000.qcom,spmi/power_supply/usb",
+                "SUBSYSTEM=power_supply",
+                "POWER_SUPPLY_NAME=usb",
+                "POWER_SUPPLY_TYPE=USB_PD",
+                "POWER_SUPPLY_ONLINE=1",
+                "POWER_SUPPLY_VOLTAGE_MAX=9000000",
+                "POWER_SUPPLY_CURRENT_MAX=3000000",
+                "POWER_SUPPLY_MOISTURE_DETECTED=0",
+                "SEQNUM=4529",
+        }),
+        message({
+                "change@/devices/platform/soc/c440000.qcom,spmi/power_supply/battery",
+                "ACTION=change",
+                "DEVPATH=/devices/platform/soc/c440000.qcom,spmi/power_supply/battery",
+                "SUBSYSTEM=power_supply",
+                "POWER_SUPPLY_NAME=battery",
+                "POWER_SUPPLY_STATUS=Charging",
+                "POWER_SUPPLY_CAPACITY=87",
+                "POWER_SUPPLY_TEMP=291",
+                "SEQNUM=4530",
+        }),
+};
+
+// The matching the handler used to do, compiling a regex for every field.
+static void UeventRegex(benchmark::State &state) {
+    uint64_t matches = 0;
+
+    for (auto _ : state) {
+        for (auto &msg : kStorm) {
+            for (const char *cp = msg.c_str(); *cp; cp += strlen(cp) + 1) {
+                if (std::regex_match(cp, std::regex("(add)(.*)(-partner)"))) {
+                    matches++;
+                } else if (!strncmp(cp, "DEVTYPE=typec_", strlen("DEVTYPE=typec_")) ||
+                           !strncmp(cp, "POWER_SUPPLY_MOISTURE_DETECTED",
+                                    strlen("POWER_SUPPLY_MOISTURE_DETECTED"))) {
+                    matches++;
+                    break;
+                }
+            }
+        }
+    }
+
+    benchmark::DoNotOptimize(matches);
+    state.SetItemsProcessed(state.iterations() * kStorm.size());
+}
+
+BENCHMARK(UeventRegex);
+
+static void UeventParse(benchmark::State &state) {
+    uint64_t matches = 0;
+    Uevent event;
+
+    for (auto _ : state) {
+        for (auto &msg : kStorm) {
+            if (!event.parse(msg.data(), msg.size())) {
+                continue;
+            }
+            matches += isPartnerAdded(event);
+            matches += isPortChanged(event);
+        }
+    }
+
+    benchmark::DoNotOptimize(matches);
+    state.SetItemsProcessed(state.iterations() * kStorm.size());
+}
+
+BENCHMARK(UeventParse);
+
+// The nodes a port status query reads with a partner attached, laid out in a
+// temporary directory standing in for sysfs.
+class FakeSysfs {
+  public:
+    FakeSysfs() {
+        for (auto &[name, value] : kNodes) {
+            auto path = std::string(mDir.path) + "/" + name;
+            std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+            ::android::base::WriteStringToFile(value, path);
+            mPaths.push_back(path);
+        }
+    }
+
+    const std::vector<std::string> &paths() const { return mPaths; }
+
+  private:
+    static constexpr std::pair<const char *, const char *> kNodes[] = {
+            {"power_supply/usb/moisture_detection_enabled", "1\n"},
+            {"power_supply/usb/moisture_detected", "0\n"},
+            {"usbpd0/usb_limit_sink_enable", "0\n"},
+            {"typec/port0/power_role", "source [sink]\n"},
+            {"typec/port0/data_role", "host [device]\n"},
+            {"typec/port0-partner/supports_usb_power_delivery", "yes\n"},
+            {"typec/port0-partner/accessory_mode", "none\n"},
+    };
+
+    TemporaryDir mDir;
+    std::vector<std::string> mPaths;
+};
+
+// Read syscalls made by the process so far, as the kernel counts them.
+static uint64_t readSyscalls() {
+    std::ifstream io("/proc/self/io");
+    std::string key;
+    uint64_t value;
+
+    while (io >> key >> value) {
+        if (key == "syscr:") {
+            return value;
+        }
+    }
+    return 0;
+}
+
+// How the nodes used to be read: a fresh string per node, and an open,
+// fstat, read until EOF and close each time.
+static void SysfsReadEach(benchmark::State &state) {
+    FakeSysfs sysfs;
+    std::string value;
+    uint64_t reads = readSyscalls();
+
+    for (auto _ : state) {
+        for (auto &path : sysfs.paths()) {
+            ::android::base::ReadFileToString(path, &value);
+            benchmark::DoNotOptimize(::android::base::Trim(value));
+        }
+    }
+
+    reads = readSyscalls() - reads;
+    state.counters["reads"] = benchmark::Counter(reads, benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations() * sysfs.paths().size());
+}
+
+BENCHMARK(SysfsReadEach);
+
+// The same nodes through one SysfsReader, the partner's opened every time.
+static void SysfsReadBatch(benchmark::State &state) {
+    FakeSysfs sysfs;
+    std::vector<SysfsReader::Node> nodes;
+
+    for (auto &path : sysfs.paths()) {
+        nodes.push_back({path, path.find("-partner/") == std::string::npos});
+    }
+    SysfsReader reader(std::move(nodes));
+    reader.read();
+
+    uint64_t reads = readSyscalls();
+    uint64_t syscalls = reader.syscalls();
+
+    for (auto _ : state) {
+        reader.read();
+        benchmark::DoNotOptimize(reader.value(0));
+    }
+
+    reads = readSyscalls() - reads;
+    syscalls = reader.syscalls() - syscalls;
+    state.counters["reads"] = benchmark::Counter(reads, benchmark::Counter::kAvgIterations);
+    state.counters["syscalls"] =
+            benchmark::Counter(syscalls, benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations() * sysfs.paths().size());
+}
+
+BENCHMARK(SysfsReadBatch);
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
+
+BENCHMARK_MAIN();
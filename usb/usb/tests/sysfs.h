@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <string>
+
+#include "Uevent.h"
+#include "uevent_message.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// A tree of Type-C ports laid out like sysfs: device directories, linked to
+// from the class directory that the HAL reads.
+class FakeTypeC {
+  public:
+    FakeTypeC()
+        : mDevices(std::string(mDir.path) + "/devices/soc/typec"),
+          mClass(std::string(mDir.path) + "/class/typec") {
+        std::filesystem::create_directories(mDevices);
+        std::filesystem::create_directories(mClass);
+    }
+
+    const std::string &classPath() const { return mClass; }
+
+    // The DEVPATH of a port or partner, as reported in uevents.
+    static std::string devpath(const std::string &port, bool partner = false) {
+        return "/devices/soc/typec/" + port + (partner ? "/" + port + "-partner" : "");
+    }
+
+    void addPort(const std::string &name, const std::string &powerRole,
+                 const std::string &dataRole) {
+        auto dir = mDevices + "/" + name;
+
+        std::filesystem::create_directories(dir);
+        setRoles(name, powerRole, dataRole);
+        std::filesystem::create_directory_symlink(dir, mClass + "/" + name);
+    }
+
+    void removePort(const std::string &name) {
+        std::filesystem::remove(mClass + "/" + name);
+        std::filesystem::remove_all(mDevices + "/" + name);
+    }
+
+    void setRoles(const std::string &name, const std::string &powerRole,
+                  const std::string &dataRole) {
+        auto dir = mDevices + "/" + name;
+
+        ASSERT_TRUE(::android::base::WriteStringToFile(powerRole + "\n", dir + "/power_role"));
+        ASSERT_TRUE(::android::base::WriteStringToFile(dataRole + "\n", dir + "/data_role"));
+    }
+
+    void addPartner(const std::string &port, const std::string &pd,
+                    const std::string &accessory = "none") {
+        auto name = port + "-partner";
+        auto dir = mDevices + "/" + port + "/" + name;
+
+        std::filesystem::create_directories(dir);
+        ASSERT_TRUE(::android::base::WriteStringToFile(pd + "\n",
+                                                       dir + "/supports_usb_power_delivery"));
+        ASSERT_TRUE(::android::base::WriteStringToFile(accessory + "\n", dir + "/accessory_mode"));
+        std::filesystem::create_directory_symlink(dir, mClass + "/" + name);
+    }
+
+    void removePartner(const std::string &port) {
+        auto name = port + "-partner";
+
+        std::filesystem::remove(mClass + "/" + name);
+        std::filesystem::remove_all(mDevices + "/" + port + "/" + name);
+    }
+
+    // The message the kernel sends when a typec device changes.
+    static std::string uevent(const std::string &action, const std::string &devpath,
+                              const std::string &devtype) {
+        return message({action + "@" + devpath, "ACTION=" + action, "DEVPATH=" + devpath,
+                        "SUBSYSTEM=typec", "DEVTYPE=" + devtype});
+    }
+
+  private:
+    TemporaryDir mDir;
+    const std::string mDevices;
+    const std::string mClass;
+};
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <poll.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Debouncer.h"
+#include "Uevent.h"
+#include "uevent_message.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using std::chrono::milliseconds;
+
+static constexpr milliseconds kWindow(50);
+
+// Roughly what the socket delivers while a PD charger is plugged in.
+static const std::vector<std::string> kPlugBurst = [] {
+    static const std::string kPort = "/devices/platform/soc/soc:qcom,pmic_glink/typec/port0";
+    static const std::string kUsb = "/devices/platform/soc/c440000.qcom,spmi/power_supply/usb";
+    std::vector<std::string> burst;
+
+    burst.push_back(message({"change@" + kPort, "ACTION=change", "DEVPATH=" + kPort,
+                             "SUBSYSTEM=typec", "DEVTYPE=typec_port"}));
+    burst.push_back(message({"add@" + kPort + "/port0-partner", "ACTION=add",
+                             "DEVPATH=" + kPort + "/port0-partner", "SUBSYSTEM=typec",
+                             "DEVTYPE=typec_partner"}));
+    for (int i = 0; i < 4; i++) {
+        burst.push_back(message({"add@" + kPort + "/port0-partner/pd" + std::to_string(i),
+                                 "ACTION=add",
+                                 "DEVPATH=" + kPort + "/port0-partner/pd" + std::to_string(i),
+                                 "SUBSYSTEM=usb_power_delivery",
+                                 "DEVTYPE=typec_partner_pd"}));
+        burst.push_back(message({"change@" + kUsb, "ACTION=change", "DEVPATH=" + kUsb,
+                                 "SUBSYSTEM=power_supply", "POWER_SUPPLY_NAME=usb",
+                                 "POWER_SUPPLY_MOISTURE_DETECTED=0"}));
+    }
+    burst.push_back(message({"change@" + kPort, "ACTION=change", "DEVPATH=" + kPort,
+                             "SUBSYSTEM=typec", "DEVTYPE=typec_port"}));
+
+    return burst;
+}();
+
+// Plays the part of the HAL's worker thread: port uevents mark the status
+// dirty, and the debounced refresh reads it and notifies if it changed.
+class DebouncerTest : public ::testing::Test {
+  protected:
+    void replay(const std::vector<std::string> &burst, milliseconds gap = milliseconds(1)) {
+        for (auto &msg : burst) {
+            Uevent event;
+
+            ASSERT_TRUE(event.parse(msg.data(), msg.size()));
+            if (isPortChanged(event)) {
+                mRefresh.mark();
+            }
+            // keep the loop serviced in between, as epoll would
+            poll(gap);
+        }
+    }
+
+    // Services the debouncer for |timeout|, like the epoll loop.
+    void poll(milliseconds timeout) {
+        auto end = std::chrono::steady_clock::now() + timeout;
+
+        for (auto now = std::chrono::steady_clock::now(); now < end;
+             now = std::chrono::steady_clock::now()) {
+            pollfd pfd{.fd = mRefresh.fd(), .events = POLLIN};
+            auto left = std::chrono::duration_cast<milliseconds>(end - now).count() + 1;
+            if (::poll(&pfd, 1, left) > 0) {
+                mRefresh.fire();
+            }
+        }
+    }
+
+    void settle() { poll(kWindow * 3); }
+
+  protected:
+    int mRefreshes = 0;
+    int mCallbacks = 0;
+    std::vector<std::string> mPortStatus{"port0:sink:device"};
+    ChangeFilter<std::vector<std::string>> mFilter;
+    Debouncer mRefresh{kWindow, [this] {
+                           mRefreshes++;
+                           if (mFilter.changed(mPortStatus)) {
+                               mCallbacks++;
+                           }
+                       }};
+};
+
+TEST_F(DebouncerTest, burstCoalesced) {
+    replay(kPlugBurst);
+    settle();
+
+    EXPECT_EQ(1, mRefreshes);
+    EXPECT_EQ(1, mCallbacks);
+    EXPECT_FALSE(mRefresh.pending());
+}
+
+TEST_F(DebouncerTest, unchangedSuppressed) {
+    replay(kPlugBurst);
+    settle();
+    replay(kPlugBurst);
+    settle();
+
+    EXPECT_EQ(2, mRefreshes);
+    EXPECT_EQ(1, mCallbacks);
+}
+
+TEST_F(DebouncerTest, changedNotified) {
+    replay(kPlugBurst);
+    settle();
+    mPortStatus = {"port0:source:host"};
+    replay(kPlugBurst);
+    settle();
+
+    EXPECT_EQ(2, mRefreshes);
+    EXPECT_EQ(2, mCallbacks);
+}
+
+TEST_F(DebouncerTest, resetNotifiesAgain) {
+    replay(kPlugBurst);
+    settle();
+    mFilter.reset();
+    replay(kPlugBurst);
+    settle();
+
+    EXPECT_EQ(2, mCallbacks);
+}
+
+TEST_F(DebouncerTest, windowNotExtended) {
+    // a steady trickle, slower than the burst but spanning several windows
+    std::vector<std::string> trickle(8, kPlugBurst.front());
+
+    replay(trickle, kWindow / 2);
+    settle();
+
+    EXPECT_GE(mRefreshes, 2);
+    EXPECT_LT(mRefreshes, trickle.size());
+    EXPECT_EQ(1, mCallbacks);
+}
+
+TEST_F(DebouncerTest, unrelatedIgnored) {
+    replay({message({"change@/devices/virtual/thermal/thermal_zone0", "ACTION=change",
+                     "SUBSYSTEM=thermal"})});
+    settle();
+
+    EXPECT_EQ(0, mRefreshes);
+}
+
+TEST_F(DebouncerTest, notDueYet) {
+    mRefresh.mark();
+    mRefresh.fire();
+
+    EXPECT_EQ(0, mRefreshes);
+    EXPECT_TRUE(mRefresh.pending());
+
+    settle();
+    EXPECT_EQ(1, mRefreshes);
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "NotificationQueue.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+// Stands in for the framework's callback: records what it is told, taking
+// |delay| over each call, and can be held until released.
+class SlowCallback {
+  public:
+    explicit SlowCallback(milliseconds delay) : mDelay(delay) {}
+
+    void notify(const std::string &what) {
+        std::unique_lock<std::mutex> lock(mLock);
+        mEntered++;
+        mCv.notify_all();
+        mCv.wait(lock, [this] { return !mHeld; });
+        lock.unlock();
+
+        std::this_thread::sleep_for(mDelay);
+
+        lock.lock();
+        mCalls.push_back(what);
+        mThread = std::this_thread::get_id();
+    }
+
+    void hold() {
+        std::lock_guard<std::mutex> lock(mLock);
+        mHeld = true;
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> lock(mLock);
+        mHeld = false;
+        mCv.notify_all();
+    }
+
+    // Waits until |count| calls have started.
+    void waitEntered(int count) {
+        std::unique_lock<std::mutex> lock(mLock);
+        mCv.wait(lock, [this, count] { return mEntered >= count; });
+    }
+
+    std::vector<std::string> calls() {
+        std::lock_guard<std::mutex> lock(mLock);
+        return mCalls;
+    }
+
+    std::thread::id thread() {
+        std::lock_guard<std::mutex> lock(mLock);
+        return mThread;
+    }
+
+  private:
+    const milliseconds mDelay;
+    std::mutex mLock;
+    std::condition_variable mCv;
+    bool mHeld = false;
+    int mEntered = 0;
+    std::vector<std::string> mCalls;
+    std::thread::id mThread;
+};
+
+TEST(NotificationQueueTest, slowCallbackDoesNotBlockPost) {
+    SlowCallback callback(milliseconds(50));
+    NotificationQueue queue(32);
+
+    auto start = steady_clock::now();
+    for (int i = 0; i < 5; i++) {
+        queue.post([&callback, i] { callback.notify("result" + std::to_string(i)); });
+    }
+    EXPECT_LT(steady_clock::now() - start, milliseconds(50));
+
+    queue.flush();
+    EXPECT_GE(steady_clock::now() - start, milliseconds(250));
+    EXPECT_EQ((std::vector<std::string>{"result0", "result1", "result2", "result3", "result4"}),
+              callback.calls());
+    EXPECT_NE(std::this_thread::get_id(), callback.thread());
+    EXPECT_EQ(5u, queue.delivered());
+}
+
+TEST(NotificationQueueTest, orderedAcrossThreads) {
+    SlowCallback callback(milliseconds(0));
+    NotificationQueue queue(256);
+    std::vector<std::thread> posters;
+
+    for (int t = 0; t < 4; t++) {
+        posters.emplace_back([&, t] {
+            for (int i = 0; i < 50; i++) {
+                queue.post([&callback, t, i] {
+                    callback.notify(std::to_string(t) + ":" + std::to_string(i));
+                });
+            }
+        });
+    }
+    for (auto &poster : posters) {
+        poster.join();
+    }
+    queue.flush();
+
+    // each thread's notifications arrive in the order it posted them
+    auto calls = callback.calls();
+    ASSERT_EQ(200u, calls.size());
+    std::vector<int> next(4, 0);
+    for (const auto &call : calls) {
+        int t = std::stoi(call.substr(0, call.find(':')));
+        int i = std::stoi(call.substr(call.find(':') + 1));
+        EXPECT_EQ(next[t], i) << call;
+        next[t] = i + 1;
+    }
+}
+
+TEST(NotificationQueueTest, latestStatusReplacesQueued) {
+    SlowCallback callback(milliseconds(0));
+    NotificationQueue queue(32);
+
+    callback.hold();
+    queue.post([&] { callback.notify("status0"); }, true);
+    callback.waitEntered(1);
+
+    queue.post([&] { callback.notify("result1"); });
+    queue.post([&] { callback.notify("status1"); }, true);
+    queue.post([&] { callback.notify("result2"); });
+    queue.post([&] { callback.notify("status2"); }, true);
+    EXPECT_EQ(3u, queue.pending());
+
+    callback.release();
+    queue.flush();
+
+    // the status being delivered is not replaced; the queued one is, and the
+    // latest status still comes after every result queued before it
+    EXPECT_EQ((std::vector<std::string>{"status0", "result1", "result2", "status2"}),
+              callback.calls());
+    EXPECT_EQ(1u, queue.replaced());
+    EXPECT_EQ(4u, queue.delivered());
+}
+
+TEST(NotificationQueueTest, boundedDepth) {
+    SlowCallback callback(milliseconds(0));
+    NotificationQueue queue(2);
+
+    callback.hold();
+    queue.post([&] { callback.notify("0"); });
+    callback.waitEntered(1);
+    queue.post([&] { callback.notify("1"); });
+    queue.post([&] { callback.notify("2"); });
+    queue.post([&] { callback.notify("3"); });
+    EXPECT_EQ(2u, queue.pending());
+    EXPECT_EQ(1u, queue.dropped());
+
+    callback.release();
+    queue.flush();
+    // the oldest queued gave way
+    EXPECT_EQ((std::vector<std::string>{"0", "2", "3"}), callback.calls());
+}
+
+TEST(NotificationQueueTest, fullQueueKeepsLatestStatus) {
+    SlowCallback callback(milliseconds(0));
+    NotificationQueue queue(2);
+
+    callback.hold();
+    queue.post([&] { callback.notify("result0"); });
+    callback.waitEntered(1);
+    queue.post([&] { callback.notify("status1"); }, true);
+    queue.post([&] { callback.notify("result1"); });
+    queue.post([&] { callback.notify("result2"); });
+
+    callback.release();
+    queue.flush();
+    EXPECT_EQ((std::vector<std::string>{"result0", "status1", "result2"}), callback.calls());
+    EXPECT_EQ(1u, queue.dropped());
+}
+
+TEST(NotificationQueueTest, stuckCallbackDoesNotBlockPost) {
+    SlowCallback callback(milliseconds(0));
+    NotificationQueue queue(4);
+
+    // uevents keep arriving while the framework never returns
+    callback.hold();
+    queue.post([&] { callback.notify("status0"); }, true);
+    callback.waitEntered(1);
+    auto producer = std::async(std::launch::async, [&] {
+        for (int i = 1; i <= 1000; i++) {
+            queue.post([&callback, i] { callback.notify("status" + std::to_string(i)); },
+                       i % 10 == 0);
+            queue.post([&callback, i] { callback.notify("result" + std::to_string(i)); });
+        }
+    });
+    EXPECT_EQ(std::future_status::ready, producer.wait_for(std::chrono::seconds(5)));
+    EXPECT_EQ(4u, queue.pending());
+    EXPECT_GT(queue.dropped(), 0u);
+
+    callback.release();
+    queue.flush();
+    auto calls = callback.calls();
+    ASSERT_EQ(5u, calls.size());
+    EXPECT_NE(calls.end(), std::find(calls.begin(), calls.end(), "status1000"));
+    EXPECT_EQ("result1000", calls.back());
+}
+
+TEST(NotificationQueueTest, postFromNotification) {
+    SlowCallback callback(milliseconds(0));
+    NotificationQueue queue(2);
+
+    // the thread posting into its own queue must not stall
+    queue.post([&] {
+        queue.post([&] { callback.notify("inner0"); });
+        queue.post([&] { callback.notify("inner1"); });
+        callback.notify("outer");
+    });
+    queue.flush();
+
+    EXPECT_EQ((std::vector<std::string>{"outer", "inner0", "inner1"}), callback.calls());
+}
+
+TEST(NotificationQueueTest, drainsOnDestruction) {
+    SlowCallback callback(milliseconds(10));
+
+    {
+        NotificationQueue queue(32);
+        for (int i = 0; i < 3; i++) {
+            queue.post([&callback, i] { callback.notify(std::to_string(i)); });
+        }
+    }
+
+    EXPECT_EQ((std::vector<std::string>{"0", "1", "2"}), callback.calls());
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include "Reactor.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::unique_fd;
+using std::chrono::milliseconds;
+
+constexpr auto kTimeout = std::chrono::seconds(5);
+
+class ReactorTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        int fds[2];
+        ASSERT_EQ(0, pipe2(fds, O_NONBLOCK | O_CLOEXEC));
+        mRead.reset(fds[0]);
+        mWrite.reset(fds[1]);
+    }
+
+    void send() { ASSERT_EQ(1, write(mWrite, "x", 1)); }
+
+    // Reads what the pipe holds, as a uevent handler drains its socket.
+    int receive() {
+        char buf[64];
+        ssize_t n = read(mRead, buf, sizeof(buf));
+        return n > 0 ? n : 0;
+    }
+
+  protected:
+    unique_fd mRead;
+    unique_fd mWrite;
+    Reactor mReactor;
+};
+
+TEST_F(ReactorTest, dispatches) {
+    std::promise<std::thread::id> handled;
+
+    ASSERT_TRUE(mReactor.add(mRead.get(), [&](uint32_t events) {
+        EXPECT_TRUE(events & EPOLLIN);
+        if (receive()) {
+            handled.set_value(std::this_thread::get_id());
+        }
+    }));
+    ASSERT_TRUE(mReactor.start());
+    send();
+
+    auto future = handled.get_future();
+    ASSERT_EQ(std::future_status::ready, future.wait_for(kTimeout));
+    EXPECT_NE(std::this_thread::get_id(), future.get());
+}
+
+TEST_F(ReactorTest, stopWakesIdleLoop) {
+    std::atomic<int> exits{0};
+    std::thread::id loop;
+
+    std::promise<void> handled;
+
+    ASSERT_TRUE(mReactor.add(mRead.get(), [&](uint32_t) {
+        if (receive()) {
+            loop = std::this_thread::get_id();
+            handled.set_value();
+        }
+    }));
+    ASSERT_TRUE(mReactor.start([&] { exits++; }));
+    send();
+    ASSERT_EQ(std::future_status::ready, handled.get_future().wait_for(kTimeout));
+    std::this_thread::sleep_for(milliseconds(20));
+
+    auto start = std::chrono::steady_clock::now();
+    mReactor.stop();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, milliseconds(500));
+
+    EXPECT_EQ(1, exits);
+    EXPECT_NE(std::thread::id(), loop);
+    EXPECT_FALSE(mReactor.running());
+
+    // stopping again is harmless
+    mReactor.stop();
+    EXPECT_EQ(1, exits);
+}
+
+TEST_F(ReactorTest, startedOnce) {
+    ASSERT_TRUE(mReactor.start());
+    EXPECT_TRUE(mReactor.running());
+    EXPECT_FALSE(mReactor.start());
+    EXPECT_FALSE(mReactor.add(mRead.get(), [](uint32_t) {}));
+
+    mReactor.stop();
+    EXPECT_FALSE(mReactor.start());
+}
+
+TEST_F(ReactorTest, badFd) {
+    EXPECT_FALSE(mReactor.add(-1, [](uint32_t) {}));
+    EXPECT_FALSE(mReactor.add(unique_fd(), [](uint32_t) {}));
+}
+
+TEST_F(ReactorTest, ownsFd) {
+    int fd;
+
+    {
+        Reactor reactor;
+        unique_fd dup(::dup(mRead));
+        fd = dup.get();
+        ASSERT_TRUE(reactor.add(std::move(dup), [](uint32_t) {}));
+        ASSERT_TRUE(reactor.start());
+        EXPECT_NE(-1, fcntl(fd, F_GETFD));
+    }
+
+    EXPECT_EQ(-1, fcntl(fd, F_GETFD));
+}
+
+TEST_F(ReactorTest, stopFromHandler) {
+    std::promise<void> exited;
+
+    ASSERT_TRUE(mReactor.add(mRead.get(), [&](uint32_t) {
+        receive();
+        mReactor.stop();
+    }));
+    ASSERT_TRUE(mReactor.start([&] { exited.set_value(); }));
+    send();
+
+    ASSERT_EQ(std::future_status::ready, exited.get_future().wait_for(kTimeout));
+    EXPECT_FALSE(mReactor.running());
+    mReactor.stop();
+}
+
+// A long stream of uevents is handled on one loop thread, which is still
+// there afterwards for whatever comes next.
+TEST_F(ReactorTest, oneLoopThread) {
+    std::atomic<int> handled{0};
+    std::thread::id loop;
+    std::atomic<bool> sameThread{true};
+    std::promise<void> alive;
+    int probe[2];
+
+    ASSERT_EQ(0, pipe2(probe, O_NONBLOCK | O_CLOEXEC));
+    unique_fd probeWrite(probe[1]);
+    // a second source, only written once the stream is over
+    ASSERT_TRUE(mReactor.add(unique_fd(probe[0]), [&](uint32_t) { alive.set_value(); },
+                             EPOLLIN | EPOLLET));
+    ASSERT_TRUE(mReactor.add(mRead.get(), [&](uint32_t) {
+        if (!receive()) {
+            return;
+        }
+        if (loop == std::thread::id()) {
+            loop = std::this_thread::get_id();
+        } else if (loop != std::this_thread::get_id()) {
+            sameThread = false;
+        }
+        handled++;
+    }));
+    ASSERT_TRUE(mReactor.start());
+
+    std::thread kernel([&] {
+        for (int i = 0; i < 2000; i++) {
+            send();
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    });
+    kernel.join();
+
+    ASSERT_EQ(1, write(probeWrite, "x", 1));
+    ASSERT_EQ(std::future_status::ready, alive.get_future().wait_for(kTimeout));
+    EXPECT_TRUE(mReactor.running());
+
+    mReactor.stop();
+    EXPECT_TRUE(sameThread);
+    EXPECT_GT(handled, 0);
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
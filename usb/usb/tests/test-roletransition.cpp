@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "RoleTransition.h"
+#include "TypeCTopology.h"
+#include "sysfs.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+using Result = RoleTransition::Result;
+
+// Plays the kernel's side of a role switch: sysfs changes, each followed by
+// its uevent, fed to the topology and the transition as the HAL's worker
+// thread does.
+class RoleTransitionTest : public ::testing::Test {
+  protected:
+    struct Step {
+        milliseconds delay;
+        std::function<void(FakeTypeC *)> change;
+        std::string uevent;
+    };
+
+    void SetUp() override {
+        mSysfs.addPort("port0", "[source] sink", "[host] device");
+        mSysfs.addPartner("port0", "yes");
+        mSysfs.addPort("port1", "source [sink]", "host [device]");
+        mTopology.track(true);
+    }
+
+    void TearDown() override {
+        if (mKernel.joinable()) {
+            mKernel.join();
+        }
+    }
+
+    // Runs |steps| in the background, as the kernel would once the role was
+    // written.
+    void replay(std::vector<Step> steps) {
+        mKernel = std::thread([this, steps = std::move(steps)] {
+            for (auto &step : steps) {
+                std::this_thread::sleep_for(step.delay);
+                if (step.change) {
+                    step.change(&mSysfs);
+                }
+                if (!step.uevent.empty()) {
+                    deliver(step.uevent);
+                }
+            }
+        });
+    }
+
+    void deliver(const std::string &msg) {
+        Uevent event;
+
+        ASSERT_TRUE(event.parse(msg.data(), msg.size()));
+        mTopology.update(event);
+        if (mTransition.pending()) {
+            std::vector<TypeCTopology::Port> ports;
+            if (mTopology.snapshot(&ports)) {
+                mTransition.observe(ports);
+            }
+        }
+    }
+
+    // Waits as the HAL does after writing a role, checking sysfs first.
+    Result wait(milliseconds timeout) {
+        std::vector<TypeCTopology::Port> ports;
+
+        mTopology.invalidate();
+        if (mTopology.snapshot(&ports)) {
+            mTransition.observe(ports);
+        }
+
+        return mTransition.wait(timeout, &mLatency);
+    }
+
+    // The steps of port0 coming back as a sink, the partner attaching
+    // |attachMs| after the write.
+    static std::vector<Step> sinkAttach(int attachMs) {
+        return {
+                {milliseconds(5),
+                 [](FakeTypeC *sysfs) { sysfs->removePartner("port0"); },
+                 FakeTypeC::uevent("remove", FakeTypeC::devpath("port0", true),
+                                   "typec_partner")},
+                {milliseconds(5),
+                 [](FakeTypeC *sysfs) {
+                     sysfs->setRoles("port0", "source [sink]", "host [device]");
+                 },
+                 FakeTypeC::uevent("change", FakeTypeC::devpath("port0"), "typec_port")},
+                {milliseconds(attachMs - 10),
+                 [](FakeTypeC *sysfs) { sysfs->addPartner("port0", "yes"); },
+                 FakeTypeC::uevent("add", FakeTypeC::devpath("port0", true), "typec_partner")},
+        };
+    }
+
+  protected:
+    FakeTypeC mSysfs;
+    TypeCTopology mTopology{mSysfs.classPath()};
+    RoleTransition mTransition;
+    microseconds mLatency{0};
+    std::thread mKernel;
+};
+
+TEST_F(RoleTransitionTest, completesOnPartnerAttach) {
+    mTransition.begin({.port = "port0", .powerRole = "sink", .connected = true});
+    replay(sinkAttach(40));
+
+    EXPECT_EQ(Result::DONE, wait(milliseconds(2000)));
+    // not before the partner was back, and well before the timeout
+    EXPECT_GE(mLatency, milliseconds(40));
+    EXPECT_LT(mLatency, milliseconds(1000));
+    EXPECT_FALSE(mTransition.pending());
+}
+
+TEST_F(RoleTransitionTest, completesImmediatelyWhenWritten) {
+    // data role swaps are done by the time the write returns
+    mTransition.begin({.port = "port0", .dataRole = "device"});
+    mSysfs.setRoles("port0", "[source] sink", "host [device]");
+
+    EXPECT_EQ(Result::DONE, wait(milliseconds(2000)));
+    EXPECT_LT(mLatency, milliseconds(100));
+}
+
+TEST_F(RoleTransitionTest, completesOnRoleChange) {
+    mTransition.begin({.port = "port0", .powerRole = "sink"});
+    replay({
+            {milliseconds(20),
+             [](FakeTypeC *sysfs) { sysfs->setRoles("port0", "source [sink]", "[host] device"); },
+             FakeTypeC::uevent("change", FakeTypeC::devpath("port0"), "typec_port")},
+    });
+
+    EXPECT_EQ(Result::DONE, wait(milliseconds(2000)));
+    EXPECT_GE(mLatency, milliseconds(20));
+}
+
+TEST_F(RoleTransitionTest, timesOut) {
+    mTransition.begin({.port = "port0", .powerRole = "sink", .connected = true});
+    // the partner goes away and never comes back
+    replay({sinkAttach(40)[0], sinkAttach(40)[1]});
+
+    EXPECT_EQ(Result::TIMED_OUT, wait(milliseconds(100)));
+    EXPECT_GE(mLatency, milliseconds(100));
+    EXPECT_FALSE(mTransition.pending());
+}
+
+TEST_F(RoleTransitionTest, otherPortIgnored) {
+    mTransition.begin({.port = "port0", .powerRole = "sink", .connected = true});
+    replay({
+            {milliseconds(10), [](FakeTypeC *sysfs) { sysfs->addPartner("port1", "yes"); },
+             FakeTypeC::uevent("add", FakeTypeC::devpath("port1", true), "typec_partner")},
+    });
+
+    EXPECT_EQ(Result::TIMED_OUT, wait(milliseconds(100)));
+}
+
+TEST_F(RoleTransitionTest, cancelled) {
+    mTransition.begin({.port = "port0", .powerRole = "sink", .connected = true});
+    std::thread canceller([this] {
+        std::this_thread::sleep_for(milliseconds(20));
+        mTransition.cancel();
+    });
+
+    EXPECT_EQ(Result::CANCELLED, wait(milliseconds(2000)));
+    EXPECT_GE(mLatency, milliseconds(20));
+    EXPECT_LT(mLatency, milliseconds(1000));
+    canceller.join();
+}
+
+TEST_F(RoleTransitionTest, replaced) {
+    mTransition.begin({.port = "port0", .powerRole = "sink", .connected = true});
+    std::thread waiter([this] { EXPECT_EQ(Result::CANCELLED, wait(milliseconds(2000))); });
+    std::this_thread::sleep_for(milliseconds(20));
+
+    mTransition.begin({.port = "port1", .powerRole = "sink"});
+    waiter.join();
+
+    EXPECT_TRUE(mTransition.pending());
+    EXPECT_EQ(Result::DONE, wait(milliseconds(100)));
+}
+
+TEST_F(RoleTransitionTest, idle) {
+    std::vector<TypeCTopology::Port> ports;
+
+    ASSERT_TRUE(mTopology.snapshot(&ports));
+    mTransition.observe(ports);
+
+    EXPECT_FALSE(mTransition.pending());
+}
+
+TEST(RoleTransitionTargetTest, matches) {
+    TypeCTopology::Port port{.name = "port0",
+                             .connected = true,
+                             .powerRole = "sink",
+                             .dataRole = "device"};
+    using Target = RoleTransition::Target;
+
+    EXPECT_TRUE((Target{.port = "port0"}.matches(port)));
+    EXPECT_TRUE((Target{.port = "port0", .powerRole = "sink", .connected = true}.matches(port)));
+    EXPECT_TRUE((Target{.port = "port0", .dataRole = "device"}.matches(port)));
+    EXPECT_FALSE((Target{.port = "port1"}.matches(port)));
+    EXPECT_FALSE((Target{.port = "port0", .powerRole = "source"}.matches(port)));
+    EXPECT_FALSE((Target{.port = "port0", .dataRole = "host"}.matches(port)));
+
+    port.connected = false;
+    EXPECT_FALSE((Target{.port = "port0", .connected = true}.matches(port)));
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
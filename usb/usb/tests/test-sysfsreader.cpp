@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <string>
+
+#include "SysfsReader.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using ::android::base::WriteStringToFile;
+
+class SysfsReaderTest : public ::testing::Test {
+  protected:
+    std::string path(const std::string &name) { return std::string(mDir.path) + "/" + name; }
+
+    void write(const std::string &name, const std::string &value) {
+        ASSERT_TRUE(WriteStringToFile(value, path(name)));
+    }
+
+  protected:
+    TemporaryDir mDir;
+};
+
+TEST_F(SysfsReaderTest, readsAll) {
+    write("enabled", "1\n");
+    write("role", "  source [sink]\n");
+    write("empty", "\n");
+    SysfsReader reader({{path("enabled")}, {path("role")}, {path("empty")}});
+
+    EXPECT_FALSE(reader.value(0));
+    EXPECT_EQ(3u, reader.read());
+
+    EXPECT_EQ("1", reader.value(0));
+    EXPECT_EQ("source [sink]", reader.value(1));
+    EXPECT_EQ("", reader.value(2));
+    EXPECT_FALSE(reader.value(3));
+}
+
+TEST_F(SysfsReaderTest, stableStaysOpen) {
+    write("enabled", "0\n");
+    SysfsReader reader({{path("enabled")}});
+
+    ASSERT_EQ(1u, reader.read());
+    EXPECT_EQ("0", reader.value(0));
+    // open and pread
+    EXPECT_EQ(2u, reader.syscalls());
+
+    write("enabled", "1\n");
+    ASSERT_EQ(1u, reader.read());
+    EXPECT_EQ("1", reader.value(0));
+    // pread alone
+    EXPECT_EQ(3u, reader.syscalls());
+}
+
+TEST_F(SysfsReaderTest, transientReopened) {
+    write("pd", "yes\n");
+    SysfsReader reader({{path("pd"), false}});
+
+    ASSERT_EQ(1u, reader.read());
+    EXPECT_EQ("yes", reader.value(0));
+    // open, pread and close
+    EXPECT_EQ(3u, reader.syscalls());
+
+    std::filesystem::remove(path("pd"));
+    EXPECT_EQ(0u, reader.read());
+    EXPECT_FALSE(reader.value(0));
+
+    write("pd", "no\n");
+    ASSERT_EQ(1u, reader.read());
+    EXPECT_EQ("no", reader.value(0));
+}
+
+TEST_F(SysfsReaderTest, missingStable) {
+    SysfsReader reader({{path("late")}});
+
+    EXPECT_EQ(0u, reader.read());
+    EXPECT_FALSE(reader.value(0));
+
+    // picked up once it shows up
+    write("late", "host\n");
+    EXPECT_EQ(1u, reader.read());
+    EXPECT_EQ("host", reader.value(0));
+}
+
+TEST_F(SysfsReaderTest, readsSubset) {
+    write("a", "1\n");
+    write("b", "2\n");
+    SysfsReader reader({{path("a")}, {path("b")}});
+
+    EXPECT_EQ(1u, reader.read({1}));
+    EXPECT_FALSE(reader.value(0));
+    EXPECT_EQ("2", reader.value(1));
+
+    EXPECT_EQ(1u, reader.read({0, 5}));
+    EXPECT_EQ("1", reader.value(0));
+}
+
+TEST_F(SysfsReaderTest, truncatesLongValues) {
+    write("long", std::string(SysfsReader::kValueSize * 2, 'x'));
+    SysfsReader reader({{path("long")}});
+
+    ASSERT_EQ(1u, reader.read());
+    EXPECT_EQ(std::string(SysfsReader::kValueSize, 'x'), reader.value(0));
+}
+
+TEST_F(SysfsReaderTest, moved) {
+    write("a", "1\n");
+    SysfsReader reader({{path("a")}});
+    ASSERT_EQ(1u, reader.read());
+
+    SysfsReader moved(std::move(reader));
+    EXPECT_EQ("1", moved.value(0));
+    write("a", "2\n");
+    ASSERT_EQ(1u, moved.read());
+    EXPECT_EQ("2", moved.value(0));
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Telemetry.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
+
+// Returns what |dump| writes to a file descriptor.
+template <typename F>
+static std::string captureDump(F dump) {
+    FILE *file = std::tmpfile();
+    std::string out;
+    char buf[256];
+
+    dump(fileno(file));
+    std::rewind(file);
+    while (size_t n = std::fread(buf, 1, sizeof(buf), file)) {
+        out.append(buf, n);
+    }
+    std::fclose(file);
+
+    return out;
+}
+
+static void record(UeventLog *log, const std::string &action, const std::string &devpath,
+                   const std::string &devtype) {
+    std::string msg = action + "@" + devpath;
+    msg.push_back('\0');
+    msg += "ACTION=" + action;
+    msg.push_back('\0');
+    msg += "DEVPATH=" + devpath;
+    msg.push_back('\0');
+    if (!devtype.empty()) {
+        msg += "DEVTYPE=" + devtype;
+        msg.push_back('\0');
+    }
+
+    Uevent event;
+    ASSERT_TRUE(event.parse(msg.data(), msg.size()));
+    log->record(event);
+}
+
+TEST(LatencyHistogramTest, percentiles) {
+    LatencyHistogram histogram;
+
+    EXPECT_EQ(0u, histogram.count());
+    EXPECT_EQ(0u, histogram.percentileNs(0.5));
+
+    for (int i = 0; i < 90; i++) {
+        histogram.record(microseconds(10));
+    }
+    for (int i = 0; i < 10; i++) {
+        histogram.record(microseconds(1000));
+    }
+
+    EXPECT_EQ(100u, histogram.count());
+    EXPECT_EQ(1000000u, histogram.maxNs());
+    // reported as the upper bound of the bucket
+    EXPECT_EQ(16384u, histogram.percentileNs(0.5));
+    EXPECT_EQ(16384u, histogram.percentileNs(0.9));
+    EXPECT_EQ(1000000u, histogram.percentileNs(0.99));
+
+    histogram.reset();
+    EXPECT_EQ(0u, histogram.count());
+    EXPECT_EQ(0u, histogram.maxNs());
+}
+
+TEST(LatencyHistogramTest, outOfRange) {
+    LatencyHistogram histogram;
+
+    histogram.record(nanoseconds(-5));
+    histogram.record(std::chrono::hours(24 * 365));
+
+    EXPECT_EQ(2u, histogram.count());
+    EXPECT_EQ(0u, histogram.percentileNs(0.5));
+}
+
+TEST(LatencyHistogramTest, concurrent) {
+    LatencyHistogram histogram;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&histogram] {
+            for (int i = 0; i < 10000; i++) {
+                histogram.record(nanoseconds(i));
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(40000u, histogram.count());
+    EXPECT_EQ(9999u, histogram.maxNs());
+}
+
+TEST(UeventLogTest, recent) {
+    UeventLog log;
+
+    record(&log, "add", "/devices/soc/typec/port0/port0-partner", "typec_partner");
+    record(&log, "change", "/devices/power_supply/usb", "");
+
+    std::string out = captureDump([&log](int fd) { log.dump(fd); });
+    EXPECT_NE(std::string::npos,
+              out.find("] add /devices/soc/typec/port0/port0-partner typec_partner\n"))
+            << out;
+    EXPECT_NE(std::string::npos, out.find("] change /devices/power_supply/usb\n")) << out;
+    EXPECT_LT(out.find("port0-partner"), out.find("power_supply"));
+}
+
+TEST(UeventLogTest, wraps) {
+    UeventLog log;
+
+    for (size_t i = 0; i < UeventLog::kSize + 5; i++) {
+        record(&log, "change", "/devices/port" + std::to_string(i), "typec_port");
+    }
+
+    std::string out = captureDump([&log](int fd) { log.dump(fd); });
+    for (size_t i = 0; i < 5; i++) {
+        EXPECT_EQ(std::string::npos, out.find("/port" + std::to_string(i) + " ")) << i;
+    }
+    for (size_t i = 5; i < UeventLog::kSize + 5; i++) {
+        EXPECT_NE(std::string::npos, out.find("/port" + std::to_string(i) + " ")) << i;
+    }
+}
+
+TEST(UeventLogTest, keepsEndOfLongPaths) {
+    UeventLog log;
+    std::string devpath = "/devices" + std::string(200, 'x') + "/port0-partner";
+
+    record(&log, "remove", devpath, "typec_partner");
+
+    std::string out = captureDump([&log](int fd) { log.dump(fd); });
+    EXPECT_NE(std::string::npos, out.find("x/port0-partner typec_partner")) << out;
+    EXPECT_EQ(std::string::npos, out.find("/devices")) << out;
+}
+
+TEST(TelemetryTest, dump) {
+    Telemetry telemetry;
+
+    telemetry.uevents.inc();
+    telemetry.uevents.inc();
+    telemetry.portUevents.inc();
+    telemetry.roleSwitchesDone.inc();
+    telemetry.roleSwitchesTimedOut.inc();
+    telemetry.roleSwitchLatency.record(std::chrono::milliseconds(40));
+    record(&telemetry.recentUevents, "add", "/devices/soc/typec/port0", "typec_port");
+
+    std::string out = captureDump([&telemetry](int fd) { telemetry.dump(fd); });
+    EXPECT_NE(std::string::npos, out.find("Uevents: 2 received")) << out;
+    EXPECT_NE(std::string::npos, out.find("1 for ports, 0 lost")) << out;
+    EXPECT_NE(std::string::npos, out.find("Role Switches: 1 done, 1 timed out, 0 cancelled"))
+            << out;
+    EXPECT_NE(std::string::npos, out.find("role switch")) << out;
+    EXPECT_NE(std::string::npos, out.find("add /devices/soc/typec/port0 typec_port")) << out;
+
+    telemetry.resetLatencies();
+    EXPECT_EQ(0u, telemetry.roleSwitchLatency.count());
+    EXPECT_EQ(2u, telemetry.uevents.get());
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
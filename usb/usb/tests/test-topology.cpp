@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "TypeCTopology.h"
+#include "sysfs.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+using Port = TypeCTopology::Port;
+
+class TypeCTopologyTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        mSysfs.addPort("port0", "source [sink]", "host [device]");
+        mTopology = std::make_unique<TypeCTopology>(mSysfs.classPath());
+    }
+
+    // Delivers the uevent the kernel would send for a port or its partner.
+    void uevent(const std::string &action, const std::string &devpath,
+                const std::string &devtype) {
+        auto msg = FakeTypeC::uevent(action, devpath, devtype);
+        Uevent event;
+
+        ASSERT_TRUE(event.parse(msg.data(), msg.size()));
+        mTopology->update(event);
+    }
+
+    std::vector<Port> snapshot() {
+        std::vector<Port> ports;
+
+        EXPECT_TRUE(mTopology->snapshot(&ports));
+        return ports;
+    }
+
+  protected:
+    FakeTypeC mSysfs;
+    std::unique_ptr<TypeCTopology> mTopology;
+};
+
+TEST_F(TypeCTopologyTest, rescan) {
+    mSysfs.addPartner("port0", "yes");
+    mSysfs.addPort("port1", "[source] sink", "[host] device");
+
+    auto ports = snapshot();
+
+    ASSERT_EQ(2, ports.size());
+    EXPECT_EQ("port0", ports[0].name);
+    EXPECT_TRUE(ports[0].connected);
+    EXPECT_TRUE(ports[0].pd);
+    EXPECT_EQ("sink", ports[0].powerRole);
+    EXPECT_EQ("device", ports[0].dataRole);
+    EXPECT_EQ("none", ports[0].accessory);
+    EXPECT_EQ("port1", ports[1].name);
+    EXPECT_FALSE(ports[1].connected);
+    EXPECT_FALSE(ports[1].pd);
+    EXPECT_EQ("source", ports[1].powerRole);
+    EXPECT_EQ("host", ports[1].dataRole);
+}
+
+TEST_F(TypeCTopologyTest, untrackedAlwaysRescans) {
+    snapshot();
+    snapshot();
+
+    EXPECT_EQ(2, mTopology->rescans());
+}
+
+TEST_F(TypeCTopologyTest, trackedServedFromCache) {
+    mTopology->track(true);
+    auto first = snapshot();
+    // changes that raise no uevent are not seen
+    mSysfs.setRoles("port0", "[source] sink", "[host] device");
+    auto second = snapshot();
+
+    EXPECT_EQ(1, mTopology->rescans());
+    EXPECT_EQ(first, second);
+}
+
+TEST_F(TypeCTopologyTest, partnerAdded) {
+    mTopology->track(true);
+    snapshot();
+
+    mSysfs.addPartner("port0", "yes", "analog_audio");
+    uevent("add", FakeTypeC::devpath("port0", true), "typec_partner");
+    auto ports = snapshot();
+
+    EXPECT_EQ(1, mTopology->rescans());
+    ASSERT_EQ(1, ports.size());
+    EXPECT_TRUE(ports[0].connected);
+    EXPECT_TRUE(ports[0].pd);
+    EXPECT_EQ("analog_audio", ports[0].accessory);
+}
+
+TEST_F(TypeCTopologyTest, partnerWithoutPd) {
+    mTopology->track(true);
+    snapshot();
+
+    mSysfs.addPartner("port0", "no");
+    uevent("add", FakeTypeC::devpath("port0", true), "typec_partner");
+    auto ports = snapshot();
+
+    EXPECT_TRUE(ports[0].connected);
+    EXPECT_FALSE(ports[0].pd);
+}
+
+TEST_F(TypeCTopologyTest, partnerRemoved) {
+    mSysfs.addPartner("port0", "yes");
+    mTopology->track(true);
+    snapshot();
+
+    mSysfs.removePartner("port0");
+    mSysfs.setRoles("port0", "source [sink]", "host [device]");
+    uevent("remove", FakeTypeC::devpath("port0", true), "typec_partner");
+    auto ports = snapshot();
+
+    EXPECT_EQ(1, mTopology->rescans());
+    EXPECT_FALSE(ports[0].connected);
+    EXPECT_FALSE(ports[0].pd);
+    EXPECT_EQ("", ports[0].accessory);
+}
+
+TEST_F(TypeCTopologyTest, roleChanged) {
+    mTopology->track(true);
+    snapshot();
+
+    mSysfs.setRoles("port0", "[source] sink", "[host] device");
+    uevent("change", FakeTypeC::devpath("port0"), "typec_port");
+    auto ports = snapshot();
+
+    EXPECT_EQ(1, mTopology->rescans());
+    EXPECT_EQ("source", ports[0].powerRole);
+    EXPECT_EQ("host", ports[0].dataRole);
+}
+
+TEST_F(TypeCTopologyTest, unrelatedIgnored) {
+    mTopology->track(true);
+    snapshot();
+
+    uevent("add", "/devices/soc/typec/port0/port0-partner/port0-partner.0",
+           "typec_alternate_mode");
+    uevent("change", "/devices/soc/typec/port0/port0-cable", "typec_cable");
+    snapshot();
+
+    EXPECT_EQ(1, mTopology->rescans());
+}
+
+TEST_F(TypeCTopologyTest, portAddedRescans) {
+    mTopology->track(true);
+    snapshot();
+
+    mSysfs.addPort("port1", "source [sink]", "host [device]");
+    uevent("add", FakeTypeC::devpath("port1"), "typec_port");
+    auto ports = snapshot();
+
+    EXPECT_EQ(2, mTopology->rescans());
+    EXPECT_EQ(2, ports.size());
+}
+
+TEST_F(TypeCTopologyTest, portRemoved) {
+    mSysfs.addPort("port1", "source [sink]", "host [device]");
+    mTopology->track(true);
+    snapshot();
+
+    uevent("remove", FakeTypeC::devpath("port1"), "typec_port");
+    auto ports = snapshot();
+
+    EXPECT_EQ(1, mTopology->rescans());
+    ASSERT_EQ(1, ports.size());
+    EXPECT_EQ("port0", ports[0].name);
+}
+
+TEST_F(TypeCTopologyTest, unknownPortRescans) {
+    mTopology->track(true);
+    snapshot();
+
+    mSysfs.addPort("port1", "source [sink]", "host [device]");
+    mSysfs.addPartner("port1", "yes");
+    // the port came up before tracking started
+    uevent("add", FakeTypeC::devpath("port1", true), "typec_partner");
+    auto ports = snapshot();
+
+    EXPECT_EQ(2, mTopology->rescans());
+    ASSERT_EQ(2, ports.size());
+    EXPECT_TRUE(ports[1].connected);
+}
+
+TEST_F(TypeCTopologyTest, unreadableNodeRescans) {
+    mTopology->track(true);
+    snapshot();
+
+    // the partner went away again before it could be read
+    uevent("add", FakeTypeC::devpath("port0", true), "typec_partner");
+    auto ports = snapshot();
+
+    EXPECT_EQ(2, mTopology->rescans());
+    EXPECT_FALSE(ports[0].connected);
+}
+
+TEST_F(TypeCTopologyTest, invalidate) {
+    mTopology->track(true);
+    snapshot();
+
+    mSysfs.setRoles("port0", "[source] sink", "[host] device");
+    mTopology->invalidate();
+    auto ports = snapshot();
+
+    EXPECT_EQ(2, mTopology->rescans());
+    EXPECT_EQ("source", ports[0].powerRole);
+}
+
+TEST_F(TypeCTopologyTest, missingClass) {
+    TypeCTopology topology(mSysfs.classPath() + "/missing");
+    std::vector<Port> ports;
+
+    EXPECT_FALSE(topology.snapshot(&ports));
+}
+
+TEST_F(TypeCTopologyTest, missingRole) {
+    std::vector<Port> ports;
+
+    unlink((mSysfs.classPath() + "/port0/data_role").c_str());
+
+    EXPECT_FALSE(mTopology->snapshot(&ports));
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
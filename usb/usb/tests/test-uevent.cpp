@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "Uevent.h"
+#include "uevent_message.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// Captured from the netlink socket while plugging in a PD charger.
+static const std::string kPartnerAdd = message({
+        "add@/devices/platform/soc/soc:qcom,pmic_glink/typec/port0/port0-partner",
+        "ACTION=add",
+        "DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/typec/port0/port0-partner",
+        "SUBSYSTEM=typec",
+        "DEVTYPE=typec_partner",
+        "SEQNUM=4528",
+});
+
+static Uevent parse(const std::string &msg) {
+    Uevent event;
+
+    EXPECT_TRUE(event.parse(msg.data(), msg.size()));
+    return event;
+}
+
+TEST(UeventTest, fields) {
+    auto event = parse(kPartnerAdd);
+
+    EXPECT_EQ("add", event.action());
+    EXPECT_EQ("/devices/platform/soc/soc:qcom,pmic_glink/typec/port0/port0-partner",
+              event.devpath());
+    EXPECT_EQ("typec_partner", event.devtype());
+    EXPECT_EQ("typec", event.get("SUBSYSTEM"));
+    EXPECT_EQ("4528", event.get("SEQNUM"));
+    EXPECT_EQ(5, event.size());
+    EXPECT_EQ("ACTION=add", event[0]);
+}
+
+TEST(UeventTest, missingKey) {
+    auto event = parse(kPartnerAdd);
+
+    EXPECT_FALSE(event.get("DRIVER").has_value());
+    // a key is only matched in full
+    EXPECT_FALSE(event.get("SEQ").has_value());
+    EXPECT_FALSE(event.get("DEVTYPE=typec").has_value());
+}
+
+TEST(UeventTest, headerOnly) {
+    auto msg = message({"remove@/devices/virtual/typec/port0/port0-partner"});
+    auto event = parse(msg);
+
+    EXPECT_EQ("remove", event.action());
+    EXPECT_EQ("/devices/virtual/typec/port0/port0-partner", event.devpath());
+    EXPECT_EQ("", event.devtype());
+    EXPECT_EQ(0, event.size());
+}
+
+TEST(UeventTest, emptyValue) {
+    auto msg = message({"change@/devices/x", "ACTION=change", "DRIVER="});
+    auto event = parse(msg);
+
+    EXPECT_EQ("", event.get("DRIVER"));
+}
+
+TEST(UeventTest, malformed) {
+    Uevent event;
+    auto noHeader = message({"ACTION=add", "DEVPATH=/devices/x"});
+
+    EXPECT_FALSE(event.parse("", 0));
+    EXPECT_FALSE(event.parse(noHeader.data(), noHeader.size()));
+}
+
+TEST(UeventTest, unterminated) {
+    std::string msg = message({"change@/devices/x", "ACTION=change"}) + "DEVTYPE=typec_port";
+    auto event = parse(msg);
+
+    EXPECT_EQ("typec_port", event.devtype());
+}
+
+TEST(UeventTest, tooManyFields) {
+    std::string msg = message({"change@/devices/x"});
+
+    for (size_t i = 0; i < Uevent::kMaxFields + 8; i++) {
+        msg += "KEY" + std::to_string(i) + "=" + std::to_string(i) + '\0';
+    }
+    msg += message({"DEVTYPE=typec_port"});
+    auto event = parse(msg);
+
+    EXPECT_EQ(Uevent::kMaxFields, event.size());
+    // fields past those kept are still found, as are the well-known keys
+    EXPECT_EQ("63", event.get("KEY63").value_or(""));
+    EXPECT_EQ("64", event.get("KEY64").value_or(""));
+    EXPECT_EQ("70", event.get("KEY70").value_or(""));
+    EXPECT_EQ("typec_port", event.get("DEVTYPE").value_or(""));
+    EXPECT_FALSE(event.get("KEY72").has_value());
+    EXPECT_EQ("typec_port", event.devtype());
+}
+
+TEST(UeventTest, reused) {
+    Uevent event;
+    auto msg = message({"change@/devices/x", "ACTION=change"});
+
+    ASSERT_TRUE(event.parse(kPartnerAdd.data(), kPartnerAdd.size()));
+    ASSERT_TRUE(event.parse(msg.data(), msg.size()));
+
+    EXPECT_EQ("", event.devtype());
+    EXPECT_FALSE(event.get("SEQNUM").has_value());
+}
+
+TEST(UeventTest, partnerAdded) {
+    EXPECT_TRUE(isPartnerAdded(parse(kPartnerAdd)));
+    EXPECT_TRUE(isPortChanged(parse(kPartnerAdd)));
+}
+
+TEST(UeventTest, partnerRemoved) {
+    auto msg = message({
+            "remove@/devices/platform/soc/soc:qcom,pmic_glink/typec/port0/port0-partner",
+            "ACTION=remove",
+            "DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/typec/port0/port0-partner",
+            "SUBSYSTEM=typec",
+            "DEVTYPE=typec_partner",
+    });
+    auto event = parse(msg);
+
+    EXPECT_FALSE(isPartnerAdded(event));
+    EXPECT_TRUE(isPortChanged(event));
+}
+
+TEST(UeventTest, portChanged) {
+    auto msg = message({
+            "change@/devices/platform/soc/soc:qcom,pmic_glink/typec/port0",
+            "ACTION=change",
+            "DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/typec/port0",
+            "SUBSYSTEM=typec",
+            "DEVTYPE=typec_port",
+    });
+    auto event = parse(msg);
+
+    EXPECT_FALSE(isPartnerAdded(event));
+    EXPECT_TRUE(isPortChanged(event));
+}
+
+TEST(UeventTest, moistureDetected) {
+    auto msg = message({
+            "change@/devices/platform/soc/c440000.qcom,spmi/power_supply/usb",
+            "ACTION=change",
+            "DEVPATH=/devices/platform/soc/c440000.qcom,spmi/power_supply/usb",
+            "SUBSYSTEM=power_supply",
+            "POWER_SUPPLY_NAME=usb",
+            "POWER_SUPPLY_MOISTURE_DETECTED=1",
+    });
+    auto event = parse(msg);
+
+    EXPECT_FALSE(isPartnerAdded(event));
+    EXPECT_TRUE(isPortChanged(event));
+}
+
+TEST(UeventTest, unrelated) {
+    auto batteryMsg = message({
+            "change@/devices/platform/soc/c440000.qcom,spmi/power_supply/battery",
+            "ACTION=change",
+            "DEVPATH=/devices/platform/soc/c440000.qcom,spmi/power_supply/battery",
+            "SUBSYSTEM=power_supply",
+            "POWER_SUPPLY_NAME=battery",
+            "POWER_SUPPLY_CAPACITY=87",
+    });
+    auto battery = parse(batteryMsg);
+    // added, but not a partner
+    auto cableMsg = message({
+            "add@/devices/platform/soc/soc:qcom,pmic_glink/typec/port0/port0-cable",
+            "ACTION=add",
+            "DEVPATH=/devices/platform/soc/soc:qcom,pmic_glink/typec/port0/port0-cable",
+            "SUBSYSTEM=typec",
+    });
+    auto cable = parse(cableMsg);
+
+    EXPECT_FALSE(isPartnerAdded(battery));
+    EXPECT_FALSE(isPortChanged(battery));
+    EXPECT_FALSE(isPartnerAdded(cable));
+    EXPECT_FALSE(isPortChanged(cable));
+}
+
+TEST(UeventTest, matchers) {
+    static constexpr StartsWith kTypec{"typec_"};
+    static constexpr EndsWith kPartner{"-partner"};
+    static constexpr Exactly kAdd{"add"};
+
+    static_assert(kTypec("typec_port"));
+    static_assert(!kTypec("typec"));
+    static_assert(kPartner("port0-partner"));
+    static_assert(!kPartner("partner"));
+    static_assert(kAdd("add"));
+    static_assert(!kAdd("addx"));
+    EXPECT_TRUE(kTypec("typec_"));
+    EXPECT_FALSE(kPartner(""));
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
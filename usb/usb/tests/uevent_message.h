@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <initializer_list>
+#include <string>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace usb {
+
+// Builds a uevent message from its fields, each terminated by a NUL as sent
+// by the kernel.
+inline std::string message(std::initializer_list<std::string> fields) {
+    std::string msg;
+
+    for (auto &field : fields) {
+        msg += field;
+        msg += '\0';
+    }
+
+    return msg;
+}
+
+}  // namespace usb
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CommandQueue.h"
+
+#include <utils/Trace.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+void CommandQueue::run(Kind kind, std::function<void()> apply, std::function<void()> drop) {
+    if (mWriter.load(std::memory_order_relaxed) == std::this_thread::get_id()) {
+        apply();
+        std::lock_guard<std::mutex> lock(mMutex);
+        mApplied++;
+        return;
+    }
+
+    Command command{kind, std::move(apply), std::move(drop), false};
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    Command *superseded = supersede(kind);
+    mPending.push_back(&command);
+
+    if (superseded) {
+        lock.unlock();
+        if (superseded->drop) {
+            superseded->drop();
+        }
+        lock.lock();
+        superseded->done = true;
+        mDropped++;
+        mCv.notify_all();
+    }
+
+    while (!command.done) {
+        // with nothing pending, the command is being dropped
+        if (mWriting || mPending.empty()) {
+            mCv.wait(lock);
+            continue;
+        }
+
+        // Take over as the writer until this command is applied, or dropped,
+        // then leave whatever was queued after it to its own caller.
+        mWriting = true;
+        mWriter.store(std::this_thread::get_id(), std::memory_order_relaxed);
+        while (!command.done && !mPending.empty()) {
+            Command *next = mPending.front();
+            mPending.pop_front();
+            lock.unlock();
+            {
+                ATRACE_NAME("CommandQueue::apply");
+                next->apply();
+            }
+            lock.lock();
+            next->done = true;
+            mApplied++;
+        }
+        mWriter.store(std::thread::id(), std::memory_order_relaxed);
+        mWriting = false;
+        mCv.notify_all();
+    }
+}
+
+size_t CommandQueue::pending() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mPending.size();
+}
+
+uint64_t CommandQueue::applied() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mApplied;
+}
+
+uint64_t CommandQueue::dropped() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mDropped;
+}
+
+CommandQueue::Command *CommandQueue::supersede(Kind next) {
+    if (mPending.empty()) {
+        return nullptr;
+    }
+
+    Command *last = mPending.back();
+    if ((last->kind == Kind::ON && next == Kind::OFF) ||
+        (last->kind == Kind::AMPLITUDE && next == Kind::AMPLITUDE)) {
+        mPending.pop_back();
+        return last;
+    }
+
+    return nullptr;
+}
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+// Serializes commands from any number of threads so that the register writes
+// of one are never interleaved with those of another. Commands are applied one
+// at a time and in order by a single writer: whichever caller finds no writer
+// at work takes the role and applies everything queued up to and including its
+// own command, so an uncontended call costs no thread handoff. Commands that a
+// later one makes redundant are dropped while they wait.
+class CommandQueue {
+  public:
+    enum class Kind : uint8_t {
+        OTHER,      // always applied
+        ON,         // dropped when directly followed by OFF
+        OFF,
+        AMPLITUDE,  // dropped when directly followed by another AMPLITUDE
+    };
+
+  public:
+    // Returns once the command has been applied, or once 'drop' has run
+    // instead if the command was superseded while queued. Commands issued
+    // from within 'apply' are applied immediately.
+    void run(Kind kind, std::function<void()> apply, std::function<void()> drop = nullptr);
+
+    // Reports how many commands are waiting to be applied.
+    size_t pending();
+    // Reports how many commands were applied and dropped so far.
+    uint64_t applied();
+    uint64_t dropped();
+
+  private:
+    struct Command {
+        Kind kind;
+        std::function<void()> apply;
+        std::function<void()> drop;
+        bool done;
+    };
+
+    // Pops the pending command that 'next' supersedes, if any. Called with the
+    // lock held.
+    Command *supersede(Kind next);
+
+  private:
+    std::mutex mMutex;
+    std::condition_variable mCv;
+    std::deque<Command *> mPending;
+    bool mWriting{false};
+    std::atomic<std::thread::id> mWriter;
+    uint64_t mApplied{0};
+    uint64_t mDropped{0};
+};
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -16,9 +16,13 @@
 
 #include "HardwareBase.h"
 
+#include <android-base/file.h>
 #include <cutils/properties.h>
+#include <fcntl.h>
 #include <log/log.h>
+#include <unistd.h>
 
+#include <cinttypes>
 #include <fstream>
 #include <sstream>
 
@@ -40,6 +44,41 @@ bool HwApiBase::has(const std::ios &stream) {
     return !!stream;
 }
 
+void HwApiBase::openRaw(const std::string &name, unique_fd *fd) {
+    auto path = mPathPrefix + name;
+    // sysfs ignores O_APPEND, while regular files standing in for attributes
+    // keep every write, as they do for the streams
+    fd->reset(TEMP_FAILURE_RETRY(::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC)));
+    if (!fd->ok()) {
+        ALOGE("Failed to open %s (%d): %s", path.c_str(), errno, strerror(errno));
+    }
+}
+
+bool HwApiBase::setRaw(int32_t value, const unique_fd &fd) {
+    char buf[16];
+    int len = snprintf(buf, sizeof(buf), "%" PRId32 "\n", value);
+
+    if (TEMP_FAILURE_RETRY(write(fd, buf, len)) != len) {
+        ALOGE("Failed to write fd %d (%d): %s", fd.get(), errno, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void HwApiBase::invalidate() {
+    mShadow.clear();
+}
+
+void HwApiBase::invalidate(const std::ios *stream) {
+    mShadow.erase(stream);
+}
+
+void HwApiBase::resetLatencies() {
+    for (auto &latency : mLatencies) {
+        latency.second.reset();
+    }
+}
+
 void HwApiBase::debug(int fd) {
     dprintf(fd, "Kernel:\n");
 
@@ -54,37 +93,76 @@ void HwApiBase::debug(int fd) {
         }
     }
 
-    mRecordsMutex.lock();
+    LatencyHistogram::dumpHeader(fd, "Write Latency:");
+    for (auto &latency : mLatencies) {
+        if (latency.second.count() != 0) {
+            latency.second.dump(fd, mNames[latency.first].c_str());
+        }
+    }
+
     dprintf(fd, "  Records:\n");
-    for (auto &r : mRecords) {
-        if (r == nullptr) {
+    uint64_t head = mRecordsHead.load(std::memory_order_acquire);
+    for (uint64_t index = head > RECORDS_SIZE ? head - RECORDS_SIZE : 0; index < head; index++) {
+        Record &r = mRecords[index % RECORDS_SIZE];
+        uint64_t seq = r.seq.load(std::memory_order_acquire);
+        auto func = r.func;
+        auto stream = r.stream;
+        auto time = r.time;
+        auto format = r.format;
+        char value[RECORD_VALUE_SIZE];
+        std::stringstream line;
+
+        std::memcpy(value, r.value, sizeof(value));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // skip slots that are still being written or were reused meanwhile
+        if (seq != index * 2 + 2 || r.seq.load(std::memory_order_relaxed) != seq) {
             continue;
         }
-        dprintf(fd, "    %s\n", r->toString(mNames).c_str());
+
+        line << func << " '" << mNames.at(stream) << "' = '";
+        format(&line, value);
+        line << "'";
+        dprintf(fd, "    [%.3f] %s\n",
+                std::chrono::duration<double, std::milli>(time.time_since_epoch()).count(),
+                line.str().c_str());
     }
-    mRecordsMutex.unlock();
 }
 
 HwCalBase::HwCalBase() {
-    std::ifstream calfile;
+    ATRACE_NAME("HwCalBase::HwCalBase");
     auto propertyPrefix = std::getenv("PROPERTY_PREFIX");
+    auto calPath = std::getenv("CALIBRATION_FILEPATH");
+    std::string calfile;
 
     if (propertyPrefix != NULL) {
         mPropertyPrefix = std::string(propertyPrefix);
+        // one walk of the property area rather than a lookup per key
+        property_list(
+            [](const char *key, const char *value, void *cookie) {
+                auto obj = static_cast<HwCalBase *>(cookie);
+                if (!strncmp(key, obj->mPropertyPrefix.c_str(), obj->mPropertyPrefix.size())) {
+                    obj->mProperties[key + obj->mPropertyPrefix.size()] = value;
+                }
+            },
+            this);
     } else {
         ALOGE("Failed get property prefix!");
     }
 
-    utils::fileFromEnv("CALIBRATION_FILEPATH", &calfile);
+    if (calPath == nullptr) {
+        ALOGE("Failed get env CALIBRATION_FILEPATH");
+    } else if (!::android::base::ReadFileToString(calPath, &calfile)) {
+        ALOGE("Failed to open %s (%d): %s", calPath, errno, strerror(errno));
+    }
 
-    for (std::string line; std::getline(calfile, line);) {
+    std::istringstream lines{calfile};
+    for (std::string line; std::getline(lines, line);) {
         if (line.empty() || line[0] == '#') {
             continue;
         }
-        std::istringstream is_line(line);
-        std::string key, value;
-        if (std::getline(is_line, key, ':') && std::getline(is_line, value)) {
-            mCalData[utils::trim(key)] = utils::trim(value);
+        auto colon = line.find(':');
+        if (colon != std::string::npos && colon + 1 < line.size()) {
+            mCalData[utils::trim(line.substr(0, colon))] = utils::trim(line.substr(colon + 1));
         }
     }
 }
@@ -18,13 +18,24 @@
 #include <android-base/unique_fd.h>
 #include <log/log.h>
 #include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 #include <utils/Trace.h>
 
-#include <list>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <map>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
 
+#include "LatencyHistogram.h"
 #include "utils.h"
 
 namespace aidl {
@@ -38,30 +49,25 @@ class HwApiBase {
   private:
     using NamesMap = std::map<const std::ios *, std::string>;
 
-    class RecordInterface {
-      public:
-        virtual std::string toString(const NamesMap &names) = 0;
-        virtual ~RecordInterface() {}
-    };
-    template <typename T>
-    class Record : public RecordInterface {
-      public:
-        Record(const char *func, const T &value, const std::ios *stream)
-            : mFunc(func), mValue(value), mStream(stream) {}
-        std::string toString(const NamesMap &names) override;
-
-      private:
-        const char *mFunc;
-        const T mValue;
-        const std::ios *mStream;
-    };
-    using Records = std::list<std::unique_ptr<RecordInterface>>;
-
     static constexpr uint32_t RECORDS_SIZE = 32;
+    static constexpr size_t RECORD_VALUE_SIZE = 32;
+
+    // One recorded access, kept as plain data so that recording neither locks
+    // nor allocates. The value is stored raw and only formatted by debug().
+    struct Record {
+        // odd while the slot is being written, 2 * (index + 1) once complete
+        std::atomic<uint64_t> seq;
+        const char *func;
+        const std::ios *stream;
+        std::chrono::steady_clock::time_point time;
+        void (*format)(std::ostream *out, const char *value);
+        char value[RECORD_VALUE_SIZE];
+    };
 
   public:
     HwApiBase();
     void debug(int fd);
+    void resetLatencies();
 
   protected:
     template <typename T>
@@ -73,16 +79,45 @@ class HwApiBase {
     bool get(T *value, std::istream *stream);
     template <typename T>
     bool set(const T &value, std::ostream *stream);
+    // Like set(), but elides the write if the value matches the last successful write.
+    template <typename T>
+    bool setCached(const T &value, std::ostream *stream);
+    // Forgets all cached values, e.g. after the device state was reset.
+    void invalidate();
+    // Forgets the cached value of one attribute.
+    void invalidate(const std::ios *stream);
+    // Waits for the attribute to read back as the given value. A negative
+    // timeout waits indefinitely. Gives up early, returning false, once
+    // wakeFd, if any, is readable; it is left for the caller to drain.
     template <typename T>
-    bool poll(const T &value, std::istream *stream);
+    bool poll(const T &value, std::ios *stream, int32_t timeoutMs = -1, int wakeFd = -1);
+    // Like open(), but keeps a raw descriptor for attributes written from a
+    // real-time thread, where stream formatting and locking cost too much.
+    void openRaw(const std::string &name, unique_fd *fd);
+    // Writes a value to a descriptor from openRaw() with a single write().
+    // Neither recorded nor timed, so that it never touches shared state.
+    bool setRaw(int32_t value, const unique_fd &fd);
     template <typename T>
     void record(const char *func, const T &value, const std::ios *stream);
 
   private:
+    // Attributes read back their current value alone. Regular files standing
+    // in for them accumulate one line per write instead, so for those the
+    // current value is the last line.
+    template <typename T>
+    bool read(int fd, T *value, bool lastLine);
+    template <typename T>
+    static void formatRecord(std::ostream *out, const char *value);
+
+  private:
+    static constexpr int32_t POLL_FALLBACK_PERIOD_MS = 5;
+
     std::string mPathPrefix;
     NamesMap mNames;
-    Records mRecords{RECORDS_SIZE};
-    std::mutex mRecordsMutex;
+    std::map<const std::ios *, std::string> mShadow;
+    std::map<const std::ios *, LatencyHistogram> mLatencies;
+    std::array<Record, RECORDS_SIZE> mRecords{};
+    std::atomic<uint64_t> mRecordsHead{0};
 };
 
 #define HWAPI_RECORD(args...) HwApiBase::record(__FUNCTION__, ##args)
@@ -90,12 +125,14 @@ class HwApiBase {
 template <typename T>
 void HwApiBase::open(const std::string &name, T *stream) {
     mNames[stream] = name;
+    mLatencies.try_emplace(stream);
     utils::openNoCreate(mPathPrefix + name, stream);
 }
 
 template <typename T>
 void HwApiBase::openFull(const std::string &name, T *stream) {
     mNames[stream] = name;
+    mLatencies.try_emplace(stream);
     utils::openNoCreate(name, stream);
 }
 
@@ -118,34 +155,145 @@ bool HwApiBase::set(const T &value, std::ostream *stream) {
     ATRACE_NAME("HwApi::set");
     using utils::operator<<;
     bool ret;
+    auto start = LatencyHistogram::Clock::now();
     *stream << value << std::endl;
     if (!(ret = !!*stream)) {
         ALOGE("Failed to write %s (%d): %s", mNames[stream].c_str(), errno, strerror(errno));
         stream->clear();
     }
+    if (auto latency = mLatencies.find(stream); latency != mLatencies.end()) {
+        latency->second.record(LatencyHistogram::Clock::now() - start);
+    }
     HWAPI_RECORD(value, stream);
     return ret;
 }
 
 template <typename T>
-bool HwApiBase::poll(const T &value, std::istream *stream) {
+bool HwApiBase::setCached(const T &value, std::ostream *stream) {
+    using utils::operator<<;
+    std::stringstream formatted;
+    formatted << value;
+    auto shadow = mShadow.find(stream);
+    if (shadow != mShadow.end() && shadow->second == formatted.str()) {
+        return true;
+    }
+    if (!set(value, stream)) {
+        mShadow.erase(stream);
+        return false;
+    }
+    mShadow[stream] = formatted.str();
+    return true;
+}
+
+template <typename T>
+bool HwApiBase::read(int fd, T *value, bool lastLine) {
+    char buf[32];
+    off_t offset = 0;
+    struct stat st;
+
+    if (lastLine) {
+        if (fstat(fd, &st)) {
+            return false;
+        }
+        offset = std::max<off_t>(st.st_size - (sizeof(buf) - 1), 0);
+    }
+
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, offset);
+
+    if (len < 0) {
+        return false;
+    }
+    buf[len] = '\0';
+
+    std::string_view text{buf, static_cast<size_t>(len)};
+    if (lastLine) {
+        text = text.substr(0, text.find_last_not_of('\n') + 1);
+        text = text.substr(text.find_last_of('\n') + 1);
+    }
+
+    std::istringstream stream{std::string(text)};
+    stream >> *value;
+    return !!stream;
+}
+
+template <typename T>
+bool HwApiBase::poll(const T &value, std::ios *stream, int32_t timeoutMs, int wakeFd) {
     ATRACE_NAME("HwApi::poll");
     auto path = mPathPrefix + mNames[stream];
     unique_fd fileFd{::open(path.c_str(), O_RDONLY)};
     unique_fd epollFd{epoll_create(1)};
+    unique_fd notifyFd;
     epoll_event event = {
         .events = EPOLLPRI | EPOLLET,
+        .data = {.fd = fileFd},
     };
+    epoll_event ready[2];
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    bool pollable = true;
     T actual;
     bool ret;
 
+    if (!fileFd.ok()) {
+        ALOGE("Failed to open %s (%d): %s", mNames[stream].c_str(), errno, strerror(errno));
+        return false;
+    }
+
     if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fileFd, &event)) {
-        ALOGE("Failed to poll %s (%d): %s", mNames[stream].c_str(), errno, strerror(errno));
+        if (errno != EPERM) {
+            ALOGE("Failed to poll %s (%d): %s", mNames[stream].c_str(), errno, strerror(errno));
+            return false;
+        }
+        // not a sysfs node, so no EPOLLPRI; wait for modifications instead, or
+        // failing that, re-read periodically
+        pollable = false;
+        notifyFd.reset(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+        event.events = EPOLLIN;
+        event.data.fd = notifyFd;
+        if (!notifyFd.ok() || inotify_add_watch(notifyFd, path.c_str(), IN_MODIFY) < 0 ||
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, notifyFd, &event)) {
+            notifyFd.reset();
+        }
+    }
+
+    event.events = EPOLLIN;
+    event.data.fd = wakeFd;
+    if (wakeFd >= 0 && epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event)) {
+        ALOGE("Failed to poll wake fd (%d): %s", errno, strerror(errno));
         return false;
     }
 
-    while ((ret = get(&actual, stream)) && (actual != value)) {
-        epoll_wait(epollFd, &event, 1, -1);
+    while ((ret = read(fileFd, &actual, !pollable)) && (actual != value)) {
+        int32_t waitMs = -1;
+
+        if (timeoutMs >= 0) {
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0) {
+                ret = false;
+                break;
+            }
+            waitMs = remaining.count();
+        }
+
+        if (!pollable && !notifyFd.ok() && (waitMs < 0 || waitMs > POLL_FALLBACK_PERIOD_MS)) {
+            waitMs = POLL_FALLBACK_PERIOD_MS;
+        }
+
+        // with nothing else to wait on, this sleeps until the next re-read
+        int count = epoll_wait(epollFd, ready, 2, waitMs);
+        bool woken = false;
+        for (int i = 0; i < count; i++) {
+            woken |= wakeFd >= 0 && ready[i].data.fd == wakeFd;
+        }
+        if (notifyFd.ok()) {
+            alignas(inotify_event) char events[sizeof(inotify_event) * 8];
+            while (::read(notifyFd, events, sizeof(events)) > 0) {
+            }
+        }
+        if (woken) {
+            ret = false;
+            break;
+        }
     }
 
     HWAPI_RECORD(value, stream);
@@ -154,19 +302,37 @@ bool HwApiBase::poll(const T &value, std::istream *stream) {
 
 template <typename T>
 void HwApiBase::record(const char *func, const T &value, const std::ios *stream) {
-    std::lock_guard<std::mutex> lock(mRecordsMutex);
-    mRecords.emplace_back(std::make_unique<Record<T>>(func, value, stream));
-    mRecords.pop_front();
+    uint64_t index = mRecordsHead.fetch_add(1, std::memory_order_relaxed);
+    Record &r = mRecords[index % RECORDS_SIZE];
+
+    r.seq.store(index * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    r.func = func;
+    r.stream = stream;
+    r.time = std::chrono::steady_clock::now();
+    r.format = &formatRecord<T>;
+    if constexpr (std::is_same_v<T, std::string>) {
+        r.value[value.copy(r.value, RECORD_VALUE_SIZE - 1)] = '\0';
+    } else {
+        static_assert(std::is_trivially_copyable_v<T> && sizeof(T) <= RECORD_VALUE_SIZE);
+        std::memcpy(r.value, &value, sizeof(T));
+    }
+
+    r.seq.store(index * 2 + 2, std::memory_order_release);
 }
 
 template <typename T>
-std::string HwApiBase::Record<T>::toString(const NamesMap &names) {
+void HwApiBase::formatRecord(std::ostream *out, const char *value) {
     using utils::operator<<;
-    std::stringstream ret;
-
-    ret << mFunc << " '" << names.at(mStream) << "' = '" << mValue << "'";
 
-    return ret.str();
+    if constexpr (std::is_same_v<T, std::string>) {
+        *out << value;
+    } else {
+        T typed;
+        std::memcpy(&typed, value, sizeof(T));
+        *out << typed;
+    }
 }
 
 class HwCalBase {
@@ -177,36 +343,44 @@ class HwCalBase {
   protected:
     template <typename T>
     bool getProperty(const char *key, T *value, const T defval);
+    // Parses the calibration entry for |key| as a T. Meant to be called once
+    // per key while the subclass is constructed, so that its lookups only
+    // read fields set before any other thread sees the object.
     template <typename T>
-    bool getPersist(const char *key, T *value);
+    std::optional<T> parsePersist(const char *key) const;
 
   private:
     std::string mPropertyPrefix;
-    std::map<std::string, std::string> mCalData;
+    // Properties under the prefix, keyed without it, captured in a single pass.
+    std::unordered_map<std::string, std::string> mProperties;
+    // Calibration entries as read from the file, keyed by name.
+    std::unordered_map<std::string, std::string> mCalData;
 };
 
 template <typename T>
 bool HwCalBase::getProperty(const char *key, T *outval, const T defval) {
     ATRACE_NAME("HwCal::getProperty");
-    *outval = utils::getProperty(mPropertyPrefix + key, defval);
+    auto it = mProperties.find(key);
+    *outval = (it == mProperties.end()) ? defval : utils::parseProperty(it->second, defval);
     return true;
 }
 
 template <typename T>
-bool HwCalBase::getPersist(const char *key, T *value) {
-    ATRACE_NAME("HwCal::getPersist");
+std::optional<T> HwCalBase::parsePersist(const char *key) const {
+    ATRACE_NAME("HwCal::parsePersist");
     auto it = mCalData.find(key);
     if (it == mCalData.end()) {
         ALOGE("Missing %s config!", key);
-        return false;
+        return std::nullopt;
     }
+    T value{};
     std::stringstream stream{it->second};
-    utils::unpack(stream, value);
+    utils::unpack(stream, &value);
     if (!stream || !stream.eof()) {
         ALOGE("Invalid %s config!", key);
-        return false;
+        return std::nullopt;
     }
-    return true;
+    return value;
 }
 
 }  // namespace vibrator
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+// Counts durations in power-of-two nanosecond buckets. Recording is a couple
+// of relaxed atomic operations, so it is safe on any thread and never blocks;
+// percentiles are reported as the upper bound of their bucket.
+class LatencyHistogram {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    // bucket n holds durations in [2^(n-1), 2^n) ns, the last one anything longer
+    static constexpr size_t BUCKETS = 40;
+
+  public:
+    void record(Clock::duration latency) {
+        uint64_t ns = std::max<int64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count(), 0);
+        size_t bucket = std::min<size_t>(ns ? 64 - __builtin_clzll(ns) : 0, BUCKETS - 1);
+        uint64_t max = mMaxNs.load(std::memory_order_relaxed);
+
+        mBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        while (ns > max && !mMaxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    void reset() {
+        for (auto &bucket : mBuckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        mMaxNs.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        uint64_t count = 0;
+        for (auto &bucket : mBuckets) {
+            count += bucket.load(std::memory_order_relaxed);
+        }
+        return count;
+    }
+
+    uint64_t maxNs() const { return mMaxNs.load(std::memory_order_relaxed); }
+
+    // Returns an upper bound for the given fraction of samples, in ns.
+    uint64_t percentileNs(double fraction) const {
+        uint64_t total = count();
+        uint64_t target = std::ceil(fraction * total);
+        uint64_t seen = 0;
+
+        if (total == 0) {
+            return 0;
+        }
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += mBuckets[i].load(std::memory_order_relaxed);
+            if (seen >= target) {
+                return std::min(i ? uint64_t{1} << i : 0, maxNs());
+            }
+        }
+        return maxNs();
+    }
+
+    // Prints one row of a table started with dumpHeader().
+    void dump(int fd, const char *name) const {
+        dprintf(fd, "    %-24s %8" PRIu64 " %10.1f %10.1f %10.1f %10.1f\n", name, count(),
+                percentileNs(0.50) / 1000.0, percentileNs(0.90) / 1000.0,
+                percentileNs(0.99) / 1000.0, maxNs() / 1000.0);
+    }
+
+    static void dumpHeader(int fd, const char *title) {
+        dprintf(fd, "  %-26s %8s %10s %10s %10s %10s\n", title, "count", "p50 us", "p90 us",
+                "p99 us", "max us");
+    }
+
+  private:
+    std::array<std::atomic<uint64_t>, BUCKETS> mBuckets{};
+    std::atomic<uint64_t> mMaxNs{0};
+};
+
+// Records the lifetime of the enclosing scope into a histogram.
+class ScopedLatency {
+  public:
+    explicit ScopedLatency(LatencyHistogram *histogram)
+        : mHistogram(histogram), mStart(LatencyHistogram::Clock::now()) {}
+    ~ScopedLatency() { mHistogram->record(LatencyHistogram::Clock::now() - mStart); }
+
+  private:
+    LatencyHistogram *mHistogram;
+    LatencyHistogram::Clock::time_point mStart;
+};
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
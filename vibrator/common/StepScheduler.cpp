@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "StepScheduler.h"
+
+#include <log/log.h>
+#include <pthread.h>
+#include <utils/Trace.h>
+
+#include <cstring>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+StepScheduler::StepScheduler(int priority)
+    : mPriority(priority), mThread(&StepScheduler::loop, this) {}
+
+StepScheduler::~StepScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mExit = true;
+    }
+    mCv.notify_all();
+    mThread.join();
+}
+
+uint64_t StepScheduler::start(std::vector<Step> steps, std::function<void()> done) {
+    uint64_t list;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mSteps.assign(std::make_move_iterator(steps.begin()),
+                      std::make_move_iterator(steps.end()));
+        mDone = std::move(done);
+        mStart = Clock::now();
+        list = ++mGeneration;
+    }
+    mCv.notify_all();
+
+    return list;
+}
+
+std::function<void()> StepScheduler::cancel() {
+    std::function<void()> done;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mSteps.clear();
+        done = std::move(mDone);
+        mDone = nullptr;
+        mGeneration++;
+    }
+    mCv.notify_all();
+
+    return done;
+}
+
+bool StepScheduler::idle() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSteps.empty();
+}
+
+bool StepScheduler::current(uint64_t list) {
+    return mGeneration.load() == list;
+}
+
+void StepScheduler::loop() {
+    if (mPriority > 0) {
+        sched_param param{.sched_priority = mPriority};
+        // best effort; without the capability the steps still run, just with more jitter
+        if (int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) {
+            ALOGW("Failed to set step priority (%d): %s", err, strerror(err));
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while (!mExit) {
+        if (mSteps.empty()) {
+            mCv.wait(lock, [&] { return mExit || !mSteps.empty(); });
+            continue;
+        }
+
+        uint64_t generation = mGeneration;
+        auto deadline = mStart + mSteps.front().offset;
+
+        if (mCv.wait_until(lock, deadline,
+                           [&] { return mExit || mGeneration != generation; })) {
+            continue;
+        }
+
+        auto step = std::move(mSteps.front());
+        mSteps.pop_front();
+
+        lock.unlock();
+        {
+            ATRACE_NAME("StepScheduler::step");
+            step.action();
+        }
+        lock.lock();
+
+        // 'done' stays in place until now, so a cancel() during the last step still returns it
+        if (mGeneration == generation && mSteps.empty() && mDone) {
+            auto done = std::move(mDone);
+            mDone = nullptr;
+            lock.unlock();
+            done();
+            lock.lock();
+        }
+    }
+}
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+// Runs a precomputed list of actions on a dedicated thread, each one at an
+// absolute deadline relative to the start of the list.
+class StepScheduler {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Step {
+        Clock::duration offset;
+        std::function<void()> action;
+    };
+
+  public:
+    // A non-zero priority runs the steps under SCHED_FIFO at that priority,
+    // for lists whose cadence matters more than their throughput.
+    explicit StepScheduler(int priority = 0);
+    ~StepScheduler();
+
+    // Replaces any pending steps. The optional 'done' action runs right after
+    // the last step, unless the list is cancelled or replaced first. Returns
+    // an identifier for the list.
+    uint64_t start(std::vector<Step> steps, std::function<void()> done = nullptr);
+    // Drops any pending steps. Returns the 'done' action of the list if it
+    // had yet to run, for the caller to run in its stead, e.g. to report that
+    // the list was cut short.
+    std::function<void()> cancel();
+    // Reports whether no steps are pending.
+    bool idle();
+    // Reports whether the given list is still the one being played, i.e. it
+    // was neither cancelled nor replaced. A step already under way is not
+    // stopped by either, so steps that must not outlive their list check this.
+    // Does not lock, so that steps on a real-time thread can check it.
+    bool current(uint64_t list);
+
+  private:
+    void loop();
+
+  private:
+    std::mutex mMutex;
+    std::condition_variable mCv;
+    std::deque<Step> mSteps;
+    std::function<void()> mDone;
+    Clock::time_point mStart;
+    std::atomic<uint64_t> mGeneration{0};
+    bool mExit{false};
+    int mPriority;
+    std::thread mThread;
+};
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SysfsSimulator.h"
+
+#include <cutils/fs.h>
+#include <fcntl.h>
+#include <log/log.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+// Reads from the given offset to the end of the file.
+static std::string readFrom(int fd, off_t offset) {
+    std::string content;
+    char buf[256];
+    ssize_t len;
+
+    while ((len = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf), offset))) > 0) {
+        content.append(buf, len);
+        offset += len;
+    }
+
+    return content;
+}
+
+SysfsSimulator::SysfsSimulator(const std::map<std::string, std::string> &attributes)
+    : mPrefix(std::filesystem::path(mDir.path) / ""),
+      mNotifyFd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+      mTimerFd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      mExitFd(eventfd(0, EFD_CLOEXEC)),
+      mEpollFd(epoll_create1(EPOLL_CLOEXEC)) {
+    for (auto &[name, initial] : attributes) {
+        auto path = mPrefix + name;
+        auto &attr = mAttributes[name];
+
+        fs_mkdirs(path.c_str(), S_IRWXU);
+        attr.name = name;
+        attr.fd.reset(::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR));
+        if (!attr.fd.ok()) {
+            ALOGE("Failed to create %s (%d): %s", path.c_str(), errno, strerror(errno));
+            continue;
+        }
+
+        // the initial value behaves like a store made before the HAL opened
+        if (!initial.empty()) {
+            attr.stored = initial + "\n";
+            TEMP_FAILURE_RETRY(pwrite(attr.fd, attr.stored.data(), attr.stored.size(), 0));
+        }
+
+        int wd = inotify_add_watch(mNotifyFd, path.c_str(), IN_MODIFY);
+        if (wd < 0) {
+            ALOGE("Failed to watch %s (%d): %s", path.c_str(), errno, strerror(errno));
+            continue;
+        }
+        mWatches[wd] = &attr;
+    }
+
+    for (int fd : {mNotifyFd.get(), mTimerFd.get(), mExitFd.get()}) {
+        epoll_event event = {.events = EPOLLIN, .data = {.fd = fd}};
+        epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    mThread = std::thread(&SysfsSimulator::loop, this);
+}
+
+SysfsSimulator::~SysfsSimulator() {
+    uint64_t one = 1;
+    TEMP_FAILURE_RETRY(write(mExitFd, &one, sizeof(one)));
+    mThread.join();
+}
+
+void SysfsSimulator::setWriteLatency(std::chrono::microseconds latency) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mWriteLatency = latency;
+}
+
+void SysfsSimulator::onWrite(const std::string &name, Handler handler) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (auto attr = find(name)) {
+        attr->handlers.push_back(std::move(handler));
+    }
+}
+
+void SysfsSimulator::modelActivate(const std::string &activate, const std::string &duration) {
+    auto generation = std::make_shared<std::atomic<uint64_t>>(0);
+
+    onWrite(activate, [this, activate, duration, generation](const std::string &value) {
+        // any write cancels a pending auto-clear
+        auto current = ++*generation;
+
+        if (value != "1") {
+            return;
+        }
+
+        auto ms = std::strtoul(load(duration).c_str(), nullptr, 10);
+        std::lock_guard<std::mutex> lock(mMutex);
+        schedule(Clock::now() + std::chrono::milliseconds(ms), [=] {
+            if (*generation == current) {
+                store(activate, "0");
+            }
+        });
+    });
+}
+
+void SysfsSimulator::store(const std::string &name, const std::string &value) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (auto attr = find(name)) {
+        // account for the HAL's writes first, so that their notifications
+        // cannot be mistaken for the one caused by this store
+        drainNotifications();
+        storeLocked(attr, value);
+    }
+}
+
+std::string SysfsSimulator::load(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto attr = find(name);
+
+    if (attr == nullptr) {
+        return "";
+    }
+
+    std::string content = readFrom(attr->fd, 0);
+    content.erase(content.find_last_not_of('\n') + 1);
+    return content.substr(content.find_last_of('\n') + 1);
+}
+
+uint32_t SysfsSimulator::writes(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    drainNotifications();
+    auto attr = find(name);
+    return attr ? attr->writes : 0;
+}
+
+SysfsSimulator::Clock::duration SysfsSimulator::busTime() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    drainNotifications();
+    return mBusTime;
+}
+
+void SysfsSimulator::loop() {
+    for (;;) {
+        epoll_event events[3];
+        int count = epoll_wait(mEpollFd, events, std::size(events), -1);
+        std::vector<std::function<void()>> due;
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.fd == mExitFd) {
+                return;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            uint64_t expirations;
+
+            drainNotifications();
+
+            TEMP_FAILURE_RETRY(read(mTimerFd, &expirations, sizeof(expirations)));
+            auto now = Clock::now();
+            while (!mTimers.empty() && mTimers.begin()->first <= now) {
+                due.push_back(std::move(mTimers.begin()->second));
+                mTimers.erase(mTimers.begin());
+            }
+            armTimer();
+        }
+
+        for (auto &action : due) {
+            action();
+        }
+    }
+}
+
+void SysfsSimulator::drainNotifications() {
+    alignas(inotify_event) char buf[sizeof(inotify_event) * 32];
+    ssize_t len;
+
+    while ((len = read(mNotifyFd, buf, sizeof(buf))) > 0) {
+        for (char *ptr = buf; ptr < buf + len;) {
+            auto event = reinterpret_cast<inotify_event *>(ptr);
+            if (auto watch = mWatches.find(event->wd); watch != mWatches.end()) {
+                consume(watch->second);
+            }
+            ptr += sizeof(inotify_event) + event->len;
+        }
+    }
+}
+
+void SysfsSimulator::consume(Attribute *attr) {
+    std::string content = readFrom(attr->fd, attr->writeOffset);
+    size_t pos = 0;
+
+    if (attr->storesPending > 0) {
+        attr->storesPending--;
+        if (content == attr->stored) {
+            // nothing but the store itself
+            return;
+        }
+    }
+
+    for (size_t end; (end = content.find('\n', pos)) != std::string::npos; pos = end + 1) {
+        // what is left of a store that was wider than the write over it
+        if (pos > 0 && pos < attr->stored.size() &&
+            content.compare(pos, std::string::npos, attr->stored, pos) == 0) {
+            break;
+        }
+
+        auto start = std::max(Clock::now(), mBusFree);
+        mBusFree = start + mWriteLatency;
+        mBusTime += mWriteLatency;
+        attr->writes++;
+
+        schedule(mBusFree, [handlers = attr->handlers, value = content.substr(pos, end - pos)] {
+            for (auto &handler : handlers) {
+                handler(value);
+            }
+        });
+    }
+
+    attr->writeOffset += pos;
+    attr->stored.erase(0, std::min(pos, attr->stored.size()));
+}
+
+void SysfsSimulator::storeLocked(Attribute *attr, const std::string &value) {
+    attr->stored = value + "\n";
+    attr->storesPending++;
+    TEMP_FAILURE_RETRY(
+            pwrite(attr->fd, attr->stored.data(), attr->stored.size(), attr->writeOffset));
+}
+
+void SysfsSimulator::schedule(Clock::time_point when, std::function<void()> action) {
+    mTimers.emplace(when, std::move(action));
+    armTimer();
+}
+
+void SysfsSimulator::armTimer() {
+    itimerspec spec{};
+
+    if (!mTimers.empty()) {
+        auto when = mTimers.begin()->first.time_since_epoch();
+        auto sec = std::chrono::duration_cast<std::chrono::seconds>(when);
+        spec.it_value.tv_sec = sec.count();
+        spec.it_value.tv_nsec = std::chrono::nanoseconds(when - sec).count();
+        // a zero value would disarm the timer
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+            spec.it_value.tv_nsec = 1;
+        }
+    }
+
+    timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+SysfsSimulator::Attribute *SysfsSimulator::find(const std::string &name) {
+    auto attr = mAttributes.find(name);
+    if (attr == mAttributes.end()) {
+        ALOGE("Unknown attribute %s", name.c_str());
+        return nullptr;
+    }
+    return &attr->second;
+}
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
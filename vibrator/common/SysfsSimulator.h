@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+// Stands in for a sysfs device directory in tests and benchmarks, so that
+// HwApiBase can be exercised with realistic timing. Attributes are regular
+// files in a temporary directory, meant to be used as HWAPI_PATH_PREFIX, and a
+// thread watches them with inotify to play the device side: reacting to
+// writes, updating attributes as the driver would, and charging every write a
+// configurable bus latency.
+//
+// HwApiBase streams never seek, so each file accumulates one line per write
+// and HwApiBase reads the last line back as the current value. Device-side
+// stores go where the HAL writes next and are overwritten by that write, so
+// they have to be as wide as what the HAL writes to the attribute, as 0/1
+// flags are. Attributes must be written through a single descriptor.
+class SysfsSimulator {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using Handler = std::function<void(const std::string &value)>;
+
+  public:
+    // Creates the attributes, mapped to their initial values.
+    explicit SysfsSimulator(const std::map<std::string, std::string> &attributes);
+    ~SysfsSimulator();
+
+    // The directory holding the attributes, with a trailing separator.
+    const std::string &prefix() const { return mPrefix; }
+
+    // Time the device takes to complete each write. Writes complete in
+    // order, so a burst of writes queues up behind the first one.
+    void setWriteLatency(std::chrono::microseconds latency);
+    // Runs on the simulator thread once each write to the attribute has
+    // completed.
+    void onWrite(const std::string &name, Handler handler);
+    // Clears 'activate' once the milliseconds last written to 'duration' have
+    // elapsed after it was set, as the driver does, which is signalled to
+    // HwApiBase::poll() like any other change.
+    void modelActivate(const std::string &activate = "activate",
+                       const std::string &duration = "duration");
+    // Updates an attribute from the device side.
+    void store(const std::string &name, const std::string &value);
+    // Reads the current value of an attribute.
+    std::string load(const std::string &name);
+    // Reports how many writes to the attribute have been seen.
+    uint32_t writes(const std::string &name);
+    // Reports the total time the simulated bus has spent on writes.
+    Clock::duration busTime();
+
+  private:
+    struct Attribute {
+        std::string name;
+        ::android::base::unique_fd fd;
+        // where the HAL's next write lands, and any device-side store there
+        off_t writeOffset{0};
+        std::string stored;
+        uint32_t storesPending{0};
+        uint32_t writes{0};
+        std::vector<Handler> handlers;
+    };
+
+    void loop();
+    // Accounts for the HAL's writes to each modified attribute. This and the
+    // rest below are called with the lock held.
+    void drainNotifications();
+    void consume(Attribute *attr);
+    void storeLocked(Attribute *attr, const std::string &value);
+    void schedule(Clock::time_point when, std::function<void()> action);
+    void armTimer();
+    Attribute *find(const std::string &name);
+
+  private:
+    TemporaryDir mDir;
+    std::string mPrefix;
+    ::android::base::unique_fd mNotifyFd;
+    ::android::base::unique_fd mTimerFd;
+    ::android::base::unique_fd mExitFd;
+    ::android::base::unique_fd mEpollFd;
+    std::mutex mMutex;
+    std::map<std::string, Attribute> mAttributes;
+    std::map<int, Attribute *> mWatches;
+    std::multimap<Clock::time_point, std::function<void()>> mTimers;
+    Clock::duration mWriteLatency{0};
+    Clock::time_point mBusFree;
+    Clock::duration mBusTime{0};
+    std::thread mThread;
+};
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
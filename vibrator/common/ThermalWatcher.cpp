@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ThermalWatcher.h"
+
+#include <utils/Trace.h>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+ThermalWatcher::ThermalWatcher(Reader reader, int32_t lowerBound, int32_t upperBound,
+                               std::chrono::milliseconds period)
+    : mReader(std::move(reader)),
+      mLowerBound(lowerBound),
+      mUpperBound(upperBound),
+      mPeriod(period) {
+    sample();
+    mThread = std::thread(&ThermalWatcher::loop, this);
+}
+
+ThermalWatcher::~ThermalWatcher() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mExit = true;
+    }
+    mCv.notify_all();
+    mThread.join();
+}
+
+void ThermalWatcher::refresh() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto request = ++mRequested;
+    mCv.notify_all();
+    mCv.wait(lock, [&] { return mExit || mCompleted >= request; });
+}
+
+const char *ThermalWatcher::toString(State state) {
+    switch (state) {
+        case State::NORMAL:
+            return "normal";
+        case State::HOT:
+            return "hot";
+        case State::COLD:
+            return "cold";
+    }
+    return "unknown";
+}
+
+void ThermalWatcher::sample() {
+    ATRACE_NAME("ThermalWatcher::sample");
+    int32_t temperature;
+
+    if (!mReader(&temperature)) {
+        return;
+    }
+
+    mTemperature.store(temperature, std::memory_order_relaxed);
+    if (temperature > mUpperBound) {
+        mState.store(State::HOT, std::memory_order_relaxed);
+    } else if (temperature < mLowerBound) {
+        mState.store(State::COLD, std::memory_order_relaxed);
+    } else {
+        mState.store(State::NORMAL, std::memory_order_relaxed);
+    }
+}
+
+void ThermalWatcher::loop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while (!mExit) {
+        mCv.wait_for(lock, mPeriod, [&] { return mExit || mRequested != mCompleted; });
+        if (mExit) {
+            break;
+        }
+
+        auto requested = mRequested;
+        lock.unlock();
+        sample();
+        lock.lock();
+
+        mCompleted = requested;
+        mCv.notify_all();
+    }
+}
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+// Samples a temperature on a dedicated thread and publishes which side of a
+// pair of bounds it last fell on, so that latency-sensitive callers never read
+// the thermal zone themselves.
+class ThermalWatcher {
+  public:
+    using Reader = std::function<bool(int32_t *value)>;
+
+    enum class State : uint8_t {
+        NORMAL,  // within the bounds
+        HOT,     // above the upper bound
+        COLD,    // below the lower bound
+    };
+
+  public:
+    // The first sample is taken before returning; later ones are taken every
+    // period on the watcher thread. Failed reads keep the previous sample.
+    ThermalWatcher(Reader reader, int32_t lowerBound, int32_t upperBound,
+                   std::chrono::milliseconds period);
+    ~ThermalWatcher();
+
+    State state() const { return mState.load(std::memory_order_relaxed); }
+    int32_t temperature() const { return mTemperature.load(std::memory_order_relaxed); }
+    // Samples right away rather than at the next period, e.g. on a thermal
+    // trip notification, and waits for the result to be published.
+    void refresh();
+
+    static const char *toString(State state);
+
+  private:
+    void sample();
+    void loop();
+
+  private:
+    const Reader mReader;
+    const int32_t mLowerBound;
+    const int32_t mUpperBound;
+    const std::chrono::milliseconds mPeriod;
+    std::atomic<State> mState{State::NORMAL};
+    std::atomic<int32_t> mTemperature{0};
+    std::mutex mMutex;
+    std::condition_variable mCv;
+    uint64_t mRequested{0};
+    uint64_t mCompleted{0};
+    bool mExit{false};
+    std::thread mThread;
+};
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -16,259 +16,271 @@
 
 #include "benchmark/benchmark.h"
 
-#include <android/hardware/vibrator/1.3/IVibrator.h>
-
-using ::android::sp;
-using ::android::hardware::hidl_enum_range;
-using ::android::hardware::Return;
-using ::android::hardware::details::hidl_enum_values;
-using ::benchmark::Counter;
+#include <aidl/android/hardware/vibrator/IVibrator.h>
+#include <android/binder_manager.h>
+#include <android/binder_process.h>
+
+#include <map>
+#include <mutex>
+
+#include "Hardware.h"
+#include "LatencyHistogram.h"
+#include "SysfsSimulator.h"
+#include "Vibrator.h"
+
+using ::aidl::android::hardware::vibrator::Effect;
+using ::aidl::android::hardware::vibrator::EffectStrength;
+using ::aidl::android::hardware::vibrator::HwApi;
+using ::aidl::android::hardware::vibrator::HwCal;
+using ::aidl::android::hardware::vibrator::IVibrator;
+using ::aidl::android::hardware::vibrator::LatencyHistogram;
+using ::aidl::android::hardware::vibrator::ScopedLatency;
+using ::aidl::android::hardware::vibrator::SysfsSimulator;
+using ::aidl::android::hardware::vibrator::Vibrator;
 using ::benchmark::Fixture;
 using ::benchmark::kMicrosecond;
 using ::benchmark::State;
 using ::benchmark::internal::Benchmark;
-using ::std::chrono::duration;
-using ::std::chrono::duration_cast;
-using ::std::chrono::high_resolution_clock;
-
-namespace V1_0 = ::android::hardware::vibrator::V1_0;
-namespace V1_1 = ::android::hardware::vibrator::V1_1;
-namespace V1_2 = ::android::hardware::vibrator::V1_2;
-namespace V1_3 = ::android::hardware::vibrator::V1_3;
 
-template <typename I>
-class VibratorBench : public Fixture {
-  public:
-    void SetUp(State & /*state*/) override { mVibrator = I::getService(); }
+// BINDER goes through the running service. IN_PROCESS calls the same
+// implementation directly, over a simulated device so as not to disturb the
+// service, which tells the cost of the HAL apart from that of binder.
+enum Transport : long {
+    BINDER,
+    IN_PROCESS,
+};
 
-    void TearDown(State & /*state*/) override {
-        if (!mVibrator) {
-            return;
-        }
-        mVibrator->off();
-    }
+static constexpr const char *FILE_NAMES[]{
+        "device/autocal",
+        "device/ol_lra_period",
+        "activate",
+        "duration",
+        "state",
+        "device/rtp_input",
+        "device/mode",
+        "device/set_sequencer",
+        "device/scale",
+        "device/ctrl_loop",
+        "device/lp_trigger_effect",
+        "device/lra_wave_shape",
+        "device/od_clamp",
+};
 
-    static void DefaultConfig(Benchmark *b) { b->Unit(kMicrosecond); }
+// Every benchmark shares one vibrator per transport, as clients share the
+// service. Returns nullptr if the transport is unavailable.
+static std::shared_ptr<IVibrator> getVibrator(Transport transport) {
+    static std::mutex mutex;
+    static std::map<Transport, std::shared_ptr<IVibrator>> vibrators;
+    static std::unique_ptr<SysfsSimulator> simulator;
+    std::lock_guard<std::mutex> lock(mutex);
 
-    static void DefaultArgs(Benchmark * /*b*/) {
-        // none
+    if (auto vibrator = vibrators.find(transport); vibrator != vibrators.end()) {
+        return vibrator->second;
     }
 
-  protected:
-    auto getOtherArg(const State &state, std::size_t index) const {
-        return state.range(index + 0);
-    }
+    auto &vibrator = vibrators[transport];
 
-  protected:
-    sp<I> mVibrator;
-};
+    if (transport == BINDER) {
+        const std::string instance = std::string() + IVibrator::descriptor + "/default";
+        if (AServiceManager_isDeclared(instance.c_str())) {
+            ABinderProcess_startThreadPool();
+            vibrator = IVibrator::fromBinder(
+                    ndk::SpAIBinder(AServiceManager_waitForService(instance.c_str())));
+        }
+    } else {
+        std::map<std::string, std::string> attributes;
 
-enum class EmptyEnum : uint32_t;
-template <>
-inline constexpr std::array<EmptyEnum, 0> hidl_enum_values<EmptyEnum> = {};
+        for (auto n : FILE_NAMES) {
+            attributes[n] = "";
+        }
+        attributes["activate"] = "0";
 
-template <typename T, typename U>
-std::set<T> difference(const hidl_enum_range<T> &t, const hidl_enum_range<U> &u) {
-    class Compare {
-      public:
-        bool operator()(const T &a, const U &b) { return a < static_cast<T>(b); }
-        bool operator()(const U &a, const T &b) { return static_cast<T>(a) < b; }
-    };
-    std::set<T> ret;
+        simulator = std::make_unique<SysfsSimulator>(attributes);
+        simulator->modelActivate();
+        setenv("HWAPI_PATH_PREFIX", simulator->prefix().c_str(), true);
 
-    std::set_difference(t.begin(), t.end(), u.begin(), u.end(),
-                        std::insert_iterator<decltype(ret)>(ret, ret.begin()), Compare());
+        auto local =
+                ndk::SharedRefBase::make<Vibrator>(HwApi::Create(), std::make_unique<HwCal>());
+        local->waitReady();
+        vibrator = local;
+    }
 
-    return ret;
+    return vibrator;
 }
 
-template <typename I, typename E1, typename E2 = EmptyEnum>
-class VibratorEffectsBench : public VibratorBench<I> {
-  public:
-    using Effect = E1;
-    using EffectStrength = V1_0::EffectStrength;
-    using Status = V1_0::Status;
-
+// Reports latency percentiles alongside the mean that the framework reports,
+// and throughput as items per second. Benchmarks may run on several threads,
+// which share the fixture and so the histogram.
+class VibratorBench : public Fixture {
   public:
-    static void DefaultArgs(Benchmark *b) {
-        b->ArgNames({"Effect", "Strength"});
-        for (const auto &effect : difference(hidl_enum_range<E1>(), hidl_enum_range<E2>())) {
-            for (const auto &strength : hidl_enum_range<EffectStrength>()) {
-                b->Args({static_cast<long>(effect), static_cast<long>(strength)});
-            }
+    void SetUp(State &state) override {
+        if (state.thread_index() == 0) {
+            mLatency.reset();
         }
     }
 
-    void performBench(State *state, Return<void> (I::*performApi)(Effect, EffectStrength,
-                                                                  typename I::perform_cb)) {
-        auto effect = getEffect(*state);
-        auto strength = getStrength(*state);
-        bool supported = true;
+    void TearDown(State &state) override {
+        auto vibrator = getVibrator(getTransport(state));
 
-        (*this->mVibrator.*performApi)(effect, strength, [&](Status status, uint32_t /*lengthMs*/) {
-            if (status == Status::UNSUPPORTED_OPERATION) {
-                supported = false;
-            }
-        });
-
-        if (!supported) {
+        state.SetItemsProcessed(state.iterations());
+        if (state.thread_index() != 0 || !vibrator) {
             return;
         }
 
-        for (auto _ : *state) {
-            state->ResumeTiming();
-            (*this->mVibrator.*performApi)(effect, strength,
-                                           [](Status /*status*/, uint32_t /*lengthMs*/) {});
-            state->PauseTiming();
-            this->mVibrator->off();
-        }
+        vibrator->off();
+        state.counters["p50Us"] = mLatency.percentileNs(0.50) / 1000.0;
+        state.counters["p99Us"] = mLatency.percentileNs(0.99) / 1000.0;
+        state.counters["p999Us"] = mLatency.percentileNs(0.999) / 1000.0;
+        state.counters["maxUs"] = mLatency.maxNs() / 1000.0;
     }
 
-  protected:
-    auto getEffect(const State &state) const {
-        return static_cast<Effect>(this->getOtherArg(state, 0));
-    }
+    static void DefaultConfig(Benchmark *b) { b->Unit(kMicrosecond); }
 
-    auto getStrength(const State &state) const {
-        return static_cast<EffectStrength>(this->getOtherArg(state, 1));
+    static void DefaultArgs(Benchmark *b) {
+        b->ArgNames({"Transport"});
+        b->Args({BINDER});
+        b->Args({IN_PROCESS});
     }
-};
-
-#define BENCHMARK_WRAPPER(fixt, test, code) \
-    BENCHMARK_DEFINE_F(fixt, test)          \
-    /* NOLINTNEXTLINE */                    \
-    (State & state) {                       \
-        if (!mVibrator) {                   \
-            return;                         \
-        }                                   \
-                                            \
-        code                                \
-    }                                       \
-    BENCHMARK_REGISTER_F(fixt, test)->Apply(fixt::DefaultConfig)->Apply(fixt::DefaultArgs)
-
-using VibratorBench_V1_0 = VibratorBench<V1_0::IVibrator>;
 
-BENCHMARK_WRAPPER(VibratorBench_V1_0, on, {
-    uint32_t ms = UINT32_MAX;
-
-    for (auto _ : state) {
-        state.ResumeTiming();
-        mVibrator->on(ms);
-        state.PauseTiming();
-        mVibrator->off();
+  protected:
+    Transport getTransport(const State &state) const {
+        return static_cast<Transport>(state.range(0));
     }
-});
 
-BENCHMARK_WRAPPER(VibratorBench_V1_0, off, {
-    uint32_t ms = UINT32_MAX;
-
-    for (auto _ : state) {
-        state.PauseTiming();
-        mVibrator->on(ms);
-        state.ResumeTiming();
-        mVibrator->off();
+    auto getOtherArg(const State &state, std::size_t index) const {
+        return state.range(index + 1);
     }
-});
 
-BENCHMARK_WRAPPER(VibratorBench_V1_0, supportsAmplitudeControl, {
-    for (auto _ : state) {
-        mVibrator->supportsAmplitudeControl();
+    // Calls into the HAL, recording the latency of the call.
+    template <typename F>
+    auto timed(F call) {
+        ScopedLatency latency(&mLatency);
+        return call();
     }
-});
 
-BENCHMARK_WRAPPER(VibratorBench_V1_0, setAmplitude, {
-    uint8_t amplitude = UINT8_MAX;
+  protected:
+    LatencyHistogram mLatency;
+};
 
-    if (!mVibrator->supportsAmplitudeControl()) {
-        return;
+class VibratorEffectsBench : public VibratorBench {
+  public:
+    static void DefaultArgs(Benchmark *b) {
+        b->ArgNames({"Transport", "Effect", "Strength"});
+        for (const auto &transport : {BINDER, IN_PROCESS}) {
+            for (const auto &effect : ndk::enum_range<Effect>()) {
+                for (const auto &strength : ndk::enum_range<EffectStrength>()) {
+                    b->Args({transport, static_cast<long>(effect), static_cast<long>(strength)});
+                }
+            }
+        }
     }
 
-    mVibrator->on(UINT32_MAX);
-
-    for (auto _ : state) {
-        mVibrator->setAmplitude(amplitude);
+  protected:
+    auto getEffect(const State &state) const {
+        return static_cast<Effect>(getOtherArg(state, 0));
     }
 
-    mVibrator->off();
-});
-
-using VibratorEffectsBench_V1_0 = VibratorEffectsBench<V1_0::IVibrator, V1_0::Effect>;
-
-BENCHMARK_WRAPPER(VibratorEffectsBench_V1_0, perform,
-                  { performBench(&state, &V1_0::IVibrator::perform); });
-
-using VibratorEffectsBench_V1_1 =
-    VibratorEffectsBench<V1_1::IVibrator, V1_1::Effect_1_1, V1_0::Effect>;
-
-BENCHMARK_WRAPPER(VibratorEffectsBench_V1_1, perform_1_1,
-                  { performBench(&state, &V1_1::IVibrator::perform_1_1); });
-
-using VibratorEffectsBench_V1_2 =
-    VibratorEffectsBench<V1_2::IVibrator, V1_2::Effect, V1_1::Effect_1_1>;
-
-BENCHMARK_WRAPPER(VibratorEffectsBench_V1_2, perform_1_2,
-                  { performBench(&state, &V1_2::IVibrator::perform_1_2); });
-
-using VibratorBench_V1_3 = VibratorBench<V1_3::IVibrator>;
+    auto getStrength(const State &state) const {
+        return static_cast<EffectStrength>(getOtherArg(state, 1));
+    }
+};
 
-BENCHMARK_WRAPPER(VibratorBench_V1_3, supportsExternalControl, {
-    for (auto _ : state) {
-        mVibrator->supportsExternalControl();
+class VibratorConcurrentBench : public VibratorBench {
+  public:
+    static void DefaultConfig(Benchmark *b) {
+        VibratorBench::DefaultConfig(b);
+        b->ThreadRange(1, 8);
+        b->UseRealTime();
     }
-});
+};
 
-BENCHMARK_WRAPPER(VibratorBench_V1_3, setExternalControl, {
-    bool enable = true;
+#define BENCHMARK_WRAPPER(fixt, test, code)                        \
+    BENCHMARK_DEFINE_F(fixt, test)                                 \
+    /* NOLINTNEXTLINE */                                           \
+    (State & state) {                                              \
+        auto vibrator = getVibrator(getTransport(state));          \
+                                                                   \
+        if (!vibrator) {                                           \
+            state.SkipWithError("vibrator service not available"); \
+            return;                                                \
+        }                                                          \
+                                                                   \
+        code                                                       \
+    }                                                              \
+    BENCHMARK_REGISTER_F(fixt, test)->Apply(fixt::DefaultConfig)->Apply(fixt::DefaultArgs)
+
+BENCHMARK_WRAPPER(VibratorEffectsBench, perform, {
+    auto effect = getEffect(state);
+    auto strength = getStrength(state);
+    int32_t lengthMs;
 
-    if (!mVibrator->supportsExternalControl()) {
+    if (vibrator->perform(effect, strength, nullptr, &lengthMs).getExceptionCode() ==
+        EX_UNSUPPORTED_OPERATION) {
+        state.SkipWithError("effect not supported");
         return;
     }
 
     for (auto _ : state) {
-        state.ResumeTiming();
-        mVibrator->setExternalControl(enable);
+        timed([&] { return vibrator->perform(effect, strength, nullptr, &lengthMs); });
         state.PauseTiming();
-        mVibrator->setExternalControl(false);
+        vibrator->off();
+        state.ResumeTiming();
     }
 });
 
-BENCHMARK_WRAPPER(VibratorBench_V1_3, supportsExternalAmplitudeControl, {
-    if (!mVibrator->supportsExternalControl()) {
-        return;
-    }
-
-    mVibrator->setExternalControl(true);
-
+// A full on/off cycle per iteration, with both calls recorded.
+BENCHMARK_WRAPPER(VibratorBench, onOff, {
     for (auto _ : state) {
-        mVibrator->supportsAmplitudeControl();
+        timed([&] { return vibrator->on(INT32_MAX, nullptr); });
+        timed([&] { return vibrator->off(); });
     }
-
-    mVibrator->setExternalControl(false);
 });
 
-BENCHMARK_WRAPPER(VibratorBench_V1_3, setExternalAmplitude, {
-    uint8_t amplitude = UINT8_MAX;
+// Back-to-back amplitude changes over one long vibration, as streamed by
+// haptic feedback for audio.
+BENCHMARK_WRAPPER(VibratorBench, setAmplitude_storm, {
+    int32_t capabilities = 0;
+    uint32_t step = 0;
 
-    if (!mVibrator->supportsExternalControl()) {
+    vibrator->getCapabilities(&capabilities);
+    if (!(capabilities & IVibrator::CAP_AMPLITUDE_CONTROL)) {
+        state.SkipWithError("amplitude control not supported");
         return;
     }
 
-    mVibrator->setExternalControl(true);
-
-    if (!mVibrator->supportsAmplitudeControl()) {
-        return;
-    }
+    vibrator->on(INT32_MAX, nullptr);
 
     for (auto _ : state) {
-        mVibrator->setAmplitude(amplitude);
+        float amplitude = (step++ % UINT8_MAX + 1) / static_cast<float>(UINT8_MAX);
+        timed([&] { return vibrator->setAmplitude(amplitude); });
     }
-
-    mVibrator->setExternalControl(false);
 });
 
-using VibratorEffectsBench_V1_3 = VibratorEffectsBench<V1_3::IVibrator, V1_3::Effect, V1_2::Effect>;
+// Several clients calling at once, each cycling through the calls that
+// contend in the HAL: effects, steady vibrations and amplitude changes.
+BENCHMARK_WRAPPER(VibratorConcurrentBench, mixed, {
+    uint32_t step = state.thread_index();
+    int32_t lengthMs;
 
-BENCHMARK_WRAPPER(VibratorEffectsBench_V1_3, perform_1_3,
-                  { performBench(&state, &V1_3::IVibrator::perform_1_3); });
+    for (auto _ : state) {
+        switch (step++ % 4) {
+            case 0:
+                timed([&] {
+                    return vibrator->perform(Effect::CLICK, EffectStrength::MEDIUM, nullptr,
+                                             &lengthMs);
+                });
+                break;
+            case 1:
+                timed([&] { return vibrator->on(INT32_MAX, nullptr); });
+                break;
+            case 2:
+                timed([&] { return vibrator->setAmplitude(0.5f); });
+                break;
+            case 3:
+                timed([&] { return vibrator->off(); });
+                break;
+        }
+    }
+});
 
 BENCHMARK_MAIN();
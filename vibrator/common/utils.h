@@ -20,6 +20,8 @@
 #include <sstream>
 
 #include <android-base/macros.h>
+#include <android-base/parsebool.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <log/log.h>
 
@@ -98,6 +100,32 @@ inline bool getProperty<bool>(const std::string &key, const bool def) {
     return ::android::base::GetBoolProperty(key, def);
 }
 
+// Parses a property value the way getProperty() does, for values that were
+// already fetched, e.g. with property_list().
+template <typename T>
+inline Enable_If_Signed<T, T> parseProperty(const std::string &value, const T def) {
+    T result;
+    return ::android::base::ParseInt(value, &result) ? result : def;
+}
+
+template <typename T>
+inline Enable_If_Unsigned<T, T> parseProperty(const std::string &value, const T def) {
+    T result;
+    return ::android::base::ParseUint(value, &result) ? result : def;
+}
+
+template <>
+inline bool parseProperty<bool>(const std::string &value, const bool def) {
+    switch (::android::base::ParseBool(value)) {
+        case ::android::base::ParseBoolResult::kTrue:
+            return true;
+        case ::android::base::ParseBoolResult::kFalse:
+            return false;
+        default:
+            return def;
+    }
+}
+
 template <typename T>
 static void openNoCreate(const std::string &file, T *outStream) {
     auto mode = std::is_base_of_v<std::ostream, T> ? std::ios_base::out : std::ios_base::in;
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+// Maps target acceleration to the drv2624 over-drive clamp for one LRA, using
+// the calibrated G-vs-voltage curve.
+class HapticCalibration {
+  public:
+    // Coefficients are {a, b, c, d} of f(x) = ax^3 + bx^2 + cx + d, or {a, b}
+    // of f(x) = ax + b when c and d are zero.
+    HapticCalibration(const std::array<float, 4> &coeffs, uint32_t lraPeriod);
+
+    // Converts between the lra_period register and frequency in Hz.
+    static uint32_t freqPeriodFormula(uint32_t in);
+    // Same conversions as freqPeriodFormula(), without truncating the frequency.
+    static float periodToFrequency(uint32_t lraPeriod);
+    static uint32_t frequencyToPeriod(float frequencyHz);
+
+    // Solves the curve for one target G.
+    uint32_t solveOdClamp(float targetG) const;
+
+  private:
+    uint32_t convertLevelsToOdClamp(float voltageLevel) const;
+
+  private:
+    std::array<float, 4> mCoeffs;
+    double mVoltsPerOdClamp;
+};
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
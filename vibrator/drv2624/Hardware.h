@@ -24,6 +24,10 @@ namespace hardware {
 namespace vibrator {
 
 class HwApi : public Vibrator::HwApi, private HwApiBase {
+  private:
+    static constexpr char RTP_MODE[] = "rtp";
+    static constexpr char WAVEFORM_MODE[] = "waveform";
+
   public:
     static std::unique_ptr<HwApi> Create() {
         auto hwapi = std::unique_ptr<HwApi>(new HwApi());
@@ -35,31 +39,13 @@ class HwApi : public Vibrator::HwApi, private HwApiBase {
         return hwapi;
     }
 
-    bool setAutocal(std::string value) override { return set(value, &mAutocal); }
-    bool setOlLraPeriod(uint32_t value) override { return set(value, &mOlLraPeriod); }
-    bool setActivate(bool value) override { return set(value, &mActivate); }
-    bool setDuration(uint32_t value) override { return set(value, &mDuration); }
-    bool setState(bool value) override { return set(value, &mState); }
-    bool hasRtpInput() override { return has(mRtpInput); }
-    bool setRtpInput(int8_t value) override { return set(value, &mRtpInput); }
-    bool setMode(std::string value) override { return set(value, &mMode); }
-    bool setSequencer(std::string value) override { return set(value, &mSequencer); }
-    bool setScale(uint8_t value) override { return set(value, &mScale); }
-    bool setCtrlLoop(bool value) override { return set(value, &mCtrlLoop); }
-    bool setLpTriggerEffect(uint32_t value) override { return set(value, &mLpTrigger); }
-    bool setLraWaveShape(uint32_t value) override { return set(value, &mLraWaveShape); }
-    bool setOdClamp(uint32_t value) override { return set(value, &mOdClamp); }
-    bool getUsbTemp(int32_t *value) override { return get(value, &mUsbTemp); }
-    void debug(int fd) override { HwApiBase::debug(fd); }
-
-  private:
-    HwApi() {
+    // Only the streams required by Create() are opened up front.
+    void openDeferred() override {
         open("device/autocal", &mAutocal);
         open("device/ol_lra_period", &mOlLraPeriod);
-        open("activate", &mActivate);
-        open("duration", &mDuration);
-        open("state", &mState);
+        openRaw("device/ol_lra_period", &mOlLraPeriodFd);
         open("device/rtp_input", &mRtpInput);
+        openRaw("device/rtp_input", &mRtpInputFd);
         open("device/mode", &mMode);
         open("device/set_sequencer", &mSequencer);
         open("device/scale", &mScale);
@@ -71,18 +57,92 @@ class HwApi : public Vibrator::HwApi, private HwApiBase {
         openFull("/sys/devices/virtual/thermal/tz-by-name/usbc-therm-monitor/temp", &mUsbTemp);
     }
 
+    // Writes to set_sequencer, scale, ctrl_loop, mode, lra_wave_shape, od_clamp
+    // and ol_lra_period are elided when unchanged, since each one is an I2C
+    // transaction. The cache is dropped whenever the driver may have
+    // reprogrammed the registers itself.
+    bool setAutocal(std::string value) override {
+        auto ret = set(value, &mAutocal);
+        invalidate();
+        return ret;
+    }
+    bool setOlLraPeriod(uint32_t value) override {
+        // a streamed value bypassed the cache, which no longer reflects the register
+        if (mOlLraPeriodStreamed.exchange(false)) {
+            invalidate(&mOlLraPeriod);
+        }
+        return setCached(value, &mOlLraPeriod);
+    }
+    bool streamOlLraPeriod(uint32_t value) override {
+        mOlLraPeriodStreamed = true;
+        return setRaw(value, mOlLraPeriodFd);
+    }
+    bool setActivate(bool value) override { return set(value, &mActivate); }
+    bool pollActivate(bool value, int32_t timeoutMs, int wakeFd = -1) override {
+        return poll(value, &mActivate, timeoutMs, wakeFd);
+    }
+    bool setDuration(uint32_t value) override { return set(value, &mDuration); }
+    bool setState(bool value) override {
+        auto ret = set(value, &mState);
+        invalidate();
+        // the LP trigger selection is not guaranteed to survive the device
+        // being re-enabled, and losing it silently disables always-on effects
+        if (ret && value && mLpTriggerEffect != 0) {
+            set(mLpTriggerEffect, &mLpTrigger);
+        }
+        return ret;
+    }
+    bool hasRtpInput() override { return has(mRtpInput); }
+    bool setRtpInput(int8_t value) override { return set(value, &mRtpInput); }
+    bool streamRtpInput(int8_t value) override { return setRaw(value, mRtpInputFd); }
+    bool setMode(std::string value) override {
+        if (value != RTP_MODE && value != WAVEFORM_MODE) {
+            // diagnostic and calibration routines clobber the device registers
+            auto ret = set(value, &mMode);
+            invalidate();
+            return ret;
+        }
+        return setCached(value, &mMode);
+    }
+    bool setSequencer(std::string value) override { return setCached(value, &mSequencer); }
+    bool setScale(uint8_t value) override { return setCached(value, &mScale); }
+    bool setCtrlLoop(bool value) override { return setCached(value, &mCtrlLoop); }
+    bool setLpTriggerEffect(uint32_t value) override {
+        if (!set(value, &mLpTrigger)) {
+            return false;
+        }
+        mLpTriggerEffect = value;
+        return true;
+    }
+    bool setLraWaveShape(uint32_t value) override { return setCached(value, &mLraWaveShape); }
+    bool setOdClamp(uint32_t value) override { return setCached(value, &mOdClamp); }
+    bool getUsbTemp(int32_t *value) override { return get(value, &mUsbTemp); }
+    void debug(int fd) override { HwApiBase::debug(fd); }
+    void resetLatencies() override { HwApiBase::resetLatencies(); }
+
+  private:
+    HwApi() {
+        open("activate", &mActivate);
+        open("duration", &mDuration);
+        open("state", &mState);
+    }
+
   private:
     std::ofstream mAutocal;
     std::ofstream mOlLraPeriod;
+    unique_fd mOlLraPeriodFd;
+    std::atomic<bool> mOlLraPeriodStreamed{false};
     std::ofstream mActivate;
     std::ofstream mDuration;
     std::ofstream mState;
     std::ofstream mRtpInput;
+    unique_fd mRtpInputFd;
     std::ofstream mMode;
     std::ofstream mSequencer;
     std::ofstream mScale;
     std::ofstream mCtrlLoop;
     std::ofstream mLpTrigger;
+    uint32_t mLpTriggerEffect{0};
     std::ofstream mLraWaveShape;
     std::ofstream mOdClamp;
     std::ifstream mUsbTemp;
@@ -106,28 +166,24 @@ class HwCal : public Vibrator::HwCal, private HwCalBase {
     static constexpr uint32_t DEFAULT_LP_TRIGGER_SUPPORT = 1;
 
   public:
-    HwCal() {}
+    HwCal()
+        : mAutocal(parsePersist<std::string>(AUTOCAL_CONFIG)),
+          mLraPeriod(parsePersist<uint32_t>(LRA_PERIOD_CONFIG)),
+          mEffectCoeffs(parsePersist<std::array<float, 4>>(EFFECT_COEFF_CONFIG)),
+          mSteadyAmpMax(parsePersist<float>(STEADY_AMP_MAX_CONFIG)) {}
 
-    bool getAutocal(std::string *value) override { return getPersist(AUTOCAL_CONFIG, value); }
+    bool getAutocal(std::string *value) override { return getPersist(mAutocal, value); }
     bool getLraPeriod(uint32_t *value) override {
-        if (getPersist(LRA_PERIOD_CONFIG, value)) {
+        if (getPersist(mLraPeriod, value)) {
             return true;
         }
         *value = DEFAULT_LRA_PERIOD;
         return true;
     }
     bool getEffectCoeffs(std::array<float, 4> *value) override {
-        if (getPersist(EFFECT_COEFF_CONFIG, value)) {
-            return true;
-        }
-        return false;
-    }
-    bool getSteadyAmpMax(float *value) override {
-        if (getPersist(STEADY_AMP_MAX_CONFIG, value)) {
-            return true;
-        }
-        return false;
+        return getPersist(mEffectCoeffs, value);
     }
+    bool getSteadyAmpMax(float *value) override { return getPersist(mSteadyAmpMax, value); }
     bool getCloseLoopThreshold(uint32_t *value) override {
         return getProperty("closeloop.threshold", value, UINT32_MAX);
         return true;
@@ -167,6 +223,23 @@ class HwCal : public Vibrator::HwCal, private HwCalBase {
         return getProperty("lptrigger", value, DEFAULT_LP_TRIGGER_SUPPORT);
     }
     void debug(int fd) override { HwCalBase::debug(fd); }
+
+  private:
+    template <typename T>
+    static bool getPersist(const std::optional<T> &persist, T *value) {
+        if (!persist) {
+            return false;
+        }
+        *value = *persist;
+        return true;
+    }
+
+  private:
+    // parsed once from the calibration file at construction
+    const std::optional<std::string> mAutocal;
+    const std::optional<uint32_t> mLraPeriod;
+    const std::optional<std::array<float, 4>> mEffectCoeffs;
+    const std::optional<float> mSteadyAmpMax;
 };
 
 }  // namespace vibrator
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PwlePlanner.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "HapticCalibration.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+PwlePlanner::PwlePlanner(uint32_t lraPeriod)
+    : mResonantFrequency(HapticCalibration::periodToFrequency(lraPeriod)),
+      mFrequencyMinimum(std::max(mResonantFrequency - BANDWIDTH_HZ / 2, FREQUENCY_RESOLUTION_HZ)),
+      mFrequencyMaximum(mFrequencyMinimum + BANDWIDTH_HZ),
+      mResonantPeriod(lraPeriod) {}
+
+std::vector<float> PwlePlanner::bandwidthAmplitudeMap() const {
+    size_t size = std::lround(BANDWIDTH_HZ / FREQUENCY_RESOLUTION_HZ) + 1;
+    return std::vector<float>(size, 1.0f);
+}
+
+bool PwlePlanner::plan(const std::vector<PrimitivePwle> &composite,
+                       std::vector<Segment> *outSegments, uint32_t *outDurationMs) const {
+    uint32_t timeMs = 0;
+
+    if (composite.empty() || composite.size() > COMPOSITION_SIZE_MAX) {
+        return false;
+    }
+
+    outSegments->clear();
+
+    for (const auto &primitive : composite) {
+        switch (primitive.getTag()) {
+            case PrimitivePwle::active: {
+                const auto &active = primitive.get<PrimitivePwle::active>();
+                if (!planActive(active, timeMs, outSegments)) {
+                    return false;
+                }
+                timeMs += active.duration;
+                break;
+            }
+            case PrimitivePwle::braking: {
+                const auto &braking = primitive.get<PrimitivePwle::braking>();
+                if (braking.braking != Braking::NONE || braking.duration < 0 ||
+                    braking.duration > PRIMITIVE_DURATION_MAX_MS) {
+                    return false;
+                }
+                if (braking.duration > 0) {
+                    append({timeMs, 0.0f, mResonantPeriod}, outSegments);
+                }
+                timeMs += braking.duration;
+                break;
+            }
+        }
+    }
+
+    if (outSegments->empty()) {
+        return false;
+    }
+
+    *outDurationMs = timeMs;
+    return true;
+}
+
+bool PwlePlanner::planActive(const ActivePwle &active, uint32_t startMs,
+                             std::vector<Segment> *outSegments) const {
+    auto inBand = [this](float frequency) {
+        return frequency >= mFrequencyMinimum && frequency <= mFrequencyMaximum;
+    };
+
+    if (!(active.startAmplitude >= 0.0f && active.startAmplitude <= 1.0f) ||
+        !(active.endAmplitude >= 0.0f && active.endAmplitude <= 1.0f) ||
+        !inBand(active.startFrequency) || !inBand(active.endFrequency) ||
+        active.duration < 0 || active.duration > PRIMITIVE_DURATION_MAX_MS) {
+        return false;
+    }
+
+    // Each slice holds the values at its midpoint, so that a ramp is centered
+    // on the requested line rather than lagging it by half a slice.
+    for (uint32_t offsetMs = 0; offsetMs < static_cast<uint32_t>(active.duration);
+         offsetMs += SEGMENT_MS) {
+        uint32_t sliceMs = std::min<uint32_t>(SEGMENT_MS, active.duration - offsetMs);
+        float progress = (offsetMs + sliceMs / 2.0f) / active.duration;
+        float amplitude =
+                active.startAmplitude + (active.endAmplitude - active.startAmplitude) * progress;
+        float frequency =
+                active.startFrequency + (active.endFrequency - active.startFrequency) * progress;
+
+        append({startMs + offsetMs, amplitude, HapticCalibration::frequencyToPeriod(frequency)},
+               outSegments);
+    }
+
+    return true;
+}
+
+void PwlePlanner::append(const Segment &segment, std::vector<Segment> *outSegments) {
+    if (!outSegments->empty() && outSegments->back().amplitude == segment.amplitude &&
+        outSegments->back().olLraPeriod == segment.olLraPeriod) {
+        return;
+    }
+    outSegments->push_back(segment);
+}
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
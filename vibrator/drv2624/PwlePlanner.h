@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <aidl/android/hardware/vibrator/BnVibrator.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+// Converts PWLE compositions into a flat list of RTP amplitude and open-loop
+// LRA period updates, sliced finely enough that ramps sound continuous. The
+// LRA is driven open loop, so the drive frequency is whatever ol_lra_period
+// says; the supported band is centered on the calibrated resonance.
+class PwlePlanner {
+  public:
+    static constexpr uint32_t SEGMENT_MS = 5;
+    static constexpr int32_t PRIMITIVE_DURATION_MAX_MS = 1000;
+    static constexpr int32_t COMPOSITION_SIZE_MAX = 127;
+    static constexpr float FREQUENCY_RESOLUTION_HZ = 1.0f;
+    static constexpr float BANDWIDTH_HZ = 100.0f;
+
+    // Register values to apply at an offset from the start of the composition.
+    struct Segment {
+        uint32_t timeMs;
+        float amplitude;
+        uint32_t olLraPeriod;
+    };
+
+  public:
+    explicit PwlePlanner(uint32_t lraPeriod);
+
+    float resonantFrequency() const { return mResonantFrequency; }
+    float frequencyMinimum() const { return mFrequencyMinimum; }
+    float frequencyMaximum() const { return mFrequencyMaximum; }
+    // Maximum amplitude at each FREQUENCY_RESOLUTION_HZ step from the minimum
+    // frequency. No per-frequency calibration exists, so the map is flat.
+    std::vector<float> bandwidthAmplitudeMap() const;
+
+    // Plans the whole composition. Consecutive slices that would write the
+    // same values are merged. Returns false if any primitive is out of range
+    // or requests braking other than Braking::NONE.
+    bool plan(const std::vector<PrimitivePwle> &composite, std::vector<Segment> *outSegments,
+              uint32_t *outDurationMs) const;
+
+  private:
+    bool planActive(const ActivePwle &active, uint32_t startMs,
+                    std::vector<Segment> *outSegments) const;
+    static void append(const Segment &segment, std::vector<Segment> *outSegments);
+
+  private:
+    float mResonantFrequency;
+    float mFrequencyMinimum;
+    float mFrequencyMaximum;
+    uint32_t mResonantPeriod;
+};
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -15,14 +15,18 @@
  */
 
 #include "Vibrator.h"
+#include "HapticCalibration.h"
 #include "utils.h"
 
 #include <cutils/properties.h>
 #include <hardware/hardware.h>
 #include <hardware/vibrator.h>
 #include <log/log.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
 #include <cinttypes>
 #include <cmath>
 #include <fstream>
@@ -51,135 +55,78 @@ static constexpr char WAVEFORM_DOUBLE_CLICK_EFFECT_SEQ[] = "3 0";
 // Use effect #4 in the waveform library for HEAVY_CLICK effect
 static constexpr char WAVEFORM_HEAVY_CLICK_EFFECT_SEQ[] = "4 0";
 
+// Composition primitives reuse the CLICK and TICK waveforms
+static constexpr uint8_t WAVEFORM_CLICK_INDEX = 1;
+static constexpr uint8_t WAVEFORM_TICK_INDEX = 2;
+
+// Always-on effects are played by the SLPI through the single LP trigger, so
+// only effects that map onto a waveform library slot are supported. The
+// library waveform plays at its stored level, whatever the strength.
+static constexpr int32_t ALWAYS_ON_ID = 0;
+static constexpr uint32_t LP_TRIGGER_DISABLED = 0;
+static constexpr uint32_t WAVEFORM_DOUBLE_CLICK_INDEX = 3;
+static constexpr uint32_t WAVEFORM_HEAVY_CLICK_INDEX = 4;
+
+// The sequencer plays up to 8 index-count pairs back to back per activation
+static constexpr size_t SEQUENCER_SLOTS_MAX = 8;
+
+static constexpr int32_t COMPOSE_DELAY_MAX_MS = 10000;
+static constexpr int32_t COMPOSE_SIZE_MAX = 127;
+
+// Amplitude envelopes are resampled at this period before being streamed.
+static constexpr uint32_t AMPLITUDE_STREAM_PERIOD_MS = 5;
+static constexpr size_t AMPLITUDE_ENVELOPE_SIZE_MAX = 256;
+static constexpr uint32_t AMPLITUDE_ENVELOPE_DURATION_MAX_MS = 10000;
+static constexpr int AMPLITUDE_STREAM_PRIORITY = 2;
+
 // UT team design those target G values
 static constexpr std::array<float, 5> EFFECT_TARGET_G = {0.15, 0.15, 0.27, 0.43, 0.57};
 static constexpr std::array<float, 3> STEADY_TARGET_G = {1.2, 1.145, 0.905};
 
-#define FLOAT_EPS 1e-6
-
 // Temperature protection upper bound 10°C and lower bound 5°C
 static constexpr int32_t TEMP_UPPER_BOUND = 10000;
 static constexpr int32_t TEMP_LOWER_BOUND = 5000;
+// The USB-C temperature moves slowly, so it is sampled off the vibration path
+static constexpr uint32_t TEMP_REFRESH_PERIOD_MS = 2000;
+// Extra time allowed for the driver to report the end of a vibration before
+// completion is assumed from the requested duration alone
+static constexpr uint32_t COMPLETION_MARGIN_MS = 20;
+
 // Steady vibration's voltage in lower bound guarantee
 static uint32_t STEADY_VOLTAGE_LOWER_BOUND = 90;  // 1.8 Vpeak
 
-static std::uint32_t freqPeriodFormula(std::uint32_t in) {
-    return 1000000000 / (24615 * in);
-}
-
-static std::uint32_t convertLevelsToOdClamp(float voltageLevel, uint32_t lraPeriod) {
-    float odClamp;
-
-    odClamp = voltageLevel /
-              ((21.32 / 1000.0) *
-               sqrt(1.0 - (static_cast<float>(freqPeriodFormula(lraPeriod)) * 8.0 / 10000.0)));
-
-    return round(odClamp);
+// The scale register attenuates waveform playback in 25% steps, from 0 (100%)
+// to 3 (25%).
+static uint8_t amplitudeToScale(float amplitude) {
+    return std::clamp<long>(std::lround((1.0f - amplitude) * 4.0f), 0, 3);
 }
 
-static float targetGToVlevelsUnderLinearEquation(std::array<float, 4> inputCoeffs, float targetG) {
-    // Implement linear equation to get voltage levels, f(x) = ax + b
-    // 0 to 3.2 is our valid output
-    float outPutVal = 0.0f;
-    outPutVal = (targetG - inputCoeffs[1]) / inputCoeffs[0];
-    if ((outPutVal > FLOAT_EPS) && (outPutVal <= 3.2)) {
-        return outPutVal;
-    } else {
-        return 0.0f;
-    }
-}
-
-static float targetGToVlevelsUnderCubicEquation(std::array<float, 4> inputCoeffs, float targetG) {
-    // Implement cubic equation to get voltage levels, f(x) = ax^3 + bx^2 + cx + d
-    // 0 to 3.2 is our valid output
-    float AA = 0.0f, BB = 0.0f, CC = 0.0f, Delta = 0.0f;
-    float Y1 = 0.0f, Y2 = 0.0f, K = 0.0f, T = 0.0f, sita = 0.0f;
-    float outPutVal = 0.0f;
-    float oneHalf = 1.0 / 2.0, oneThird = 1.0 / 3.0;
-    float cosSita = 0.0f, sinSitaSqrt3 = 0.0f, sqrtA = 0.0f;
-
-    AA = inputCoeffs[1] * inputCoeffs[1] - 3.0 * inputCoeffs[0] * inputCoeffs[2];
-    BB = inputCoeffs[1] * inputCoeffs[2] - 9.0 * inputCoeffs[0] * (inputCoeffs[3] - targetG);
-    CC = inputCoeffs[2] * inputCoeffs[2] - 3.0 * inputCoeffs[1] * (inputCoeffs[3] - targetG);
-
-    Delta = BB * BB - 4.0 * AA * CC;
-
-    // There are four discriminants in Shengjin formula.
-    // https://zh.wikipedia.org/wiki/%E4%B8%89%E6%AC%A1%E6%96%B9%E7%A8%8B#%E7%9B%9B%E9%87%91%E5%85%AC%E5%BC%8F%E6%B3%95
-    if ((fabs(AA) <= FLOAT_EPS) && (fabs(BB) <= FLOAT_EPS)) {
-        // Case 1: A = B = 0
-        outPutVal = -inputCoeffs[1] / (3 * inputCoeffs[0]);
-        if ((outPutVal > FLOAT_EPS) && (outPutVal <= 3.2)) {
-            return outPutVal;
-        }
-        return 0.0f;
-    } else if (Delta > FLOAT_EPS) {
-        // Case 2: Delta > 0
-        Y1 = AA * inputCoeffs[1] + 3.0 * inputCoeffs[0] * (-BB + pow(Delta, oneHalf)) / 2.0;
-        Y2 = AA * inputCoeffs[1] + 3.0 * inputCoeffs[0] * (-BB - pow(Delta, oneHalf)) / 2.0;
-
-        if ((Y1 < -FLOAT_EPS) && (Y2 > FLOAT_EPS)) {
-            return (-inputCoeffs[1] + pow(-Y1, oneThird) - pow(Y2, oneThird)) /
-                   (3.0 * inputCoeffs[0]);
-        } else if ((Y1 > FLOAT_EPS) && (Y2 < -FLOAT_EPS)) {
-            return (-inputCoeffs[1] - pow(Y1, oneThird) + pow(-Y2, oneThird)) /
-                   (3.0 * inputCoeffs[0]);
-        } else if ((Y1 < -FLOAT_EPS) && (Y2 < -FLOAT_EPS)) {
-            return (-inputCoeffs[1] + pow(-Y1, oneThird) + pow(-Y2, oneThird)) /
-                   (3.0 * inputCoeffs[0]);
-        } else {
-            return (-inputCoeffs[1] - pow(Y1, oneThird) - pow(Y2, oneThird)) /
-                   (3.0 * inputCoeffs[0]);
-        }
-        return 0.0f;
-    } else if (Delta < -FLOAT_EPS) {
-        // Case 3: Delta < 0
-        T = (2 * AA * inputCoeffs[1] - 3 * inputCoeffs[0] * BB) / (2 * AA * sqrt(AA));
-        sita = acos(T);
-        cosSita = cos(sita / 3);
-        sinSitaSqrt3 = sqrt(3.0) * sin(sita / 3);
-        sqrtA = sqrt(AA);
-
-        outPutVal = (-inputCoeffs[1] - 2 * sqrtA * cosSita) / (3 * inputCoeffs[0]);
-        if ((outPutVal > FLOAT_EPS) && (outPutVal <= 3.2)) {
-            return outPutVal;
-        }
-        outPutVal = (-inputCoeffs[1] + sqrtA * (cosSita + sinSitaSqrt3)) / (3 * inputCoeffs[0]);
-        if ((outPutVal > FLOAT_EPS) && (outPutVal <= 3.2)) {
-            return outPutVal;
-        }
-        outPutVal = (-inputCoeffs[1] + sqrtA * (cosSita - sinSitaSqrt3)) / (3 * inputCoeffs[0]);
-        if ((outPutVal > FLOAT_EPS) && (outPutVal <= 3.2)) {
-            return outPutVal;
-        }
-        return 0.0f;
-    } else if (Delta <= FLOAT_EPS) {
-        // Case 4: Delta = 0
-        K = BB / AA;
-        outPutVal = (-inputCoeffs[1] / inputCoeffs[0] + K);
-        if ((outPutVal > FLOAT_EPS) && (outPutVal <= 3.2)) {
-            return outPutVal;
-        }
-        outPutVal = (-K / 2);
-        if ((outPutVal > FLOAT_EPS) && (outPutVal <= 3.2)) {
-            return outPutVal;
-        }
-        return 0.0f;
-    } else {
-        // Exception handling
-        return 0.0f;
-    }
+static int8_t amplitudeToRtpInput(float amplitude) {
+    return std::round(amplitude * (MAX_RTP_INPUT - MIN_RTP_INPUT) + MIN_RTP_INPUT);
 }
 
 using utils::toUnderlying;
 
 Vibrator::Vibrator(std::unique_ptr<HwApi> hwapi, std::unique_ptr<HwCal> hwcal)
-    : mHwApi(std::move(hwapi)), mHwCal(std::move(hwcal)) {
+    : mHwApi(std::move(hwapi)),
+      mHwCal(std::move(hwcal)),
+      mCompletionWakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      mAmplitudeScheduler(AMPLITUDE_STREAM_PRIORITY) {
+    mCompletionThread = std::thread(&Vibrator::completionLoop, this);
+    // The service registers as soon as this returns; the rest of the bring-up
+    // happens in the background and API calls wait for it in waitReady().
+    mInitThread = std::thread(&Vibrator::init, this);
+}
+
+void Vibrator::init() {
+    ATRACE_NAME("Vibrator::init");
     std::string autocal;
     uint32_t lraPeriod = 0, lpTrigSupport = 0;
     bool hasEffectCoeffs = false;
     std::array<float, 4> effectCoeffs = {0};
 
+    mHwApi->openDeferred();
+
     if (!mHwApi->setState(true)) {
         ALOGE("Failed to set state (%d): %s", errno, strerror(errno));
     }
@@ -188,6 +135,8 @@ Vibrator::Vibrator(std::unique_ptr<HwApi> hwapi, std::unique_ptr<HwCal> hwcal)
         mHwApi->setAutocal(autocal);
     }
     mHwCal->getLraPeriod(&lraPeriod);
+    mLraPeriod = lraPeriod;
+    mPwlePlanner = std::make_unique<PwlePlanner>(lraPeriod);
 
     mHwCal->getCloseLoopThreshold(&mCloseLoopThreshold);
     mHwCal->getDynamicConfig(&mDynamicConfig);
@@ -205,22 +154,13 @@ Vibrator::Vibrator(std::unique_ptr<HwApi> hwapi, std::unique_ptr<HwCal> hwcal)
         mHwCal->getLongVoltageMax(&longVoltageMax);
 
         hasEffectCoeffs = mHwCal->getEffectCoeffs(&effectCoeffs);
-        for (i = 0; i < 5; i++) {
-            if (hasEffectCoeffs) {
-                // Use linear approach to get the target voltage levels
-                if ((effectCoeffs[2] == 0) && (effectCoeffs[3] == 0)) {
-                    tempVolLevel =
-                        targetGToVlevelsUnderLinearEquation(effectCoeffs, EFFECT_TARGET_G[i]);
-                    mEffectTargetOdClamp[i] = convertLevelsToOdClamp(tempVolLevel, lraPeriod);
-                } else {
-                    // Use cubic approach to get the target voltage levels
-                    tempVolLevel =
-                        targetGToVlevelsUnderCubicEquation(effectCoeffs, EFFECT_TARGET_G[i]);
-                    mEffectTargetOdClamp[i] = convertLevelsToOdClamp(tempVolLevel, lraPeriod);
-                }
-            } else {
-                mEffectTargetOdClamp[i] = shortVoltageMax;
+        if (hasEffectCoeffs) {
+            HapticCalibration calibration(effectCoeffs, lraPeriod);
+            for (i = 0; i < 5; i++) {
+                mEffectTargetOdClamp[i] = calibration.solveOdClamp(EFFECT_TARGET_G[i]);
             }
+        } else {
+            mEffectTargetOdClamp.fill(shortVoltageMax);
         }
         // Add a boundary protection for level 5 only, since
         // some devices might not be able to reach the maximum target G
@@ -253,7 +193,11 @@ Vibrator::Vibrator(std::unique_ptr<HwApi> hwapi, std::unique_ptr<HwCal> hwcal)
         // 2. Get frequency': subtract the frequency shift from the frequency
         // 3. Get final long lra period after put the frequency' to formula
         mSteadyOlLraPeriodShift =
-            freqPeriodFormula(freqPeriodFormula(lraPeriod) - longFreqencyShift);
+            HapticCalibration::freqPeriodFormula(HapticCalibration::freqPeriodFormula(lraPeriod) -
+                                                 longFreqencyShift);
+        mThermalWatcher = std::make_unique<ThermalWatcher>(
+                [this](int32_t *value) { return mHwApi->getUsbTemp(value); }, TEMP_LOWER_BOUND,
+                TEMP_UPPER_BOUND, std::chrono::milliseconds(TEMP_REFRESH_PERIOD_MS));
     } else {
         mHwApi->setOlLraPeriod(lraPeriod);
     }
@@ -263,6 +207,9 @@ Vibrator::Vibrator(std::unique_ptr<HwApi> hwapi, std::unique_ptr<HwCal> hwcal)
     mHwCal->getDoubleClickDuration(&mDoubleClickDuration);
     mHwCal->getHeavyClickDuration(&mHeavyClickDuration);
 
+    compileEffectPrograms();
+    mSteadyProgram = compileProgram(nullptr, RTP_MODE, mSteadyConfig, 0, 0);
+
     // This enables effect #1 from the waveform library to be triggered by SLPI
     // while the AP is in suspend mode
     // For default setting, we will enable this feature if that project did not
@@ -271,40 +218,109 @@ Vibrator::Vibrator(std::unique_ptr<HwApi> hwapi, std::unique_ptr<HwCal> hwcal)
     if (!mHwApi->setLpTriggerEffect(lpTrigSupport)) {
         ALOGW("Failed to set LP trigger mode (%d): %s", errno, strerror(errno));
     }
+    mAlwaysOnSupported = lpTrigSupport != LP_TRIGGER_DISABLED;
+
+    {
+        std::lock_guard<std::mutex> lock(mInitMutex);
+        mReady.store(true, std::memory_order_release);
+    }
+    mInitCv.notify_all();
+}
+
+void Vibrator::waitReady() {
+    if (mReady.load(std::memory_order_acquire)) {
+        return;
+    }
+    ATRACE_NAME("Vibrator::waitReady");
+    std::unique_lock<std::mutex> lock(mInitMutex);
+    mInitCv.wait(lock, [&] { return mReady.load(std::memory_order_acquire); });
+}
+
+Vibrator::~Vibrator() {
+    mInitThread.join();
+    {
+        std::lock_guard<std::mutex> lock(mCompletionMutex);
+        mCompletionExit = true;
+    }
+    mCompletionCv.notify_all();
+    endCompletion();
+    mCompletionThread.join();
 }
 
 ndk::ScopedAStatus Vibrator::getCapabilities(int32_t *_aidl_return) {
     ATRACE_NAME("Vibrator::getCapabilities");
-    int32_t ret = 0;
+    waitReady();
+    int32_t ret = IVibrator::CAP_ON_CALLBACK | IVibrator::CAP_PERFORM_CALLBACK |
+                  IVibrator::CAP_COMPOSE_EFFECTS | IVibrator::CAP_GET_RESONANT_FREQUENCY;
+    if (mAlwaysOnSupported) {
+        ret |= IVibrator::CAP_ALWAYS_ON_CONTROL;
+    }
     if (mHwApi->hasRtpInput()) {
-        ret |= IVibrator::CAP_AMPLITUDE_CONTROL;
+        ret |= IVibrator::CAP_AMPLITUDE_CONTROL | IVibrator::CAP_FREQUENCY_CONTROL |
+               IVibrator::CAP_COMPOSE_PWLE_EFFECTS;
     }
     *_aidl_return = ret;
     return ndk::ScopedAStatus::ok();
 }
 
-ndk::ScopedAStatus Vibrator::on(uint32_t timeoutMs, const char mode[],
-                                const std::unique_ptr<VibrationConfig> &config,
-                                const int8_t volOffset) {
-    LoopControl loopMode = LoopControl::OPEN;
+Vibrator::RegisterProgram Vibrator::compileProgram(const char sequence[], const char mode[],
+                                                   const std::unique_ptr<VibrationConfig> &config,
+                                                   const int8_t volOffset, uint32_t timeMs) {
+    RegisterProgram program{
+        .sequence = sequence != nullptr ? sequence : "",
+        .scale = 0,
+        .mode = mode,
+        .hasConfig = config != nullptr,
+        .timeMs = timeMs,
+    };
 
-    // Open-loop mode is used for short click for over-drive
-    // Close-loop mode is used for long notification for stability
-    if (mode == RTP_MODE && timeoutMs > mCloseLoopThreshold) {
-        loopMode = LoopControl::CLOSE;
+    if (config != nullptr) {
+        program.shape = config->shape;
+        program.odClamp = config->odClamp[volOffset];
+        program.olLraPeriod = config->olLraPeriod;
     }
 
-    mHwApi->setCtrlLoop(toUnderlying(loopMode));
-    if (!mHwApi->setDuration(timeoutMs)) {
-        ALOGE("Failed to set duration (%d): %s", errno, strerror(errno));
+    return program;
+}
+
+bool Vibrator::stage(const RegisterProgram &program, LoopControl loopMode) {
+    bool ok = true;
+
+    if (!program.sequence.empty()) {
+        ok = mHwApi->setSequencer(program.sequence) && ok;
+        ok = mHwApi->setScale(program.scale) && ok;
+    }
+
+    ok = mHwApi->setCtrlLoop(toUnderlying(loopMode)) && ok;
+    ok = mHwApi->setMode(program.mode) && ok;
+    if (program.hasConfig) {
+        ok = mHwApi->setLraWaveShape(toUnderlying(program.shape)) && ok;
+        ok = mHwApi->setOdClamp(program.odClamp) && ok;
+        ok = mHwApi->setOlLraPeriod(program.olLraPeriod) && ok;
+    } else if (mOlLraPeriodOverridden) {
+        ok = mHwApi->setOlLraPeriod(mLraPeriod) && ok;
+    }
+    mOlLraPeriodOverridden = false;
+
+    return ok;
+}
+
+ndk::ScopedAStatus Vibrator::run(const RegisterProgram &program, uint32_t timeoutMs,
+                                 LoopControl loopMode) {
+    // Registers already holding the program's values are not rewritten, so a
+    // staged program only costs the duration and activate writes.
+    bool staged = stage(program, loopMode);
+    // whatever was playing is replaced by this program
+    endCompletion();
+
+    if (!staged) {
+        ALOGE("Failed to stage program (%d): %s", errno, strerror(errno));
         return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
     }
 
-    mHwApi->setMode(mode);
-    if (config != nullptr) {
-        mHwApi->setLraWaveShape(toUnderlying(config->shape));
-        mHwApi->setOdClamp(config->odClamp[volOffset]);
-        mHwApi->setOlLraPeriod(config->olLraPeriod);
+    if (!mHwApi->setDuration(timeoutMs)) {
+        ALOGE("Failed to set duration (%d): %s", errno, strerror(errno));
+        return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
     }
 
     if (!mHwApi->setActivate(1)) {
@@ -318,45 +334,194 @@ ndk::ScopedAStatus Vibrator::on(uint32_t timeoutMs, const char mode[],
 ndk::ScopedAStatus Vibrator::on(int32_t timeoutMs,
                                 const std::shared_ptr<IVibratorCallback> &callback) {
     ATRACE_NAME("Vibrator::on");
-    if (callback) {
-        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    waitReady();
+    ScopedLatency latency(&mOnLatency);
+    LoopControl loopMode = LoopControl::OPEN;
+    ndk::ScopedAStatus status;
+
+    // Open-loop mode is used for short click for over-drive
+    // Close-loop mode is used for long notification for stability
+    if (static_cast<uint32_t>(timeoutMs) > mCloseLoopThreshold) {
+        loopMode = LoopControl::CLOSE;
     }
-    if (mDynamicConfig) {
-        int usbTemp = 0;
-        mHwApi->getUsbTemp(&usbTemp);
-        if (usbTemp > TEMP_UPPER_BOUND) {
-            mSteadyConfig->odClamp = &mSteadyTargetOdClamp;
-            mSteadyConfig->olLraPeriod = mSteadyOlLraPeriod;
-        } else if (usbTemp < TEMP_LOWER_BOUND) {
-            mSteadyConfig->odClamp = &STEADY_VOLTAGE_LOWER_BOUND;
-            mSteadyConfig->olLraPeriod = mSteadyOlLraPeriodShift;
+
+    auto apply = [&] {
+        cancelSteps(&mComposeScheduler);
+        cancelSteps(&mAmplitudeScheduler);
+        mEffectStaged = false;
+
+        if (mThermalWatcher) {
+            // within the bounds, keep whichever tuning was last selected
+            auto thermal = mThermalWatcher->state();
+            if (thermal == ThermalWatcher::State::HOT &&
+                mSteadyConfig->odClamp != &mSteadyTargetOdClamp) {
+                mSteadyConfig->odClamp = &mSteadyTargetOdClamp;
+                mSteadyConfig->olLraPeriod = mSteadyOlLraPeriod;
+                mSteadyProgram = compileProgram(nullptr, RTP_MODE, mSteadyConfig, 0, 0);
+            } else if (thermal == ThermalWatcher::State::COLD &&
+                       mSteadyConfig->odClamp != &STEADY_VOLTAGE_LOWER_BOUND) {
+                mSteadyConfig->odClamp = &STEADY_VOLTAGE_LOWER_BOUND;
+                mSteadyConfig->olLraPeriod = mSteadyOlLraPeriodShift;
+                mSteadyProgram = compileProgram(nullptr, RTP_MODE, mSteadyConfig, 0, 0);
+            }
         }
-    }
 
-    return on(timeoutMs, RTP_MODE, mSteadyConfig, 0);
+        status = run(mSteadyProgram, timeoutMs, loopMode);
+        if (status.isOk() && callback) {
+            armCompletion(callback, timeoutMs);
+        }
+    };
+    // an on() cancelled by an off() before it was applied has completed
+    auto drop = [callback] {
+        if (callback) {
+            callback->onComplete();
+        }
+    };
+
+    mCommands.run(CommandQueue::Kind::ON, apply, drop);
+
+    return status;
 }
 
 ndk::ScopedAStatus Vibrator::off() {
     ATRACE_NAME("Vibrator::off");
-    if (!mHwApi->setActivate(0)) {
-        ALOGE("Failed to turn vibrator off (%d): %s", errno, strerror(errno));
-        return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+    waitReady();
+    ScopedLatency latency(&mOffLatency);
+    ndk::ScopedAStatus status;
+
+    mCommands.run(CommandQueue::Kind::OFF, [&] {
+        cancelSteps(&mComposeScheduler);
+        cancelSteps(&mAmplitudeScheduler);
+        endCompletion();
+        if (!mHwApi->setActivate(0)) {
+            ALOGE("Failed to turn vibrator off (%d): %s", errno, strerror(errno));
+            status = ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+            return;
+        }
+
+        // The end of a vibration is not latency sensitive, while the next
+        // effect is, so restore the configuration of the last effect played if
+        // something else has replaced it.
+        if (!mEffectStaged && mPredictedProgram != nullptr) {
+            // left for the next off() to retry if it fails
+            mEffectStaged = stage(*mPredictedProgram, LoopControl::OPEN);
+        }
+    });
+
+    return status;
+}
+
+ndk::ScopedAStatus Vibrator::prime(Effect effect, EffectStrength strength) {
+    ATRACE_NAME("Vibrator::prime");
+    waitReady();
+    auto program = mEffectPrograms.find({effect, strength});
+
+    if (program == mEffectPrograms.end()) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
     }
-    return ndk::ScopedAStatus::ok();
+
+    ndk::ScopedAStatus status;
+
+    mCommands.run(CommandQueue::Kind::OTHER, [&] {
+        if (!stage(program->second, LoopControl::OPEN)) {
+            ALOGE("Failed to prime effect (%d): %s", errno, strerror(errno));
+            mEffectStaged = false;
+            status = ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+            return;
+        }
+        mPredictedProgram = &program->second;
+        mEffectStaged = true;
+    });
+
+    return status;
 }
 
 ndk::ScopedAStatus Vibrator::setAmplitude(float amplitude) {
     ATRACE_NAME("Vibrator::setAmplitude");
+    waitReady();
+    ScopedLatency latency(&mSetAmplitudeLatency);
     if (amplitude <= 0.0f || amplitude > 1.0f) {
         return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
     }
 
-    int32_t rtp_input = std::round(amplitude * (MAX_RTP_INPUT - MIN_RTP_INPUT) + MIN_RTP_INPUT);
+    ndk::ScopedAStatus status;
+
+    // a newer amplitude queued behind this one makes it moot
+    mCommands.run(CommandQueue::Kind::AMPLITUDE, [&] {
+        cancelSteps(&mAmplitudeScheduler);
 
-    if (!mHwApi->setRtpInput(rtp_input)) {
-        ALOGE("Failed to set amplitude (%d): %s", errno, strerror(errno));
-        return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+        if (!mHwApi->setRtpInput(amplitudeToRtpInput(amplitude))) {
+            ALOGE("Failed to set amplitude (%d): %s", errno, strerror(errno));
+            status = ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+        }
+    });
+
+    return status;
+}
+
+ndk::ScopedAStatus Vibrator::streamAmplitude(const std::vector<AmplitudePoint> &envelope) {
+    ATRACE_NAME("Vibrator::streamAmplitude");
+    waitReady();
+    std::vector<StepScheduler::Step> steps;
+    int32_t lastRtpInput = -1;
+
+    if (envelope.empty() || envelope.size() > AMPLITUDE_ENVELOPE_SIZE_MAX) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
     }
+    for (auto point = envelope.begin(); point != envelope.end(); point++) {
+        if (!(point->amplitude >= 0.0f && point->amplitude <= 1.0f) ||
+            point->timeMs > AMPLITUDE_ENVELOPE_DURATION_MAX_MS ||
+            (point != envelope.begin() && point->timeMs < std::prev(point)->timeMs)) {
+            return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+        }
+    }
+    if (!mHwApi->hasRtpInput()) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+
+    // The envelope is resampled at a fixed cadence here, interpolating
+    // linearly between points, so that the timer thread only writes
+    // precomputed values. Samples that repeat the previous value are dropped.
+    auto point = envelope.begin();
+    uint32_t endMs = envelope.back().timeMs;
+    for (uint32_t timeMs = point->timeMs;; timeMs = std::min(timeMs + AMPLITUDE_STREAM_PERIOD_MS,
+                                                             endMs)) {
+        while (std::next(point) != envelope.end() && std::next(point)->timeMs <= timeMs) {
+            point++;
+        }
+
+        float amplitude = point->amplitude;
+        if (auto next = std::next(point); next != envelope.end()) {
+            amplitude += (next->amplitude - point->amplitude) * (timeMs - point->timeMs) /
+                         (next->timeMs - point->timeMs);
+        }
+
+        int8_t rtpInput = amplitudeToRtpInput(amplitude);
+        if (rtpInput != lastRtpInput) {
+            steps.push_back({
+                    .offset = std::chrono::milliseconds(timeMs),
+                    .action =
+                            [this, rtpInput] {
+                                if (!mHwApi->streamRtpInput(rtpInput)) {
+                                    ALOGE("Failed to stream amplitude (%d): %s", errno,
+                                          strerror(errno));
+                                }
+                            },
+            });
+            lastRtpInput = rtpInput;
+        }
+
+        if (timeMs == endMs) {
+            break;
+        }
+    }
+
+    // The samples themselves are single raw writes from the real-time thread,
+    // which bypass the command queue.
+    mCommands.run(CommandQueue::Kind::OTHER, [&] {
+        cancelSteps(&mAmplitudeScheduler);
+        mAmplitudeScheduler.start(std::move(steps));
+    });
 
     return ndk::ScopedAStatus::ok();
 }
@@ -368,13 +533,23 @@ ndk::ScopedAStatus Vibrator::setExternalControl(bool enabled) {
 }
 
 binder_status_t Vibrator::dump(int fd, const char **args, uint32_t numArgs) {
+    waitReady();
     if (fd < 0) {
         ALOGE("Called debug() with invalid fd.");
         return STATUS_OK;
     }
 
-    (void)args;
-    (void)numArgs;
+    for (uint32_t i = 0; i < numArgs; i++) {
+        if (!strcmp(args[i], "--reset-latency")) {
+            mOnLatency.reset();
+            mOffLatency.reset();
+            mPerformLatency.reset();
+            mSetAmplitudeLatency.reset();
+            mHwApi->resetLatencies();
+            dprintf(fd, "Latency histograms reset\n");
+            return STATUS_OK;
+        }
+    }
 
     dprintf(fd, "AIDL:\n");
 
@@ -392,10 +567,21 @@ binder_status_t Vibrator::dump(int fd, const char **args, uint32_t numArgs) {
                 mEffectConfig->odClamp[3], mEffectConfig->odClamp[4]);
         dprintf(fd, "  Effect OL LRA Period: %" PRIu32 "\n", mEffectConfig->olLraPeriod);
     }
+    if (mThermalWatcher) {
+        dprintf(fd, "  USB Temp: %" PRId32 " (%s)\n", mThermalWatcher->temperature(),
+                ThermalWatcher::toString(mThermalWatcher->state()));
+    }
     dprintf(fd, "  Click Duration: %" PRIu32 "\n", mClickDuration);
     dprintf(fd, "  Tick Duration: %" PRIu32 "\n", mTickDuration);
     dprintf(fd, "  Double Click Duration: %" PRIu32 "\n", mDoubleClickDuration);
     dprintf(fd, "  Heavy Click Duration: %" PRIu32 "\n", mHeavyClickDuration);
+    LatencyHistogram::dumpHeader(fd, "API Latency:");
+    mOnLatency.dump(fd, "on");
+    mOffLatency.dump(fd, "off");
+    mPerformLatency.dump(fd, "perform");
+    mSetAmplitudeLatency.dump(fd, "setAmplitude");
+    dprintf(fd, "  Commands: %" PRIu64 " applied, %" PRIu64 " coalesced\n", mCommands.applied(),
+            mCommands.dropped());
 
     dprintf(fd, "\n");
 
@@ -419,21 +605,25 @@ ndk::ScopedAStatus Vibrator::perform(Effect effect, EffectStrength strength,
                                      const std::shared_ptr<IVibratorCallback> &callback,
                                      int32_t *_aidl_return) {
     ATRACE_NAME("Vibrator::perform");
+    waitReady();
+    ScopedLatency latency(&mPerformLatency);
     ndk::ScopedAStatus status;
 
-    if (callback) {
-        status = ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
-    } else {
+    mCommands.run(CommandQueue::Kind::OTHER, [&] {
+        cancelSteps(&mComposeScheduler);
+        cancelSteps(&mAmplitudeScheduler);
         status = performEffect(effect, strength, _aidl_return);
-    }
+
+        if (status.isOk() && callback) {
+            armCompletion(callback, *_aidl_return);
+        }
+    });
 
     return status;
 }
 
-ndk::ScopedAStatus Vibrator::performEffect(Effect effect, EffectStrength strength,
-                                           int32_t *outTimeMs) {
-    ndk::ScopedAStatus status;
-    uint32_t timeMS = 0;
+bool Vibrator::resolveEffect(Effect effect, EffectStrength strength, const char **outSequence,
+                             uint32_t *outTimeMs, int8_t *outVolOffset) {
     int8_t volOffset;
 
     switch (strength) {
@@ -447,118 +637,580 @@ ndk::ScopedAStatus Vibrator::performEffect(Effect effect, EffectStrength strengt
             volOffset = 1;
             break;
         default:
-            return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+            return false;
     }
 
     switch (effect) {
         case Effect::TEXTURE_TICK:
-            mHwApi->setSequencer(WAVEFORM_TICK_EFFECT_SEQ);
-            timeMS = mTickDuration;
+            *outSequence = WAVEFORM_TICK_EFFECT_SEQ;
+            *outTimeMs = mTickDuration;
             volOffset = TEXTURE_TICK;
             break;
         case Effect::CLICK:
-            mHwApi->setSequencer(WAVEFORM_CLICK_EFFECT_SEQ);
-            timeMS = mClickDuration;
+            *outSequence = WAVEFORM_CLICK_EFFECT_SEQ;
+            *outTimeMs = mClickDuration;
             volOffset += CLICK;
             break;
         case Effect::DOUBLE_CLICK:
-            mHwApi->setSequencer(WAVEFORM_DOUBLE_CLICK_EFFECT_SEQ);
-            timeMS = mDoubleClickDuration;
+            *outSequence = WAVEFORM_DOUBLE_CLICK_EFFECT_SEQ;
+            *outTimeMs = mDoubleClickDuration;
             volOffset += CLICK;
             break;
         case Effect::TICK:
-            mHwApi->setSequencer(WAVEFORM_TICK_EFFECT_SEQ);
-            timeMS = mTickDuration;
+            *outSequence = WAVEFORM_TICK_EFFECT_SEQ;
+            *outTimeMs = mTickDuration;
             volOffset += TICK;
             break;
         case Effect::HEAVY_CLICK:
-            mHwApi->setSequencer(WAVEFORM_HEAVY_CLICK_EFFECT_SEQ);
-            timeMS = mHeavyClickDuration;
+            *outSequence = WAVEFORM_HEAVY_CLICK_EFFECT_SEQ;
+            *outTimeMs = mHeavyClickDuration;
             volOffset += HEAVY_CLICK;
             break;
         default:
-            return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+            return false;
+    }
+
+    *outVolOffset = volOffset;
+
+    return true;
+}
+
+void Vibrator::compileEffectPrograms() {
+    for (const auto &effect : ndk::enum_range<Effect>()) {
+        for (const auto &strength : ndk::enum_range<EffectStrength>()) {
+            const char *sequence;
+            uint32_t timeMs;
+            int8_t volOffset;
+
+            if (!resolveEffect(effect, strength, &sequence, &timeMs, &volOffset)) {
+                continue;
+            }
+
+            mEffectPrograms[{effect, strength}] =
+                    compileProgram(sequence, WAVEFORM_MODE, mEffectConfig, volOffset, timeMs);
+        }
+    }
+}
+
+ndk::ScopedAStatus Vibrator::performEffect(Effect effect, EffectStrength strength,
+                                           int32_t *outTimeMs) {
+    ndk::ScopedAStatus status;
+    auto program = mEffectPrograms.find({effect, strength});
+
+    if (program == mEffectPrograms.end()) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
     }
-    status = on(timeMS, WAVEFORM_MODE, mEffectConfig, volOffset);
+
+    status = run(program->second, program->second.timeMs, LoopControl::OPEN);
     if (!status.isOk()) {
+        // the registers may hold part of this program and part of another
+        mEffectStaged = false;
         return status;
     }
+    mPredictedProgram = &program->second;
+    mEffectStaged = true;
 
-    *outTimeMs = timeMS;
+    *outTimeMs = program->second.timeMs;
 
     return ndk::ScopedAStatus::ok();
 }
 
-ndk::ScopedAStatus Vibrator::getSupportedAlwaysOnEffects(std::vector<Effect> * /*_aidl_return*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+void Vibrator::armCompletion(const std::shared_ptr<IVibratorCallback> &callback,
+                             uint32_t timeoutMs) {
+    std::shared_ptr<IVibratorCallback> superseded;
+
+    {
+        std::lock_guard<std::mutex> lock(mCompletionMutex);
+        superseded = std::move(mCompletionCallback);
+        mCompletionCallback = callback;
+        mCompletionTimeoutMs = timeoutMs;
+        mCompletionPendingEnded = false;
+    }
+    mCompletionCv.notify_all();
+
+    // a vibration that was replaced before it was waited on has ended already
+    if (superseded) {
+        superseded->onComplete();
+    }
 }
 
-ndk::ScopedAStatus Vibrator::alwaysOnEnable(int32_t /*id*/, Effect /*effect*/,
-                                            EffectStrength /*strength*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+void Vibrator::endCompletion() {
+    std::lock_guard<std::mutex> lock(mCompletionMutex);
+    // a callback not yet picked up by the completion thread is not waited on
+    if (mCompletionCallback) {
+        mCompletionPendingEnded = true;
+    }
+    if (!mCompletionWaiting || mCompletionWoken) {
+        return;
+    }
+    mCompletionWoken = true;
+    uint64_t count = 1;
+    if (TEMP_FAILURE_RETRY(write(mCompletionWakeFd, &count, sizeof(count))) < 0) {
+        ALOGE("Failed to interrupt completion wait (%d): %s", errno, strerror(errno));
+    }
 }
-ndk::ScopedAStatus Vibrator::alwaysOnDisable(int32_t /*id*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+
+void Vibrator::completionLoop() {
+    std::unique_lock<std::mutex> lock(mCompletionMutex);
+
+    while (true) {
+        mCompletionCv.wait(lock, [&] { return mCompletionExit || mCompletionCallback; });
+        if (!mCompletionCallback) {
+            break;
+        }
+
+        auto callback = std::move(mCompletionCallback);
+        int32_t timeoutMs = std::min<uint64_t>(
+                static_cast<uint64_t>(mCompletionTimeoutMs) + COMPLETION_MARGIN_MS, INT32_MAX);
+        uint64_t count;
+        while (read(mCompletionWakeFd, &count, sizeof(count)) > 0) {
+        }
+        mCompletionWaiting = true;
+        mCompletionWoken = false;
+        // neither is a vibration that already ended, or one still pending at shutdown
+        bool ended = mCompletionPendingEnded || mCompletionExit;
+        mCompletionPendingEnded = false;
+
+        lock.unlock();
+        // If the driver never reports the end of the vibration, the timeout
+        // derived from the requested duration completes it instead, unless the
+        // HAL ends or replaces the vibration first.
+        bool reported = !ended && mHwApi->pollActivate(false, timeoutMs, mCompletionWakeFd);
+        lock.lock();
+        if (!reported && !ended && !mCompletionWoken) {
+            ALOGW("Completion inferred from timeout (%d ms)", timeoutMs);
+        }
+        mCompletionWaiting = false;
+        lock.unlock();
+
+        auto ret = callback->onComplete();
+        if (!ret.isOk()) {
+            ALOGE("Failed completion callback: %d", ret.getExceptionCode());
+        }
+        lock.lock();
+    }
 }
 
-ndk::ScopedAStatus Vibrator::getCompositionDelayMax(int32_t * /*maxDelayMs*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+std::function<void()> Vibrator::queuedStep(StepScheduler *scheduler,
+                                           const std::shared_ptr<std::atomic<uint64_t>> &list,
+                                           std::function<void()> action) {
+    return [this, scheduler, list, action = std::move(action)] {
+        mCommands.run(CommandQueue::Kind::OTHER, [&] {
+            // a step that was already due when its list was cancelled or
+            // replaced must not override what replaced it
+            if (scheduler->current(*list)) {
+                action();
+            }
+        });
+    };
 }
 
-ndk::ScopedAStatus Vibrator::getCompositionSizeMax(int32_t * /*maxSize*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+void Vibrator::cancelSteps(StepScheduler *scheduler) {
+    if (auto done = scheduler->cancel()) {
+        done();
+    }
 }
 
-ndk::ScopedAStatus Vibrator::getSupportedPrimitives(
-        std::vector<CompositePrimitive> * /*supported*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+ndk::ScopedAStatus Vibrator::getSupportedAlwaysOnEffects(std::vector<Effect> *_aidl_return) {
+    waitReady();
+    if (!mAlwaysOnSupported) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+    *_aidl_return = {Effect::CLICK, Effect::DOUBLE_CLICK, Effect::TICK, Effect::HEAVY_CLICK,
+                     Effect::TEXTURE_TICK};
+    return ndk::ScopedAStatus::ok();
 }
 
-ndk::ScopedAStatus Vibrator::getPrimitiveDuration(CompositePrimitive /*primitive*/,
-                                                  int32_t * /*durationMs*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+bool Vibrator::resolveAlwaysOn(Effect effect, EffectStrength strength, uint32_t *outIndex) {
+    switch (strength) {
+        case EffectStrength::LIGHT:
+        case EffectStrength::MEDIUM:
+        case EffectStrength::STRONG:
+            break;
+        default:
+            return false;
+    }
+
+    switch (effect) {
+        case Effect::CLICK:
+            *outIndex = WAVEFORM_CLICK_INDEX;
+            return true;
+        case Effect::DOUBLE_CLICK:
+            *outIndex = WAVEFORM_DOUBLE_CLICK_INDEX;
+            return true;
+        case Effect::TICK:
+        case Effect::TEXTURE_TICK:
+            *outIndex = WAVEFORM_TICK_INDEX;
+            return true;
+        case Effect::HEAVY_CLICK:
+            *outIndex = WAVEFORM_HEAVY_CLICK_INDEX;
+            return true;
+        default:
+            return false;
+    }
 }
 
-ndk::ScopedAStatus Vibrator::compose(const std::vector<CompositeEffect> & /*composite*/,
-                                     const std::shared_ptr<IVibratorCallback> & /*callback*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+ndk::ScopedAStatus Vibrator::alwaysOnEnable(int32_t id, Effect effect, EffectStrength strength) {
+    ATRACE_NAME("Vibrator::alwaysOnEnable");
+    waitReady();
+    uint32_t index;
+
+    if (!mAlwaysOnSupported) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+    if (id != ALWAYS_ON_ID) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+    }
+    if (!resolveAlwaysOn(effect, strength, &index)) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+
+    ndk::ScopedAStatus status;
+
+    mCommands.run(CommandQueue::Kind::OTHER, [&] {
+        if (!mHwApi->setLpTriggerEffect(index)) {
+            ALOGE("Failed to enable always-on effect (%d): %s", errno, strerror(errno));
+            status = ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+        }
+    });
+
+    return status;
 }
 
-ndk::ScopedAStatus Vibrator::getResonantFrequency(float * /*resonantFreqHz*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+ndk::ScopedAStatus Vibrator::alwaysOnDisable(int32_t id) {
+    ATRACE_NAME("Vibrator::alwaysOnDisable");
+    waitReady();
+
+    if (!mAlwaysOnSupported) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+    if (id != ALWAYS_ON_ID) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+    }
+
+    ndk::ScopedAStatus status;
+
+    mCommands.run(CommandQueue::Kind::OTHER, [&] {
+        if (!mHwApi->setLpTriggerEffect(LP_TRIGGER_DISABLED)) {
+            ALOGE("Failed to disable always-on effect (%d): %s", errno, strerror(errno));
+            status = ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+        }
+    });
+
+    return status;
+}
+
+ndk::ScopedAStatus Vibrator::getCompositionDelayMax(int32_t *maxDelayMs) {
+    ATRACE_NAME("Vibrator::getCompositionDelayMax");
+    *maxDelayMs = COMPOSE_DELAY_MAX_MS;
+    return ndk::ScopedAStatus::ok();
+}
+
+ndk::ScopedAStatus Vibrator::getCompositionSizeMax(int32_t *maxSize) {
+    ATRACE_NAME("Vibrator::getCompositionSizeMax");
+    *maxSize = COMPOSE_SIZE_MAX;
+    return ndk::ScopedAStatus::ok();
+}
+
+ndk::ScopedAStatus Vibrator::getSupportedPrimitives(std::vector<CompositePrimitive> *supported) {
+    *supported = {CompositePrimitive::NOOP, CompositePrimitive::CLICK,
+                  CompositePrimitive::LIGHT_TICK};
+    return ndk::ScopedAStatus::ok();
+}
+
+bool Vibrator::resolvePrimitive(CompositePrimitive primitive, uint8_t *outIndex,
+                                uint32_t *outTimeMs, int8_t *outVolOffset) {
+    switch (primitive) {
+        case CompositePrimitive::CLICK:
+            *outIndex = WAVEFORM_CLICK_INDEX;
+            *outTimeMs = mClickDuration;
+            *outVolOffset = CLICK + 1;
+            return true;
+        case CompositePrimitive::LIGHT_TICK:
+            *outIndex = WAVEFORM_TICK_INDEX;
+            *outTimeMs = mTickDuration;
+            *outVolOffset = TICK;
+            return true;
+        default:
+            return false;
+    }
+}
+
+ndk::ScopedAStatus Vibrator::getPrimitiveDuration(CompositePrimitive primitive,
+                                                  int32_t *durationMs) {
+    waitReady();
+    uint8_t index;
+    uint32_t timeMs;
+    int8_t volOffset;
+
+    if (primitive == CompositePrimitive::NOOP) {
+        *durationMs = 0;
+        return ndk::ScopedAStatus::ok();
+    }
+
+    if (!resolvePrimitive(primitive, &index, &timeMs, &volOffset)) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+
+    *durationMs = timeMs;
+    return ndk::ScopedAStatus::ok();
+}
+
+ndk::ScopedAStatus Vibrator::compose(const std::vector<CompositeEffect> &composite,
+                                     const std::shared_ptr<IVibratorCallback> &callback) {
+    ATRACE_NAME("Vibrator::compose");
+    waitReady();
+    std::vector<StepScheduler::Step> steps;
+    auto list = std::make_shared<std::atomic<uint64_t>>(0);
+    std::string sequence;
+    size_t slots = 0;
+    uint8_t scale = 0;
+    int8_t volOffset = 0;
+    uint64_t startMs = 0;
+    uint64_t timeMs = 0;
+    uint64_t endMs = 0;
+
+    if (composite.empty() || composite.size() > COMPOSE_SIZE_MAX) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+    }
+
+    // Primitives that follow each other without a gap and share a scale are
+    // played from a single sequencer activation; every other boundary becomes
+    // a step on the timer thread, at an offset computed here up front.
+    auto flush = [&] {
+        if (slots == 0) {
+            return;
+        }
+        auto program = compileProgram(sequence.c_str(), WAVEFORM_MODE, mEffectConfig,
+                                      volOffset, timeMs);
+        program.scale = scale;
+        steps.push_back({
+                .offset = std::chrono::milliseconds(startMs),
+                .action = queuedStep(&mComposeScheduler, list,
+                                     [this, program] {
+                                         run(program, program.timeMs, LoopControl::OPEN);
+                                     }),
+        });
+        slots = 0;
+    };
+
+    for (const auto &effect : composite) {
+        uint8_t index;
+        uint32_t primitiveMs;
+        int8_t primitiveVolOffset;
+
+        if (effect.delayMs < 0 || effect.delayMs > COMPOSE_DELAY_MAX_MS) {
+            return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+        }
+        endMs += effect.delayMs;
+
+        if (effect.primitive == CompositePrimitive::NOOP) {
+            continue;
+        }
+        if (!resolvePrimitive(effect.primitive, &index, &primitiveMs, &primitiveVolOffset)) {
+            return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+        }
+        if (!(effect.scale >= 0.0f && effect.scale <= 1.0f)) {
+            return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+        }
+
+        uint8_t primitiveScale = amplitudeToScale(effect.scale);
+
+        if (slots == SEQUENCER_SLOTS_MAX || startMs + timeMs != endMs || scale != primitiveScale) {
+            flush();
+        }
+        if (slots == 0) {
+            sequence.clear();
+            scale = primitiveScale;
+            volOffset = primitiveVolOffset;
+            startMs = endMs;
+            timeMs = 0;
+        } else {
+            sequence += " ";
+        }
+
+        sequence += std::to_string(index) + " 0";
+        slots++;
+        volOffset = std::max(volOffset, primitiveVolOffset);
+        timeMs += primitiveMs;
+        endMs += primitiveMs;
+    }
+
+    flush();
+
+    // Trailing delays are honored before reporting completion.
+    uint64_t remainingMs = timeMs;
+    if (steps.empty() || endMs != startMs + timeMs) {
+        steps.push_back({.offset = std::chrono::milliseconds(endMs), .action = [] {}});
+        remainingMs = 0;
+    }
+
+    std::function<void()> done;
+    if (callback) {
+        done = [this, callback, remainingMs] { armCompletion(callback, remainingMs); };
+    }
+
+    mCommands.run(CommandQueue::Kind::OTHER, [&] {
+        cancelSteps(&mAmplitudeScheduler);
+        cancelSteps(&mComposeScheduler);
+        endCompletion();
+        mEffectStaged = false;
+        *list = mComposeScheduler.start(std::move(steps), std::move(done));
+    });
+
+    return ndk::ScopedAStatus::ok();
+}
+
+ndk::ScopedAStatus Vibrator::getResonantFrequency(float *resonantFreqHz) {
+    waitReady();
+    *resonantFreqHz = mPwlePlanner->resonantFrequency();
+    return ndk::ScopedAStatus::ok();
 }
 
 ndk::ScopedAStatus Vibrator::getQFactor(float * /*qFactor*/) {
     return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
 }
 
-ndk::ScopedAStatus Vibrator::getFrequencyResolution(float * /*freqResolutionHz*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+ndk::ScopedAStatus Vibrator::getFrequencyResolution(float *freqResolutionHz) {
+    waitReady();
+    if (!mHwApi->hasRtpInput()) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+    *freqResolutionHz = PwlePlanner::FREQUENCY_RESOLUTION_HZ;
+    return ndk::ScopedAStatus::ok();
 }
 
-ndk::ScopedAStatus Vibrator::getFrequencyMinimum(float * /*freqMinimumHz*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+ndk::ScopedAStatus Vibrator::getFrequencyMinimum(float *freqMinimumHz) {
+    waitReady();
+    if (!mHwApi->hasRtpInput()) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+    *freqMinimumHz = mPwlePlanner->frequencyMinimum();
+    return ndk::ScopedAStatus::ok();
 }
 
-ndk::ScopedAStatus Vibrator::getBandwidthAmplitudeMap(std::vector<float> * /*_aidl_return*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+ndk::ScopedAStatus Vibrator::getBandwidthAmplitudeMap(std::vector<float> *_aidl_return) {
+    waitReady();
+    if (!mHwApi->hasRtpInput()) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+    *_aidl_return = mPwlePlanner->bandwidthAmplitudeMap();
+    return ndk::ScopedAStatus::ok();
 }
 
-ndk::ScopedAStatus Vibrator::getPwlePrimitiveDurationMax(int32_t * /*durationMs*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+ndk::ScopedAStatus Vibrator::getPwlePrimitiveDurationMax(int32_t *durationMs) {
+    waitReady();
+    if (!mHwApi->hasRtpInput()) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+    *durationMs = PwlePlanner::PRIMITIVE_DURATION_MAX_MS;
+    return ndk::ScopedAStatus::ok();
 }
 
-ndk::ScopedAStatus Vibrator::getPwleCompositionSizeMax(int32_t * /*maxSize*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+ndk::ScopedAStatus Vibrator::getPwleCompositionSizeMax(int32_t *maxSize) {
+    waitReady();
+    if (!mHwApi->hasRtpInput()) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+    *maxSize = PwlePlanner::COMPOSITION_SIZE_MAX;
+    return ndk::ScopedAStatus::ok();
 }
 
-ndk::ScopedAStatus Vibrator::getSupportedBraking(std::vector<Braking> * /*supported*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+ndk::ScopedAStatus Vibrator::getSupportedBraking(std::vector<Braking> *supported) {
+    waitReady();
+    if (!mHwApi->hasRtpInput()) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+    *supported = {Braking::NONE};
+    return ndk::ScopedAStatus::ok();
 }
 
-ndk::ScopedAStatus Vibrator::composePwle(const std::vector<PrimitivePwle> & /*composite*/,
-                                         const std::shared_ptr<IVibratorCallback> & /*callback*/) {
-    return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+ndk::ScopedAStatus Vibrator::composePwle(const std::vector<PrimitivePwle> &composite,
+                                         const std::shared_ptr<IVibratorCallback> &callback) {
+    ATRACE_NAME("Vibrator::composePwle");
+    waitReady();
+    std::vector<PwlePlanner::Segment> segments;
+    std::vector<StepScheduler::Step> steps;
+    auto list = std::make_shared<std::atomic<uint64_t>>(0);
+    uint32_t durationMs;
+
+    if (!mHwApi->hasRtpInput()) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_UNSUPPORTED_OPERATION);
+    }
+    if (!mPwlePlanner->plan(composite, &segments, &durationMs)) {
+        return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+    }
+
+    // The first segment is programmed before activation, the rest only
+    // rewrite the registers whose values change, and the duration register
+    // ends the vibration without another write. Only the activation goes
+    // through the command queue; the segments are raw writes from the
+    // real-time thread, which thus never waits on another caller's commands.
+    int8_t rtpInput = amplitudeToRtpInput(segments.front().amplitude);
+    uint32_t olLraPeriod = segments.front().olLraPeriod;
+
+    steps.push_back({
+            .offset = std::chrono::milliseconds(0),
+            .action = queuedStep(&mAmplitudeScheduler, list,
+                                 [this, rtpInput, olLraPeriod, durationMs] {
+                                     auto program = mSteadyProgram;
+                                     program.olLraPeriod = olLraPeriod;
+                                     mHwApi->streamRtpInput(rtpInput);
+                                     mHwApi->setOlLraPeriod(program.olLraPeriod);
+                                     run(program, durationMs, LoopControl::OPEN);
+                                     // whatever plays next restores the period
+                                     mOlLraPeriodOverridden = true;
+                                 }),
+    });
+
+    for (auto segment = std::next(segments.begin()); segment != segments.end(); segment++) {
+        int8_t nextRtpInput = amplitudeToRtpInput(segment->amplitude);
+        bool rtpChanged = nextRtpInput != rtpInput;
+        bool periodChanged = segment->olLraPeriod != olLraPeriod;
+
+        if (!rtpChanged && !periodChanged) {
+            continue;
+        }
+
+        rtpInput = nextRtpInput;
+        olLraPeriod = segment->olLraPeriod;
+        steps.push_back({
+                .offset = std::chrono::milliseconds(segment->timeMs),
+                .action =
+                        [this, list, rtpInput, olLraPeriod, rtpChanged, periodChanged] {
+                            // a segment already due when its list was cancelled
+                            // or replaced must not override what replaced it
+                            if (!mAmplitudeScheduler.current(*list)) {
+                                return;
+                            }
+                            if (periodChanged && !mHwApi->streamOlLraPeriod(olLraPeriod)) {
+                                ALOGE("Failed to stream LRA period (%d): %s", errno,
+                                      strerror(errno));
+                            }
+                            if (rtpChanged && !mHwApi->streamRtpInput(rtpInput)) {
+                                ALOGE("Failed to stream amplitude (%d): %s", errno,
+                                      strerror(errno));
+                            }
+                        },
+        });
+    }
+
+    steps.push_back({.offset = std::chrono::milliseconds(durationMs), .action = [] {}});
+
+    std::function<void()> done;
+    if (callback) {
+        done = [this, callback] { armCompletion(callback, 0); };
+    }
+
+    mCommands.run(CommandQueue::Kind::OTHER, [&] {
+        cancelSteps(&mComposeScheduler);
+        cancelSteps(&mAmplitudeScheduler);
+        endCompletion();
+        mEffectStaged = false;
+        *list = mAmplitudeScheduler.start(std::move(steps), std::move(done));
+    });
+
+    return ndk::ScopedAStatus::ok();
 }
 
 }  // namespace vibrator
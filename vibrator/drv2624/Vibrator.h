@@ -16,8 +16,21 @@
 #pragma once
 
 #include <aidl/android/hardware/vibrator/BnVibrator.h>
+#include <android-base/unique_fd.h>
 
+#include "CommandQueue.h"
+#include "LatencyHistogram.h"
+#include "PwlePlanner.h"
+#include "StepScheduler.h"
+#include "ThermalWatcher.h"
+
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
 
 namespace aidl {
 namespace android {
@@ -30,14 +43,24 @@ class Vibrator : public BnVibrator {
     class HwApi {
       public:
         virtual ~HwApi() = default;
+        // Opens the attributes that are not needed to register the service.
+        // Called once, before any of them are accessed.
+        virtual void openDeferred() = 0;
         // Stores the COMP, BEMF, and GAIN calibration values to use.
         //   <COMP> <BEMF> <GAIN>
         virtual bool setAutocal(std::string value) = 0;
         // Stores the open-loop LRA frequency to be used.
         virtual bool setOlLraPeriod(uint32_t value) = 0;
+        // Same as setOlLraPeriod(), through a preopened descriptor that is
+        // safe to write from a real-time thread. Not traced or recorded.
+        virtual bool streamOlLraPeriod(uint32_t value) = 0;
         // Activates/deactivates the vibrator for durations specified by
         // setDuration().
         virtual bool setActivate(bool value) = 0;
+        // Blocks until the activation state matches the given value or the
+        // timeout in milliseconds expires (negative waits indefinitely). Returns
+        // false early once wakeFd, if given, becomes readable.
+        virtual bool pollActivate(bool value, int32_t timeoutMs, int wakeFd = -1) = 0;
         // Specifies the vibration duration in milliseconds.
         virtual bool setDuration(uint32_t value) = 0;
         // Specifies the active state of the vibrator
@@ -48,6 +71,9 @@ class Vibrator : public BnVibrator {
         // Specifies the playback amplitude of the haptic waveforms in RTP mode.
         // Negative numbers indicates braking.
         virtual bool setRtpInput(int8_t value) = 0;
+        // Same as setRtpInput(), through a preopened descriptor that is safe
+        // to write from a real-time thread. Not traced or recorded.
+        virtual bool streamRtpInput(int8_t value) = 0;
         // Specifies the mode of operation.
         //   rtp        - RTP Mode
         //   waveform   - Waveform Sequencer Mode
@@ -69,6 +95,7 @@ class Vibrator : public BnVibrator {
         // Specifies waveform index to be played in low-power trigger mode.
         //   0  - Disabled
         //   1+ - Waveform Index
+        // The selection survives setState() toggles.
         virtual bool setLpTriggerEffect(uint32_t value) = 0;
         // Specifies which shape to use for driving the LRA when in open loop
         // mode.
@@ -82,6 +109,8 @@ class Vibrator : public BnVibrator {
         virtual bool getUsbTemp(int32_t *value) = 0;
         // Emit diagnostic information to the given file.
         virtual void debug(int fd) = 0;
+        // Clears the write latency statistics emitted by debug().
+        virtual void resetLatencies() = 0;
     };
 
     // APIs for obtaining calibration/configuration data from persistent memory.
@@ -141,6 +170,28 @@ class Vibrator : public BnVibrator {
         uint32_t olLraPeriod;
     };
 
+    // Fully resolved register values for one kind of vibration, so that issuing
+    // it requires no lookups, string building or float math.
+    struct RegisterProgram {
+        std::string sequence;
+        uint8_t scale;
+        const char *mode;
+        bool hasConfig;
+        WaveShape shape;
+        uint32_t odClamp;
+        uint32_t olLraPeriod;
+        uint32_t timeMs;
+    };
+
+  public:
+    // One point of an amplitude envelope: the amplitude, from 0 to 1, to reach
+    // at the given time since the start of the envelope.
+    struct AmplitudePoint {
+        float amplitude;
+        uint32_t timeMs;
+    };
+
+  private:
     enum OdClampOffset : uint32_t {
         TEXTURE_TICK,
         TICK,
@@ -150,6 +201,7 @@ class Vibrator : public BnVibrator {
 
   public:
     Vibrator(std::unique_ptr<HwApi> hwapi, std::unique_ptr<HwCal> hwcal);
+    ~Vibrator();
 
     ndk::ScopedAStatus getCapabilities(int32_t *_aidl_return) override;
     ndk::ScopedAStatus off() override;
@@ -161,8 +213,8 @@ class Vibrator : public BnVibrator {
     ndk::ScopedAStatus getSupportedEffects(std::vector<Effect> *_aidl_return) override;
     ndk::ScopedAStatus setAmplitude(float amplitude) override;
     ndk::ScopedAStatus setExternalControl(bool enabled) override;
-    ndk::ScopedAStatus getCompositionDelayMax(int32_t *maxDelayMs);
-    ndk::ScopedAStatus getCompositionSizeMax(int32_t *maxSize);
+    ndk::ScopedAStatus getCompositionDelayMax(int32_t *maxDelayMs) override;
+    ndk::ScopedAStatus getCompositionSizeMax(int32_t *maxSize) override;
     ndk::ScopedAStatus getSupportedPrimitives(std::vector<CompositePrimitive> *supported) override;
     ndk::ScopedAStatus getPrimitiveDuration(CompositePrimitive primitive,
                                             int32_t *durationMs) override;
@@ -184,10 +236,50 @@ class Vibrator : public BnVibrator {
 
     binder_status_t dump(int fd, const char **args, uint32_t numArgs) override;
 
+    // Blocks until the bring-up started by the constructor has completed,
+    // which every API call does implicitly.
+    void waitReady();
+
+    // Replays an amplitude envelope into the RTP input from a real-time
+    // thread, replacing any envelope still playing. This is not part of the
+    // AIDL interface; the vibrator must already be on in RTP mode. Any other
+    // vibration request and setAmplitude() stop the envelope.
+    ndk::ScopedAStatus streamAmplitude(const std::vector<AmplitudePoint> &envelope);
+    // Stages every register for the given effect except duration and activate,
+    // so that a following perform() of it only has to issue those two writes.
+    // Meant for moments that predict a haptic, such as a touch-down. This is
+    // not part of the AIDL interface, and must not be called mid-vibration.
+    ndk::ScopedAStatus prime(Effect effect, EffectStrength strength);
+
   private:
-    ndk::ScopedAStatus on(uint32_t timeoutMs, const char mode[],
-                          const std::unique_ptr<VibrationConfig> &config, const int8_t volOffset);
+    RegisterProgram compileProgram(const char sequence[], const char mode[],
+                                   const std::unique_ptr<VibrationConfig> &config,
+                                   const int8_t volOffset, uint32_t timeMs);
+    bool resolveEffect(Effect effect, EffectStrength strength, const char **outSequence,
+                       uint32_t *outTimeMs, int8_t *outVolOffset);
+    void init();
+    void compileEffectPrograms();
+    // Writes the program's configuration. Returns false if any write failed.
+    bool stage(const RegisterProgram &program, LoopControl loopMode);
+    ndk::ScopedAStatus run(const RegisterProgram &program, uint32_t timeoutMs,
+                           LoopControl loopMode);
     ndk::ScopedAStatus performEffect(Effect effect, EffectStrength strength, int32_t *outTimeMs);
+    void armCompletion(const std::shared_ptr<IVibratorCallback> &callback, uint32_t timeoutMs);
+    // Ends the wait on the vibration in progress, whose callback then
+    // completes right away, as the HAL itself has stopped or replaced it.
+    void endCompletion();
+    void completionLoop();
+    bool resolvePrimitive(CompositePrimitive primitive, uint8_t *outIndex, uint32_t *outTimeMs,
+                          int8_t *outVolOffset);
+    bool resolveAlwaysOn(Effect effect, EffectStrength strength, uint32_t *outIndex);
+    // Wraps a step so that it is applied through the command queue, and only
+    // if the list it belongs to is still current by then.
+    std::function<void()> queuedStep(StepScheduler *scheduler,
+                                     const std::shared_ptr<std::atomic<uint64_t>> &list,
+                                     std::function<void()> action);
+    // Cancels the scheduler's steps, still running the 'done' action of a
+    // list cut short so that its callback completes.
+    void cancelSteps(StepScheduler *scheduler);
 
     std::unique_ptr<HwApi> mHwApi;
     std::unique_ptr<HwCal> mHwCal;
@@ -201,8 +293,48 @@ class Vibrator : public BnVibrator {
     std::array<uint32_t, 5> mEffectTargetOdClamp;
     uint32_t mSteadyTargetOdClamp;
     uint32_t mSteadyOlLraPeriod;
+    // The calibrated open-loop period, and whether a PWLE has left another
+    // one behind that programs without a config of their own must undo.
+    uint32_t mLraPeriod;
+    bool mOlLraPeriodOverridden{false};
     uint32_t mSteadyOlLraPeriodShift;
     bool mDynamicConfig;
+    // Only created with the dynamic config, which picks the steady tuning by temperature.
+    std::unique_ptr<ThermalWatcher> mThermalWatcher;
+    bool mAlwaysOnSupported;
+    std::unique_ptr<PwlePlanner> mPwlePlanner;
+    std::map<std::tuple<Effect, EffectStrength>, RegisterProgram> mEffectPrograms;
+    RegisterProgram mSteadyProgram;
+    // The effect expected next, and whether the registers still hold an effect
+    // configuration rather than one left behind by on() or a composition.
+    const RegisterProgram *mPredictedProgram{nullptr};
+    bool mEffectStaged{true};
+    std::thread mInitThread;
+    std::mutex mInitMutex;
+    std::condition_variable mInitCv;
+    std::atomic<bool> mReady{false};
+    std::thread mCompletionThread;
+    std::mutex mCompletionMutex;
+    std::condition_variable mCompletionCv;
+    std::shared_ptr<IVibratorCallback> mCompletionCallback;
+    uint32_t mCompletionTimeoutMs;
+    bool mCompletionExit{false};
+    // Interrupts pollActivate() in the completion thread while mCompletionWaiting.
+    ::android::base::unique_fd mCompletionWakeFd;
+    bool mCompletionWaiting{false};
+    bool mCompletionWoken{false};
+    // mCompletionCallback's vibration ended before the thread got to wait on it
+    bool mCompletionPendingEnded{false};
+    // Every register write made on behalf of an API call or a scheduled step
+    // goes through here, except for amplitude envelope samples and PWLE
+    // segments after the first, which the real-time thread writes raw.
+    CommandQueue mCommands;
+    StepScheduler mComposeScheduler;
+    StepScheduler mAmplitudeScheduler;
+    LatencyHistogram mOnLatency;
+    LatencyHistogram mOffLatency;
+    LatencyHistogram mPerformLatency;
+    LatencyHistogram mSetAmplitudeLatency;
 };
 
 }  // namespace vibrator
@@ -14,11 +14,21 @@
 
 #include "benchmark/benchmark.h"
 
+#include <aidl/android/hardware/vibrator/BnVibratorCallback.h>
 #include <android-base/file.h>
 #include <android-base/properties.h>
 #include <cutils/fs.h>
 
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <set>
+
+#include "CommandQueue.h"
+#include "HapticCalibration.h"
 #include "Hardware.h"
+#include "StepScheduler.h"
+#include "SysfsSimulator.h"
 #include "Vibrator.h"
 
 namespace aidl {
@@ -29,7 +39,7 @@ namespace vibrator {
 using ::android::base::SetProperty;
 
 class VibratorBench : public benchmark::Fixture {
-  private:
+  protected:
     static constexpr const char *FILE_NAMES[]{
         "device/autocal",
         "device/ol_lra_period",
@@ -58,11 +68,17 @@ class VibratorBench : public benchmark::Fixture {
             const auto path = std::filesystem::path(mFilesDir.path) / name;
 
             fs_mkdirs(path.c_str(), S_IRWXU);
-            symlink("/dev/null", path.c_str());
+            createFile(path);
         }
 
         setenv("PROPERTY_PREFIX", PROPERTY_PREFIX, true);
 
+        std::ofstream{mCalFile.path} << "autocal: 9 10 11\n"
+                                     << "lra_period: 262\n"
+                                     << "haptic_coefficient: 0.4 -3.2 7.7 -1.9\n"
+                                     << "vibration_amp_max: 1.3\n";
+        setenv("CALIBRATION_FILEPATH", mCalFile.path, true);
+
         SetProperty(std::string() + PROPERTY_PREFIX + "config.dynamic", getDynamicConfig(state));
 
         mVibrator = ndk::SharedRefBase::make<Vibrator>(HwApi::Create(), std::make_unique<HwCal>());
@@ -79,6 +95,10 @@ class VibratorBench : public benchmark::Fixture {
     }
 
   protected:
+    virtual void createFile(const std::filesystem::path &path) {
+        symlink("/dev/null", path.c_str());
+    }
+
     std::string getDynamicConfig(const ::benchmark::State &state) const {
         return std::to_string(state.range(0));
     }
@@ -89,6 +109,7 @@ class VibratorBench : public benchmark::Fixture {
 
   protected:
     TemporaryDir mFilesDir;
+    TemporaryFile mCalFile;
     std::shared_ptr<IVibrator> mVibrator;
 };
 
@@ -141,6 +162,242 @@ BENCHMARK_WRAPPER(VibratorBench, getCapabilities, {
     }
 });
 
+// Startup cost of the service: 'construct' is how long registration is held
+// back, 'constructToReady' runs until the programs are compiled and the
+// calibration written out, when API calls stop waiting.
+BENCHMARK_WRAPPER(VibratorBench, construct, {
+    for (auto _ : state) {
+        auto vibrator =
+                ndk::SharedRefBase::make<Vibrator>(HwApi::Create(), std::make_unique<HwCal>());
+
+        state.PauseTiming();
+        vibrator.reset();
+        state.ResumeTiming();
+    }
+});
+
+BENCHMARK_WRAPPER(VibratorBench, constructToReady, {
+    for (auto _ : state) {
+        auto vibrator =
+                ndk::SharedRefBase::make<Vibrator>(HwApi::Create(), std::make_unique<HwCal>());
+        vibrator->waitReady();
+
+        state.PauseTiming();
+        vibrator.reset();
+        state.ResumeTiming();
+    }
+});
+
+// Looks up everything the Vibrator constructor does.
+static void readHwCal(HwCal *hwcal) {
+    std::string autocal;
+    uint32_t value;
+    std::array<float, 4> coeffs;
+    float ampMax;
+    bool dynamic;
+
+    hwcal->getAutocal(&autocal);
+    hwcal->getLraPeriod(&value);
+    hwcal->getEffectCoeffs(&coeffs);
+    hwcal->getSteadyAmpMax(&ampMax);
+    hwcal->getCloseLoopThreshold(&value);
+    hwcal->getDynamicConfig(&dynamic);
+    hwcal->getLongFrequencyShift(&value);
+    hwcal->getShortVoltageMax(&value);
+    hwcal->getLongVoltageMax(&value);
+    hwcal->getClickDuration(&value);
+    hwcal->getTickDuration(&value);
+    hwcal->getDoubleClickDuration(&value);
+    hwcal->getHeavyClickDuration(&value);
+    hwcal->getEffectShape(&value);
+    hwcal->getSteadyShape(&value);
+    hwcal->getTriggerEffectSupport(&value);
+    benchmark::DoNotOptimize(value);
+}
+
+BENCHMARK_WRAPPER(VibratorBench, hwCalLoad, {
+    for (auto _ : state) {
+        HwCal hwcal;
+        readHwCal(&hwcal);
+    }
+});
+
+// Every HwApi access is recorded for debug(), so this also measures recording.
+BENCHMARK_WRAPPER(VibratorBench, hwApiSet, {
+    auto hwapi = HwApi::Create();
+    uint32_t value = 0;
+
+    for (auto _ : state) {
+        hwapi->setDuration(value++);
+    }
+});
+
+// Compares the stream path used by setAmplitude() with the raw descriptor used
+// when streaming an envelope.
+BENCHMARK_WRAPPER(VibratorBench, hwApiSetRtpInput, {
+    auto hwapi = HwApi::Create();
+    hwapi->openDeferred();
+    int8_t value = 0;
+
+    for (auto _ : state) {
+        hwapi->setRtpInput(value++ & 0x7f);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+});
+
+BENCHMARK_WRAPPER(VibratorBench, hwApiStreamRtpInput, {
+    auto hwapi = HwApi::Create();
+    hwapi->openDeferred();
+    int8_t value = 0;
+
+    for (auto _ : state) {
+        hwapi->streamRtpInput(value++ & 0x7f);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+});
+
+// Cost of handing a one second envelope to the streaming thread, which
+// includes resampling it at the stream cadence.
+BENCHMARK_WRAPPER(VibratorBench, streamAmplitude, {
+    static constexpr uint32_t POINTS = 64;
+    auto vibrator = std::static_pointer_cast<Vibrator>(mVibrator);
+    std::vector<Vibrator::AmplitudePoint> envelope;
+
+    for (uint32_t i = 0; i < POINTS; i++) {
+        envelope.push_back({
+                .amplitude = i % 2 ? 1.0f : 0.25f,
+                .timeMs = i * 1000 / POINTS,
+        });
+    }
+
+    for (auto _ : state) {
+        vibrator->streamAmplitude(envelope);
+    }
+
+    mVibrator->off();
+
+    state.SetItemsProcessed(state.iterations() * POINTS);
+});
+
+BENCHMARK_WRAPPER(VibratorBench, compose, {
+    std::vector<CompositeEffect> composite;
+
+    for (int i = 0; i < 8; i++) {
+        composite.push_back({
+                .delayMs = i % 2 ? 0 : 10,
+                .primitive = i % 3 ? CompositePrimitive::CLICK : CompositePrimitive::LIGHT_TICK,
+                .scale = 1.0f / (i + 1),
+        });
+    }
+
+    for (auto _ : state) {
+        mVibrator->compose(composite, nullptr);
+    }
+
+    mVibrator->off();
+});
+
+// Measures how late each step runs against its deadline, optionally on a
+// SCHED_FIFO thread as used for amplitude streaming. Raising the priority
+// needs CAP_SYS_NICE; without it the result matches the default priority.
+static void StepSchedulerJitter(benchmark::State &state) {
+    static constexpr int STEPS = 16;
+    auto period = std::chrono::microseconds(state.range(0));
+    StepScheduler scheduler(state.range(1));
+    std::vector<StepScheduler::Clock::duration> lateness(STEPS);
+    StepScheduler::Clock::duration total{0}, max{0};
+    uint64_t count = 0;
+
+    for (auto _ : state) {
+        std::vector<StepScheduler::Step> steps;
+        std::promise<void> done;
+        auto start = StepScheduler::Clock::now();
+
+        for (int i = 0; i < STEPS; i++) {
+            auto deadline = start + period * (i + 1);
+            steps.push_back({
+                    .offset = period * (i + 1),
+                    .action = [&lateness, i, deadline] {
+                        lateness[i] = StepScheduler::Clock::now() - deadline;
+                    },
+            });
+        }
+
+        scheduler.start(std::move(steps), [&done] { done.set_value(); });
+        done.get_future().wait();
+
+        for (auto &late : lateness) {
+            total += late;
+            max = std::max(max, late);
+            count++;
+        }
+    }
+
+    state.counters["MeanLatenessUs"] =
+            std::chrono::duration<double, std::micro>(total).count() / count;
+    state.counters["MaxLatenessUs"] = std::chrono::duration<double, std::micro>(max).count();
+}
+
+BENCHMARK(StepSchedulerJitter)
+        ->Unit(benchmark::kMillisecond)
+        ->ArgNames({"PeriodUs", "Priority"})
+        ->Args({500, 0})
+        ->Args({1000, 0})
+        ->Args({5000, 0})
+        ->Args({5000, 2});
+
+// Measures the throughput of the command queue as more threads contend for
+// it, each command standing in for a register write of a few microseconds.
+// Amplitude changes coalesce under contention, other commands never do.
+static void CommandQueueThroughput(benchmark::State &state) {
+    static constexpr auto WRITE_TIME = std::chrono::microseconds(2);
+    static CommandQueue queue;
+    auto kind = static_cast<CommandQueue::Kind>(state.range(0));
+    uint64_t dropped = 0;
+
+    for (auto _ : state) {
+        queue.run(
+                kind,
+                [] {
+                    auto end = std::chrono::steady_clock::now() + WRITE_TIME;
+                    while (std::chrono::steady_clock::now() < end) {
+                    }
+                },
+                [&dropped] { dropped++; });
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["Coalesced"] =
+            benchmark::Counter(static_cast<double>(dropped) / state.iterations(),
+                               benchmark::Counter::kAvgThreads);
+}
+
+BENCHMARK(CommandQueueThroughput)
+        ->Unit(benchmark::kMicrosecond)
+        ->ArgNames({"Kind"})
+        ->Arg(static_cast<long>(CommandQueue::Kind::OTHER))
+        ->Arg(static_cast<long>(CommandQueue::Kind::AMPLITUDE))
+        ->ThreadRange(1, 8)
+        ->UseRealTime();
+
+static constexpr std::array<float, 4> CALIBRATION_COEFFS = {-0.0264, 0.1457, 0.0866, 0.01};
+static constexpr uint32_t CALIBRATION_LRA_PERIOD = 262;
+
+// Solves the curve across an amplitude sweep, as done for each od_clamp.
+static void HapticCalibrationSolve(benchmark::State &state) {
+    HapticCalibration calibration(CALIBRATION_COEFFS, CALIBRATION_LRA_PERIOD);
+    float targetG = 0.0f;
+
+    for (auto _ : state) {
+        targetG = targetG < 1.0f ? targetG + 0.001f : 0.0f;
+        benchmark::DoNotOptimize(calibration.solveOdClamp(targetG));
+    }
+}
+
+BENCHMARK(HapticCalibrationSolve);
+
 class VibratorEffectsBench : public VibratorBench {
   public:
     static void DefaultArgs(benchmark::internal::Benchmark *b) {
@@ -180,6 +437,241 @@ BENCHMARK_WRAPPER(VibratorEffectsBench, perform, {
     }
 });
 
+BENCHMARK_WRAPPER(VibratorEffectsBench, perform_alternating, {
+    Effect effect = getEffect(state);
+    EffectStrength strength = getStrength(state);
+    // switching strength defeats the write cache for the strength-dependent registers
+    EffectStrength other = strength == EffectStrength::LIGHT ? EffectStrength::STRONG
+                                                             : EffectStrength::LIGHT;
+    int32_t lengthMs;
+
+    ndk::ScopedAStatus status = mVibrator->perform(effect, strength, nullptr, &lengthMs);
+
+    if (status.getExceptionCode() == EX_UNSUPPORTED_OPERATION) {
+        return;
+    }
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        mVibrator->perform(effect, other, nullptr, &lengthMs);
+        state.ResumeTiming();
+        mVibrator->perform(effect, strength, nullptr, &lengthMs);
+    }
+});
+
+// Backs each attribute with a regular file, so that every write the HAL issues
+// can be counted as a newline-terminated record.
+class VibratorWritesBench : public VibratorEffectsBench {
+  protected:
+    void createFile(const std::filesystem::path &path) override {
+        std::ofstream touch{path};
+        mFiles.insert(path);
+    }
+
+    uint64_t countWrites() const {
+        uint64_t count = 0;
+        for (auto &path : mFiles) {
+            std::ifstream file{path};
+            count += std::count(std::istreambuf_iterator<char>(file),
+                                std::istreambuf_iterator<char>(), '\n');
+        }
+        return count;
+    }
+
+  private:
+    std::set<std::filesystem::path> mFiles;
+};
+
+BENCHMARK_WRAPPER(VibratorWritesBench, perform_writes, {
+    Effect effect = getEffect(state);
+    EffectStrength strength = getStrength(state);
+    int32_t lengthMs;
+    uint64_t initial = countWrites();
+
+    ndk::ScopedAStatus status = mVibrator->perform(effect, strength, nullptr, &lengthMs);
+
+    if (status.getExceptionCode() == EX_UNSUPPORTED_OPERATION) {
+        return;
+    }
+
+    // the first perform() programs every register, later ones only what changed
+    uint64_t before = countWrites();
+    uint64_t cold = before - initial;
+
+    for (auto _ : state) {
+        mVibrator->perform(effect, strength, nullptr, &lengthMs);
+    }
+
+    double warm = static_cast<double>(countWrites() - before) / state.iterations();
+
+    state.counters["ColdWrites"] = cold;
+    state.counters["Writes"] = warm;
+    state.counters["SavedWrites"] = cold - warm;
+});
+
+// Plays CLICK after the registers were left in a steady vibration's state,
+// either as is, after prime(), or after off() restaged the last effect. The
+// backing files count writes, and each one is charged a typical I2C
+// transaction time on top of the measured time.
+class VibratorPrimeBench : public VibratorWritesBench {
+  public:
+    static constexpr auto WRITE_COST = std::chrono::microseconds(100);
+
+    enum Warmup : long {
+        NONE,
+        PRIME,
+        OFF,
+    };
+
+    static void DefaultArgs(benchmark::internal::Benchmark *b) {
+        b->ArgNames({"DynamicConfig", "Warmup"});
+        for (const auto &dynamic : {false, true}) {
+            for (const auto &warmup : {NONE, PRIME, OFF}) {
+                b->Args({dynamic, warmup});
+            }
+        }
+    }
+
+  protected:
+    auto getWarmup(const ::benchmark::State &state) const {
+        return static_cast<Warmup>(getOtherArg(state, 0));
+    }
+};
+
+BENCHMARK_WRAPPER(VibratorPrimeBench, perform_firstTouch, {
+    auto vibrator = std::static_pointer_cast<Vibrator>(mVibrator);
+    auto warmup = getWarmup(state);
+    int32_t lengthMs;
+    uint64_t writes = 0;
+
+    // teaches the off() heuristic which effect comes next
+    mVibrator->perform(Effect::CLICK, EffectStrength::MEDIUM, nullptr, &lengthMs);
+
+    for (auto _ : state) {
+        mVibrator->on(1000, nullptr);
+        if (warmup == PRIME) {
+            vibrator->prime(Effect::CLICK, EffectStrength::MEDIUM);
+        } else if (warmup == OFF) {
+            mVibrator->off();
+        }
+
+        uint64_t before = countWrites();
+        auto start = std::chrono::steady_clock::now();
+        mVibrator->perform(Effect::CLICK, EffectStrength::MEDIUM, nullptr, &lengthMs);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        uint64_t count = countWrites() - before;
+
+        state.SetIterationTime(
+                std::chrono::duration<double>(elapsed + WRITE_COST * count).count());
+        writes += count;
+    }
+
+    state.counters["Writes"] = static_cast<double>(writes) / state.iterations();
+})->UseManualTime();
+
+// Runs against simulated attributes instead of /dev/null, so that a vibration
+// ends when the driver would clear activate and each write is charged the
+// given bus latency. Times run from the call until the completion callback.
+class VibratorSimulatedBench : public VibratorBench {
+  public:
+    static void DefaultArgs(benchmark::internal::Benchmark *b) {
+        b->ArgNames({"DynamicConfig", "WriteLatencyUs"});
+        for (const auto &dynamic : {false, true}) {
+            for (const auto &latency : {0, 100, 1000}) {
+                b->Args({dynamic, latency});
+            }
+        }
+    }
+
+    void SetUp(::benchmark::State &state) override {
+        std::map<std::string, std::string> attributes;
+
+        VibratorBench::SetUp(state);
+
+        for (auto n : FILE_NAMES) {
+            attributes[n] = "";
+        }
+        attributes["activate"] = "0";
+
+        mSimulator = std::make_unique<SysfsSimulator>(attributes);
+        mSimulator->modelActivate();
+        mSimulator->setWriteLatency(std::chrono::microseconds(getOtherArg(state, 0)));
+
+        setenv("HWAPI_PATH_PREFIX", mSimulator->prefix().c_str(), true);
+        auto vibrator =
+                ndk::SharedRefBase::make<Vibrator>(HwApi::Create(), std::make_unique<HwCal>());
+        vibrator->waitReady();
+        mVibrator = vibrator;
+    }
+
+    void TearDown(::benchmark::State &state) override {
+        mVibrator.reset();
+        mSimulator.reset();
+        VibratorBench::TearDown(state);
+    }
+
+  protected:
+    class Callback : public BnVibratorCallback {
+      public:
+        ndk::ScopedAStatus onComplete() override {
+            mCompleted.set_value(std::chrono::steady_clock::now());
+            return ndk::ScopedAStatus::ok();
+        }
+        auto getFuture() { return mCompleted.get_future(); }
+
+      private:
+        std::promise<std::chrono::steady_clock::time_point> mCompleted;
+    };
+
+    // Times one vibration from start() until it completes, reporting how far
+    // past the requested length it ran.
+    template <typename F>
+    void timeCompletion(::benchmark::State &state, F start) {
+        std::chrono::steady_clock::duration overshoot{0};
+        auto busTime = mSimulator->busTime();
+
+        for (auto _ : state) {
+            auto callback = ndk::SharedRefBase::make<Callback>();
+            auto completed = callback->getFuture();
+            auto begin = std::chrono::steady_clock::now();
+            auto lengthMs = start(callback);
+
+            if (completed.wait_for(std::chrono::seconds(5)) != std::future_status::ready) {
+                state.SkipWithError("vibration did not complete");
+                break;
+            }
+
+            auto elapsed = completed.get() - begin;
+            state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+            overshoot += elapsed - std::chrono::milliseconds(lengthMs);
+        }
+
+        state.counters["OvershootUs"] =
+                std::chrono::duration<double, std::micro>(overshoot).count() / state.iterations();
+        busTime = mSimulator->busTime() - busTime;
+        state.counters["BusUs"] =
+                std::chrono::duration<double, std::micro>(busTime).count() / state.iterations();
+    }
+
+  protected:
+    std::unique_ptr<SysfsSimulator> mSimulator;
+};
+
+BENCHMARK_WRAPPER(VibratorSimulatedBench, on_completion, {
+    timeCompletion(state, [this](auto &callback) {
+        mVibrator->on(20, callback);
+        return 20;
+    });
+})->UseManualTime();
+
+BENCHMARK_WRAPPER(VibratorSimulatedBench, perform_completion, {
+    timeCompletion(state, [this](auto &callback) {
+        int32_t lengthMs = 0;
+        mVibrator->perform(Effect::CLICK, EffectStrength::MEDIUM, callback, &lengthMs);
+        return lengthMs;
+    });
+})->UseManualTime();
+
 }  // namespace vibrator
 }  // namespace hardware
 }  // namespace android
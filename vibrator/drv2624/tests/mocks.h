@@ -16,18 +16,24 @@
 #ifndef ANDROID_HARDWARE_VIBRATOR_TEST_MOCKS_H
 #define ANDROID_HARDWARE_VIBRATOR_TEST_MOCKS_H
 
+#include <aidl/android/hardware/vibrator/BnVibratorCallback.h>
+
 #include "Vibrator.h"
 
 class MockApi : public ::aidl::android::hardware::vibrator::Vibrator::HwApi {
   public:
     MOCK_METHOD0(destructor, void());
+    MOCK_METHOD0(openDeferred, void());
     MOCK_METHOD1(setAutocal, bool(std::string value));
     MOCK_METHOD1(setOlLraPeriod, bool(uint32_t value));
+    MOCK_METHOD1(streamOlLraPeriod, bool(uint32_t value));
     MOCK_METHOD1(setActivate, bool(bool value));
+    MOCK_METHOD3(pollActivate, bool(bool value, int32_t timeoutMs, int wakeFd));
     MOCK_METHOD1(setDuration, bool(uint32_t value));
     MOCK_METHOD1(setState, bool(bool value));
     MOCK_METHOD0(hasRtpInput, bool());
     MOCK_METHOD1(setRtpInput, bool(int8_t value));
+    MOCK_METHOD1(streamRtpInput, bool(int8_t value));
     MOCK_METHOD1(setMode, bool(std::string value));
     MOCK_METHOD1(setSequencer, bool(std::string value));
     MOCK_METHOD1(setScale, bool(uint8_t value));
@@ -37,6 +43,7 @@ class MockApi : public ::aidl::android::hardware::vibrator::Vibrator::HwApi {
     MOCK_METHOD1(setOdClamp, bool(uint32_t value));
     MOCK_METHOD1(getUsbTemp, bool(int32_t *value));
     MOCK_METHOD1(debug, void(int fd));
+    MOCK_METHOD0(resetLatencies, void());
 
     ~MockApi() override { destructor(); };
 };
@@ -67,4 +74,9 @@ class MockCal : public ::aidl::android::hardware::vibrator::Vibrator::HwCal {
     bool getAutocal(std::string *value) { return getAutocal(*value); }
 };
 
+class MockVibratorCallback : public ::aidl::android::hardware::vibrator::BnVibratorCallback {
+  public:
+    MOCK_METHOD(ndk::ScopedAStatus, onComplete, ());
+};
+
 #endif  // ANDROID_HARDWARE_VIBRATOR_TEST_MOCKS_H
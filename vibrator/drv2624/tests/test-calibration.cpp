@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "HapticCalibration.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+using ::testing::TestParamInfo;
+using ::testing::TestWithParam;
+using ::testing::ValuesIn;
+
+struct GoldenCalibration {
+    const char *name;
+    std::array<float, 4> coeffs;
+    uint32_t lraPeriod;
+    // od_clamp values produced by the solver before it moved into
+    // HapticCalibration, at 0.15, 0.27, 0.43, 0.57 and 0.8 G
+    std::array<uint32_t, 5> odClamps;
+};
+
+static constexpr std::array<float, 5> GOLDEN_TARGET_G = {0.15, 0.27, 0.43, 0.57, 0.8};
+
+static const std::vector<GoldenCalibration> GOLDEN_CALIBRATIONS = {
+    {"LinearDefaultPeriod", {0.35, -0.01, 0, 0}, 262, {23, 40, 63, 83, 116}},
+    {"LinearSteep", {0.25, 0.02, 0, 0}, 262, {26, 50, 82, 110, 156}},
+    {"LinearShortPeriod", {0.25, 0.02, 0, 0}, 250, {26, 50, 82, 111, 157}},
+    {"CubicDefaultPeriod", {-0.0264, 0.1457, 0.0866, 0.01}, 262, {38, 59, 83, 102, 138}},
+    {"CubicShortPeriod", {-0.0264, 0.1457, 0.0866, 0.01}, 250, {39, 59, 83, 103, 138}},
+};
+
+class CalibrationTest : public TestWithParam<GoldenCalibration> {
+  public:
+    static auto PrintParam(const TestParamInfo<ParamType> &info) { return info.param.name; }
+};
+
+TEST_P(CalibrationTest, solveMatchesGolden) {
+    auto param = GetParam();
+    HapticCalibration calibration(param.coeffs, param.lraPeriod);
+
+    for (size_t i = 0; i < GOLDEN_TARGET_G.size(); i++) {
+        EXPECT_EQ(param.odClamps[i], calibration.solveOdClamp(GOLDEN_TARGET_G[i]))
+            << "targetG " << GOLDEN_TARGET_G[i];
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(CalibrationTests, CalibrationTest, ValuesIn(GOLDEN_CALIBRATIONS),
+                        CalibrationTest::PrintParam);
+
+TEST(CalibrationFormulaTest, freqPeriodFormula) {
+    // the default lra_period corresponds to 155 Hz, and the mapping is its own inverse
+    EXPECT_EQ(155, HapticCalibration::freqPeriodFormula(262));
+    EXPECT_EQ(262, HapticCalibration::freqPeriodFormula(155));
+}
+
+TEST(CalibrationFormulaTest, periodToFrequency) {
+    EXPECT_NEAR(155.06f, HapticCalibration::periodToFrequency(262), 0.01f);
+    EXPECT_EQ(262, HapticCalibration::frequencyToPeriod(155.06f));
+    EXPECT_EQ(203, HapticCalibration::frequencyToPeriod(200.0f));
+}
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "CommandQueue.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+using Kind = CommandQueue::Kind;
+
+// Holds the queue's writer inside a command until released, so that the
+// commands issued meanwhile pile up behind it.
+class Gate {
+  public:
+    Gate(CommandQueue *queue) : mQueue(queue) {
+        auto entered = std::make_shared<std::promise<void>>();
+        auto future = entered->get_future();
+        mThread = std::thread([this, entered] {
+            mQueue->run(Kind::OTHER, [this, entered] {
+                entered->set_value();
+                mRelease.get_future().wait();
+            });
+        });
+        future.wait();
+    }
+
+    ~Gate() { release(); }
+
+    // Waits for the given number of commands to be queued behind the gate.
+    void await(size_t pending) {
+        while (mQueue->pending() < pending) {
+            std::this_thread::yield();
+        }
+    }
+
+    void release() {
+        if (mThread.joinable()) {
+            mRelease.set_value();
+            mThread.join();
+        }
+    }
+
+  private:
+    CommandQueue *mQueue;
+    std::promise<void> mRelease;
+    std::thread mThread;
+};
+
+TEST(CommandQueueTest, inOrder) {
+    CommandQueue queue;
+    std::vector<int> order;
+    std::vector<std::thread> threads;
+    Gate gate(&queue);
+
+    // queue from separate threads one at a time, so the order is known
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&queue, &order, i] {
+            queue.run(Kind::OTHER, [&order, i] { order.push_back(i); });
+        });
+        gate.await(i + 1);
+    }
+    gate.release();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3}), order);
+    EXPECT_EQ(5, queue.applied());
+    EXPECT_EQ(0, queue.dropped());
+}
+
+TEST(CommandQueueTest, amplitudeCoalesced) {
+    CommandQueue queue;
+    std::vector<int> applied;
+    std::atomic<int> dropped{0};
+    std::vector<std::thread> threads;
+    Gate gate(&queue);
+
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&, i] {
+            queue.run(
+                    Kind::AMPLITUDE, [&applied, i] { applied.push_back(i); },
+                    [&dropped] { dropped++; });
+        });
+        gate.await(1);
+        // each one replaces the last, so wait for that to be dropped too
+        while (dropped < i) {
+            std::this_thread::yield();
+        }
+    }
+    gate.release();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    // only the latest amplitude reaches the device
+    EXPECT_EQ(std::vector<int>({3}), applied);
+    EXPECT_EQ(3, dropped);
+    EXPECT_EQ(3, queue.dropped());
+}
+
+TEST(CommandQueueTest, onCancelledByOff) {
+    CommandQueue queue;
+    std::vector<Kind> applied;
+    bool dropped = false;
+    Gate gate(&queue);
+
+    std::thread on([&] {
+        queue.run(
+                Kind::ON, [&applied] { applied.push_back(Kind::ON); },
+                [&dropped] { dropped = true; });
+    });
+    gate.await(1);
+    std::thread off([&] { queue.run(Kind::OFF, [&applied] { applied.push_back(Kind::OFF); }); });
+    on.join();
+    gate.release();
+    off.join();
+
+    EXPECT_TRUE(dropped);
+    EXPECT_EQ(std::vector<Kind>({Kind::OFF}), applied);
+}
+
+TEST(CommandQueueTest, noCoalescingAcrossOther) {
+    CommandQueue queue;
+    std::vector<Kind> applied;
+    std::vector<std::thread> threads;
+    Gate gate(&queue);
+
+    for (auto kind : {Kind::AMPLITUDE, Kind::OTHER, Kind::AMPLITUDE}) {
+        threads.emplace_back([&queue, &applied, kind] {
+            queue.run(kind, [&applied, kind] { applied.push_back(kind); });
+        });
+        gate.await(threads.size());
+    }
+    gate.release();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(std::vector<Kind>({Kind::AMPLITUDE, Kind::OTHER, Kind::AMPLITUDE}), applied);
+    EXPECT_EQ(0, queue.dropped());
+}
+
+TEST(CommandQueueTest, reentrant) {
+    CommandQueue queue;
+    std::vector<int> order;
+
+    queue.run(Kind::OTHER, [&] {
+        order.push_back(0);
+        queue.run(Kind::OTHER, [&order] { order.push_back(1); });
+        order.push_back(2);
+    });
+
+    EXPECT_EQ(std::vector<int>({0, 1, 2}), order);
+    EXPECT_EQ(2, queue.applied());
+}
+
+TEST(CommandQueueTest, stress) {
+    static constexpr int THREADS = 8;
+    static constexpr int COMMANDS = 2000;
+    static constexpr Kind KINDS[] = {Kind::ON, Kind::AMPLITUDE, Kind::OFF, Kind::OTHER};
+    CommandQueue queue;
+    std::atomic<int> inside{0}, overlaps{0}, applied{0}, dropped{0};
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < COMMANDS; i++) {
+                queue.run(
+                        KINDS[(t + i) % std::size(KINDS)],
+                        [&] {
+                            if (inside++ != 0) {
+                                overlaps++;
+                            }
+                            applied++;
+                            inside--;
+                        },
+                        [&dropped] { dropped++; });
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(0, overlaps);
+    EXPECT_EQ(THREADS * COMMANDS, applied + dropped);
+    EXPECT_EQ(applied, queue.applied());
+    EXPECT_EQ(dropped, queue.dropped());
+    EXPECT_EQ(0, queue.pending());
+}
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
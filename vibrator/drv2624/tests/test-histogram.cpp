@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "LatencyHistogram.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+using std::chrono::microseconds;
+using std::chrono::nanoseconds;
+
+TEST(LatencyHistogramTest, empty) {
+    LatencyHistogram histogram;
+
+    EXPECT_EQ(0, histogram.count());
+    EXPECT_EQ(0, histogram.percentileNs(0.5));
+    EXPECT_EQ(0, histogram.maxNs());
+}
+
+TEST(LatencyHistogramTest, percentiles) {
+    LatencyHistogram histogram;
+
+    // 90 fast samples in [512, 1024) ns, 9 in [8192, 16384) ns and one slow outlier
+    for (int i = 0; i < 90; i++) {
+        histogram.record(nanoseconds(600));
+    }
+    for (int i = 0; i < 9; i++) {
+        histogram.record(nanoseconds(10000));
+    }
+    histogram.record(microseconds(500));
+
+    EXPECT_EQ(100, histogram.count());
+    EXPECT_EQ(1024, histogram.percentileNs(0.50));
+    EXPECT_EQ(1024, histogram.percentileNs(0.90));
+    EXPECT_EQ(16384, histogram.percentileNs(0.99));
+    EXPECT_EQ(500000, histogram.percentileNs(1.0));
+    EXPECT_EQ(500000, histogram.maxNs());
+}
+
+TEST(LatencyHistogramTest, percentileCappedByMax) {
+    LatencyHistogram histogram;
+
+    histogram.record(nanoseconds(600));
+
+    EXPECT_EQ(600, histogram.percentileNs(0.5));
+}
+
+TEST(LatencyHistogramTest, reset) {
+    LatencyHistogram histogram;
+
+    histogram.record(microseconds(1));
+    histogram.reset();
+
+    EXPECT_EQ(0, histogram.count());
+    EXPECT_EQ(0, histogram.maxNs());
+}
+
+TEST(LatencyHistogramTest, concurrentRecords) {
+    static constexpr int THREADS = 4;
+    static constexpr int RECORDS = 10000;
+    LatencyHistogram histogram;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&histogram, t] {
+            for (int i = 0; i < RECORDS; i++) {
+                histogram.record(nanoseconds(t * RECORDS + i));
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(THREADS * RECORDS, histogram.count());
+    EXPECT_EQ(THREADS * RECORDS - 1, histogram.maxNs());
+}
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
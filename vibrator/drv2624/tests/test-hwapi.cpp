@@ -17,9 +17,12 @@
 #include <android-base/file.h>
 #include <cutils/fs.h>
 #include <gtest/gtest.h>
+#include <sys/eventfd.h>
 
+#include <chrono>
 #include <cstdlib>
 #include <fstream>
+#include <thread>
 
 #include "Hardware.h"
 
@@ -70,6 +73,7 @@ class HwApiTest : public Test {
         prefix = std::filesystem::path(mFilesDir.path) / "";
         setenv("HWAPI_PATH_PREFIX", prefix.c_str(), true);
         mHwApi = HwApi::Create();
+        mHwApi->openDeferred();
 
         for (auto n : REQUIRED) {
             auto name = std::filesystem::path(n);
@@ -80,6 +84,7 @@ class HwApiTest : public Test {
         prefix = std::filesystem::path(mEmptyDir.path) / "";
         setenv("HWAPI_PATH_PREFIX", prefix.c_str(), true);
         mNoApi = HwApi::Create();
+        mNoApi->openDeferred();
     }
 
     void TearDown() override { verifyContents(); }
@@ -393,6 +398,286 @@ INSTANTIATE_TEST_CASE_P(
     }),
     SetStringTest::PrintParam);
 
+using CachedUint32Test = HwApiTypedTest<bool(Vibrator::HwApi &, uint32_t)>;
+
+TEST_P(CachedUint32Test, repeat_elided) {
+    auto param = GetParam();
+    auto name = std::get<0>(param);
+    auto func = std::get<1>(param);
+    uint32_t value = std::rand();
+
+    expectContent(name, value);
+
+    EXPECT_TRUE(func(*mHwApi, value));
+    EXPECT_TRUE(func(*mHwApi, value));
+}
+
+TEST_P(CachedUint32Test, change_written) {
+    auto param = GetParam();
+    auto name = std::get<0>(param);
+    auto func = std::get<1>(param);
+    uint32_t value = std::rand();
+
+    expectContent(name, value);
+    expectContent(name, value + 1);
+    expectContent(name, value);
+
+    EXPECT_TRUE(func(*mHwApi, value));
+    EXPECT_TRUE(func(*mHwApi, value + 1));
+    EXPECT_TRUE(func(*mHwApi, value));
+}
+
+TEST_P(CachedUint32Test, setState_invalidates) {
+    auto param = GetParam();
+    auto name = std::get<0>(param);
+    auto func = std::get<1>(param);
+    uint32_t value = std::rand();
+
+    expectContent(name, value);
+    expectContent("state", "1");
+    expectContent(name, value);
+
+    EXPECT_TRUE(func(*mHwApi, value));
+    EXPECT_TRUE(mHwApi->setState(true));
+    EXPECT_TRUE(func(*mHwApi, value));
+}
+
+TEST_P(CachedUint32Test, setAutocal_invalidates) {
+    auto param = GetParam();
+    auto name = std::get<0>(param);
+    auto func = std::get<1>(param);
+    uint32_t value = std::rand();
+    std::string autocal = TemporaryFile().path;
+
+    expectContent(name, value);
+    expectContent("device/autocal", autocal);
+    expectContent(name, value);
+
+    EXPECT_TRUE(func(*mHwApi, value));
+    EXPECT_TRUE(mHwApi->setAutocal(autocal));
+    EXPECT_TRUE(func(*mHwApi, value));
+}
+
+TEST_P(CachedUint32Test, failure_notCached) {
+    auto param = GetParam();
+    auto func = std::get<1>(param);
+    uint32_t value = std::rand();
+
+    EXPECT_FALSE(func(*mNoApi, value));
+    EXPECT_FALSE(func(*mNoApi, value));
+}
+
+INSTANTIATE_TEST_CASE_P(
+    HwApiTests, CachedUint32Test,
+    ValuesIn({
+        CachedUint32Test::MakeParam("device/ol_lra_period", &Vibrator::HwApi::setOlLraPeriod),
+        CachedUint32Test::MakeParam("device/lra_wave_shape", &Vibrator::HwApi::setLraWaveShape),
+        CachedUint32Test::MakeParam("device/od_clamp", &Vibrator::HwApi::setOdClamp),
+    }),
+    CachedUint32Test::PrintParam);
+
+TEST_F(HwApiTest, setCtrlLoop_repeatElided) {
+    expectContent("device/ctrl_loop", "1");
+    expectContent("device/ctrl_loop", "0");
+
+    EXPECT_TRUE(mHwApi->setCtrlLoop(true));
+    EXPECT_TRUE(mHwApi->setCtrlLoop(true));
+    EXPECT_TRUE(mHwApi->setCtrlLoop(false));
+    EXPECT_TRUE(mHwApi->setCtrlLoop(false));
+}
+
+TEST_F(HwApiTest, setScale_repeatElided) {
+    expectContent("device/scale", "2");
+    expectContent("device/scale", "0");
+
+    EXPECT_TRUE(mHwApi->setScale(2));
+    EXPECT_TRUE(mHwApi->setScale(2));
+    EXPECT_TRUE(mHwApi->setScale(0));
+    EXPECT_TRUE(mHwApi->setScale(0));
+}
+
+TEST_F(HwApiTest, setState_restoresLpTrigger) {
+    expectContent("device/lp_trigger_effect", 3);
+    expectContent("state", "0");
+    expectContent("state", "1");
+    expectContent("device/lp_trigger_effect", 3);
+
+    EXPECT_TRUE(mHwApi->setLpTriggerEffect(3));
+    EXPECT_TRUE(mHwApi->setState(false));
+    EXPECT_TRUE(mHwApi->setState(true));
+}
+
+TEST_F(HwApiTest, setState_lpTriggerDisabled) {
+    expectContent("device/lp_trigger_effect", 0);
+    expectContent("state", "1");
+
+    EXPECT_TRUE(mHwApi->setLpTriggerEffect(0));
+    EXPECT_TRUE(mHwApi->setState(true));
+}
+
+TEST_F(HwApiTest, streamRtpInput_success) {
+    expectContent("device/rtp_input", -5);
+    expectContent("device/rtp_input", 100);
+
+    EXPECT_TRUE(mHwApi->streamRtpInput(-5));
+    EXPECT_TRUE(mHwApi->streamRtpInput(100));
+}
+
+TEST_F(HwApiTest, streamRtpInput_failure) {
+    EXPECT_FALSE(mNoApi->streamRtpInput(100));
+}
+
+TEST_F(HwApiTest, streamOlLraPeriod_success) {
+    uint32_t value = std::rand();
+
+    expectContent("device/ol_lra_period", value);
+    expectContent("device/ol_lra_period", value + 1);
+
+    EXPECT_TRUE(mHwApi->streamOlLraPeriod(value));
+    EXPECT_TRUE(mHwApi->streamOlLraPeriod(value + 1));
+}
+
+TEST_F(HwApiTest, streamOlLraPeriod_failure) {
+    EXPECT_FALSE(mNoApi->streamOlLraPeriod(100));
+}
+
+TEST_F(HwApiTest, setSequencer_repeatElided) {
+    expectContent("device/set_sequencer", "1 0");
+    expectContent("device/set_sequencer", "2 0");
+
+    EXPECT_TRUE(mHwApi->setSequencer("1 0"));
+    EXPECT_TRUE(mHwApi->setSequencer("1 0"));
+    EXPECT_TRUE(mHwApi->setSequencer("2 0"));
+}
+
+TEST_F(HwApiTest, setMode_repeatElided) {
+    expectContent("device/mode", "rtp");
+    expectContent("device/mode", "waveform");
+
+    EXPECT_TRUE(mHwApi->setMode("rtp"));
+    EXPECT_TRUE(mHwApi->setMode("rtp"));
+    EXPECT_TRUE(mHwApi->setMode("waveform"));
+    EXPECT_TRUE(mHwApi->setMode("waveform"));
+}
+
+TEST_F(HwApiTest, setMode_routineInvalidates) {
+    uint32_t value = std::rand();
+
+    expectContent("device/od_clamp", value);
+    expectContent("device/mode", "autocal");
+    expectContent("device/mode", "autocal");
+    expectContent("device/od_clamp", value);
+
+    EXPECT_TRUE(mHwApi->setOdClamp(value));
+    EXPECT_TRUE(mHwApi->setMode("autocal"));
+    EXPECT_TRUE(mHwApi->setMode("autocal"));
+    EXPECT_TRUE(mHwApi->setOdClamp(value));
+}
+
+TEST_F(HwApiTest, pollActivate_toggled) {
+    updateContent("activate", "1");
+    expectContent("activate", "0");
+
+    std::thread toggle{[this] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        // overwrite in place, as sysfs would, so the value is never empty
+        std::fstream(mFileMap["activate"], std::ios_base::in | std::ios_base::out)
+            << "0" << std::endl;
+    }};
+
+    EXPECT_TRUE(mHwApi->pollActivate(false, 1000));
+
+    toggle.join();
+}
+
+TEST_F(HwApiTest, pollActivate_timeout) {
+    auto start = std::chrono::steady_clock::now();
+
+    expectAndUpdateContent("activate", "1");
+
+    EXPECT_FALSE(mHwApi->pollActivate(false, 50));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+}
+
+TEST_F(HwApiTest, pollActivate_woken) {
+    unique_fd wake{eventfd(0, EFD_CLOEXEC)};
+    uint64_t count = 1;
+
+    expectAndUpdateContent("activate", "1");
+
+    std::thread interrupt{[&wake, &count] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        write(wake, &count, sizeof(count));
+    }};
+
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(mHwApi->pollActivate(false, 10000, wake));
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+    interrupt.join();
+}
+
+TEST_F(HwApiTest, debug_recordsRecent) {
+    TemporaryFile dump;
+    std::string records;
+
+    for (uint32_t i = 0; i < 40; i++) {
+        expectContent("duration", i);
+        EXPECT_TRUE(mHwApi->setDuration(i));
+    }
+    expectContent("device/mode", "rtp");
+    EXPECT_TRUE(mHwApi->setMode("rtp"));
+
+    mHwApi->debug(dump.fd);
+    ::android::base::ReadFileToString(dump.path, &records);
+
+    // only the most recent accesses are kept, oldest first
+    EXPECT_EQ(std::string::npos, records.find("set 'duration' = '8'"));
+    auto first = records.find("set 'duration' = '9'");
+    auto last = records.find("set 'duration' = '39'");
+    auto mode = records.find("set 'device/mode' = 'rtp'");
+    EXPECT_NE(std::string::npos, first);
+    EXPECT_LT(first, last);
+    EXPECT_LT(last, mode);
+    EXPECT_NE(std::string::npos, mode);
+}
+
+TEST_F(HwApiTest, debug_writeLatency) {
+    TemporaryFile dump;
+    std::string content;
+
+    expectContent("duration", 1);
+    expectContent("duration", 2);
+    EXPECT_TRUE(mHwApi->setDuration(1));
+    EXPECT_TRUE(mHwApi->setDuration(2));
+
+    mHwApi->debug(dump.fd);
+    ::android::base::ReadFileToString(dump.path, &content);
+    EXPECT_NE(std::string::npos, content.find(" duration                        2 "));
+
+    mHwApi->resetLatencies();
+    mHwApi->debug(dump.fd);
+    ::android::base::ReadFileToString(dump.path, &content);
+    // rows without samples are left out
+    EXPECT_EQ(std::string::npos, content.find(" duration                        0 "));
+}
+
+TEST_F(HwApiTest, debug_recordsTruncated) {
+    TemporaryFile dump;
+    std::string records;
+    std::string sequence = "1 0 2 0 1 0 2 0 1 0 2 0 1 0 2 0 1 0";
+
+    expectContent("device/set_sequencer", sequence);
+    EXPECT_TRUE(mHwApi->setSequencer(sequence));
+
+    mHwApi->debug(dump.fd);
+    ::android::base::ReadFileToString(dump.path, &records);
+
+    // values longer than the inline buffer are cut short
+    auto expected = "set 'device/set_sequencer' = '" + sequence.substr(0, 31) + "'";
+    EXPECT_NE(std::string::npos, records.find(expected));
+}
+
 }  // namespace vibrator
 }  // namespace hardware
 }  // namespace android
@@ -19,6 +19,8 @@
 #include <gtest/gtest.h>
 
 #include <fstream>
+#include <thread>
+#include <vector>
 
 #include "Hardware.h"
 
@@ -388,6 +390,70 @@ TEST_F(HwCalTest, trimming) {
     EXPECT_EQ(lraPeriodExpect, lraPeriodActual);
 }
 
+TEST_F(HwCalTest, closeloop_capturedAtConstruction) {
+    std::string prefix{PROPERTY_PREFIX};
+    uint32_t expect = std::rand();
+    uint32_t actual = ~expect;
+
+    EXPECT_TRUE(SetProperty(prefix + "closeloop.threshold", std::to_string(expect)));
+
+    createHwCal();
+
+    EXPECT_TRUE(SetProperty(prefix + "closeloop.threshold", std::to_string(~expect)));
+
+    EXPECT_TRUE(mHwCal->getCloseLoopThreshold(&actual));
+    EXPECT_EQ(expect, actual);
+}
+
+TEST_F(HwCalTest, coeffs_repeated) {
+    std::array<float, 4> expect = {0.5f, -1.25f, 2.0f, 8.0f};
+    std::array<float, 4> actual = {};
+
+    write("haptic_coefficient", "0.5 -1.25 2 8");
+
+    createHwCal();
+
+    for (int i = 0; i < 2; i++) {
+        actual.fill(0.0f);
+        EXPECT_TRUE(mHwCal->getEffectCoeffs(&actual));
+        EXPECT_EQ(expect, actual);
+    }
+}
+
+TEST_F(HwCalTest, coeffs_invalidRepeated) {
+    std::array<float, 4> actual = {};
+
+    write("haptic_coefficient", "0.5 -1.25 2");
+
+    createHwCal();
+
+    EXPECT_FALSE(mHwCal->getEffectCoeffs(&actual));
+    EXPECT_FALSE(mHwCal->getEffectCoeffs(&actual));
+}
+
+TEST_F(HwCalTest, coeffs_concurrentLookups) {
+    std::array<float, 4> expect = {0.5f, -1.25f, 2.0f, 8.0f};
+    std::vector<std::thread> threads;
+
+    write("haptic_coefficient", "0.5 -1.25 2 8");
+
+    createHwCal();
+
+    // lookups only read what construction parsed, so they may race freely
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 100; i++) {
+                std::array<float, 4> actual = {};
+                EXPECT_TRUE(mHwCal->getEffectCoeffs(&actual));
+                EXPECT_EQ(expect, actual);
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
 }  // namespace vibrator
 }  // namespace hardware
 }  // namespace android
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <android-base/properties.h>
+#include <cutils/fs.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <future>
+
+#include "HapticCalibration.h"
+#include "Hardware.h"
+#include "PwlePlanner.h"
+#include "Vibrator.h"
+#include "mocks.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+using ::android::base::SetProperty;
+using ::testing::ElementsAre;
+using ::testing::Test;
+
+static constexpr uint32_t LRA_PERIOD = 262;
+static constexpr float RESONANT_FREQUENCY = 155.06f;
+
+static ActivePwle active(float startAmplitude, float startFrequency, float endAmplitude,
+                         float endFrequency, int32_t duration) {
+    return ActivePwle{
+            .startAmplitude = startAmplitude,
+            .startFrequency = startFrequency,
+            .endAmplitude = endAmplitude,
+            .endFrequency = endFrequency,
+            .duration = duration,
+    };
+}
+
+static BrakingPwle braking(Braking braking, int32_t duration) {
+    return BrakingPwle{.braking = braking, .duration = duration};
+}
+
+TEST(PwlePlannerTest, band) {
+    PwlePlanner planner(LRA_PERIOD);
+
+    EXPECT_NEAR(RESONANT_FREQUENCY, planner.resonantFrequency(), 0.01f);
+    EXPECT_NEAR(RESONANT_FREQUENCY - 50.0f, planner.frequencyMinimum(), 0.01f);
+    EXPECT_NEAR(RESONANT_FREQUENCY + 50.0f, planner.frequencyMaximum(), 0.01f);
+    EXPECT_EQ(101, planner.bandwidthAmplitudeMap().size());
+}
+
+TEST(PwlePlannerTest, plan_flatMerged) {
+    PwlePlanner planner(LRA_PERIOD);
+    std::vector<PwlePlanner::Segment> segments;
+    uint32_t durationMs;
+
+    ASSERT_TRUE(planner.plan({active(0.5f, 200.0f, 0.5f, 200.0f, 40)}, &segments, &durationMs));
+
+    ASSERT_EQ(1, segments.size());
+    EXPECT_EQ(0, segments[0].timeMs);
+    EXPECT_EQ(0.5f, segments[0].amplitude);
+    EXPECT_EQ(203, segments[0].olLraPeriod);
+    EXPECT_EQ(40, durationMs);
+}
+
+TEST(PwlePlannerTest, plan_rampSliced) {
+    PwlePlanner planner(LRA_PERIOD);
+    std::vector<PwlePlanner::Segment> segments;
+    std::vector<uint32_t> times;
+    std::vector<float> amplitudes;
+    uint32_t durationMs;
+
+    ASSERT_TRUE(planner.plan({active(0.0f, 150.0f, 1.0f, 150.0f, 18)}, &segments, &durationMs));
+
+    for (auto &segment : segments) {
+        times.push_back(segment.timeMs);
+        amplitudes.push_back(segment.amplitude);
+        EXPECT_EQ(HapticCalibration::frequencyToPeriod(150.0f), segment.olLraPeriod);
+    }
+    // slices hold their midpoint values, and the last slice is short
+    EXPECT_THAT(times, ElementsAre(0, 5, 10, 15));
+    EXPECT_THAT(amplitudes, ElementsAre(2.5f / 18, 7.5f / 18, 12.5f / 18, 16.5f / 18));
+    EXPECT_EQ(18, durationMs);
+}
+
+TEST(PwlePlannerTest, plan_frequencySweep) {
+    PwlePlanner planner(LRA_PERIOD);
+    std::vector<PwlePlanner::Segment> segments;
+    uint32_t durationMs;
+
+    ASSERT_TRUE(planner.plan({active(1.0f, 120.0f, 1.0f, 200.0f, 100)}, &segments, &durationMs));
+
+    ASSERT_EQ(20, segments.size());
+    for (size_t i = 1; i < segments.size(); i++) {
+        EXPECT_LT(segments[i].olLraPeriod, segments[i - 1].olLraPeriod);
+    }
+}
+
+TEST(PwlePlannerTest, plan_braking) {
+    PwlePlanner planner(LRA_PERIOD);
+    std::vector<PwlePlanner::Segment> segments;
+    uint32_t durationMs;
+
+    ASSERT_TRUE(planner.plan(
+            {
+                    active(1.0f, 150.0f, 1.0f, 150.0f, 10),
+                    braking(Braking::NONE, 20),
+                    active(0.5f, 150.0f, 0.5f, 150.0f, 10),
+            },
+            &segments, &durationMs));
+
+    ASSERT_EQ(3, segments.size());
+    EXPECT_EQ(10, segments[1].timeMs);
+    EXPECT_EQ(0.0f, segments[1].amplitude);
+    EXPECT_EQ(LRA_PERIOD, segments[1].olLraPeriod);
+    EXPECT_EQ(30, segments[2].timeMs);
+    EXPECT_EQ(40, durationMs);
+}
+
+TEST(PwlePlannerTest, plan_invalid) {
+    PwlePlanner planner(LRA_PERIOD);
+    std::vector<PwlePlanner::Segment> segments;
+    uint32_t durationMs;
+    std::vector<std::vector<PrimitivePwle>> invalid = {
+            {},
+            std::vector<PrimitivePwle>(PwlePlanner::COMPOSITION_SIZE_MAX + 1,
+                                       active(1.0f, 150.0f, 1.0f, 150.0f, 10)),
+            {active(1.5f, 150.0f, 1.0f, 150.0f, 10)},
+            {active(1.0f, 150.0f, -0.5f, 150.0f, 10)},
+            {active(1.0f, 50.0f, 1.0f, 150.0f, 10)},
+            {active(1.0f, 150.0f, 1.0f, 250.0f, 10)},
+            {active(NAN, 150.0f, 1.0f, 150.0f, 10)},
+            {active(1.0f, 150.0f, 1.0f, NAN, 10)},
+            {active(1.0f, 150.0f, 1.0f, 150.0f, PwlePlanner::PRIMITIVE_DURATION_MAX_MS + 1)},
+            {active(1.0f, 150.0f, 1.0f, 150.0f, 0)},
+            {braking(Braking::CLAB, 10)},
+    };
+
+    for (auto &composite : invalid) {
+        EXPECT_FALSE(planner.plan(composite, &segments, &durationMs));
+    }
+}
+
+// Plays compositions through the real HwApi into regular files standing in
+// for the driver's sysfs nodes.
+class PwleSysfsTest : public Test {
+  protected:
+    static constexpr const char *FILE_NAMES[]{
+        "device/autocal",
+        "device/ol_lra_period",
+        "activate",
+        "duration",
+        "state",
+        "device/rtp_input",
+        "device/mode",
+        "device/set_sequencer",
+        "device/scale",
+        "device/ctrl_loop",
+        "device/lp_trigger_effect",
+        "device/lra_wave_shape",
+        "device/od_clamp",
+    };
+    static constexpr char PROPERTY_PREFIX[] = "test.vibrator.hal.";
+
+  public:
+    void SetUp() override {
+        for (auto n : FILE_NAMES) {
+            auto path = std::filesystem::path(mFilesDir.path) / n;
+            fs_mkdirs(path.c_str(), S_IRWXU);
+            std::ofstream touch{path};
+        }
+        std::ofstream{mCalFile.path} << "lra_period: " << LRA_PERIOD << std::endl;
+
+        setenv("HWAPI_PATH_PREFIX", (std::filesystem::path(mFilesDir.path) / "").c_str(), true);
+        setenv("PROPERTY_PREFIX", PROPERTY_PREFIX, true);
+        setenv("CALIBRATION_FILEPATH", mCalFile.path, true);
+        SetProperty(std::string(PROPERTY_PREFIX) + "config.dynamic", "0");
+
+        mVibrator = ndk::SharedRefBase::make<Vibrator>(HwApi::Create(), std::make_unique<HwCal>());
+    }
+
+  protected:
+    // Returns every value written to the node since the test started.
+    std::vector<std::string> written(const std::string &name) {
+        std::ifstream file{std::filesystem::path(mFilesDir.path) / name};
+        std::vector<std::string> lines;
+        for (std::string line; std::getline(file, line);) {
+            lines.push_back(line);
+        }
+        return lines;
+    }
+
+    void play(const std::vector<PrimitivePwle> &composite) {
+        auto callback = ndk::SharedRefBase::make<MockVibratorCallback>();
+        std::promise<void> completed;
+
+        EXPECT_CALL(*callback, onComplete()).WillOnce([&completed] {
+            completed.set_value();
+            return ndk::ScopedAStatus::ok();
+        });
+
+        ASSERT_EQ(EX_NONE, mVibrator->composePwle(composite, callback).getExceptionCode());
+        ASSERT_EQ(std::future_status::ready,
+                  completed.get_future().wait_for(std::chrono::seconds(2)));
+    }
+
+  protected:
+    TemporaryDir mFilesDir;
+    TemporaryFile mCalFile;
+    std::shared_ptr<IVibrator> mVibrator;
+};
+
+TEST_F(PwleSysfsTest, capabilities) {
+    int32_t capabilities;
+    float resonantFreqHz;
+    std::vector<Braking> braking;
+
+    EXPECT_TRUE(mVibrator->getCapabilities(&capabilities).isOk());
+    EXPECT_GT(capabilities & IVibrator::CAP_COMPOSE_PWLE_EFFECTS, 0);
+    EXPECT_GT(capabilities & IVibrator::CAP_FREQUENCY_CONTROL, 0);
+    EXPECT_GT(capabilities & IVibrator::CAP_GET_RESONANT_FREQUENCY, 0);
+
+    EXPECT_TRUE(mVibrator->getResonantFrequency(&resonantFreqHz).isOk());
+    EXPECT_NEAR(RESONANT_FREQUENCY, resonantFreqHz, 0.01f);
+    EXPECT_TRUE(mVibrator->getSupportedBraking(&braking).isOk());
+    EXPECT_THAT(braking, ElementsAre(Braking::NONE));
+}
+
+TEST_F(PwleSysfsTest, composePwle_writes) {
+    play({
+            active(0.0f, 150.0f, 1.0f, 150.0f, 20),
+            braking(Braking::NONE, 10),
+            active(0.5f, 200.0f, 0.5f, 200.0f, 10),
+    });
+
+    EXPECT_THAT(written("device/rtp_input"), ElementsAre("16", "48", "79", "111", "0", "64"));
+    EXPECT_THAT(written("device/ol_lra_period"), ElementsAre("262", "271", "262", "203"));
+    EXPECT_THAT(written("device/mode"), ElementsAre("rtp"));
+    EXPECT_THAT(written("duration"), ElementsAre("40"));
+    EXPECT_THAT(written("activate"), ElementsAre("1"));
+}
+
+TEST_F(PwleSysfsTest, composePwle_restoresLraPeriod) {
+    play({active(0.5f, 200.0f, 0.5f, 200.0f, 10)});
+    EXPECT_EQ(EX_NONE, mVibrator->on(10, nullptr).getExceptionCode());
+
+    // without a dynamic config, on() relies on the calibrated period
+    EXPECT_THAT(written("device/ol_lra_period"), ElementsAre("262", "203", "262"));
+}
+
+TEST_F(PwleSysfsTest, composePwle_invalid) {
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT,
+              mVibrator->composePwle({braking(Braking::CLAB, 10)}, nullptr).getExceptionCode());
+    EXPECT_THAT(written("activate"), ElementsAre());
+}
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <future>
+
+#include "Hardware.h"
+#include "SysfsSimulator.h"
+#include "Vibrator.h"
+#include "mocks.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+using ::testing::Test;
+
+using Clock = SysfsSimulator::Clock;
+
+// Runs the real HwApi against simulated attributes, to cover what mocks cannot:
+// polling, auto-clear and how many writes reach the device.
+class SimulatorTest : public Test {
+  protected:
+    static constexpr const char *FILE_NAMES[]{
+        "device/autocal",
+        "device/ol_lra_period",
+        "activate",
+        "duration",
+        "state",
+        "device/rtp_input",
+        "device/mode",
+        "device/set_sequencer",
+        "device/scale",
+        "device/ctrl_loop",
+        "device/lp_trigger_effect",
+        "device/lra_wave_shape",
+        "device/od_clamp",
+    };
+
+  public:
+    void SetUp() override {
+        std::map<std::string, std::string> attributes;
+
+        for (auto n : FILE_NAMES) {
+            attributes[n] = "";
+        }
+        attributes["activate"] = "0";
+
+        mSimulator = std::make_unique<SysfsSimulator>(attributes);
+        mSimulator->modelActivate();
+
+        setenv("HWAPI_PATH_PREFIX", mSimulator->prefix().c_str(), true);
+        mHwApi = HwApi::Create();
+        mHwApi->openDeferred();
+    }
+
+    void TearDown() override {
+        mHwApi.reset();
+        mSimulator.reset();
+    }
+
+  protected:
+    std::unique_ptr<SysfsSimulator> mSimulator;
+    std::unique_ptr<Vibrator::HwApi> mHwApi;
+};
+
+TEST_F(SimulatorTest, pollActivate_autoClear) {
+    auto durationMs = 50;
+
+    EXPECT_TRUE(mHwApi->setDuration(durationMs));
+    auto start = Clock::now();
+    EXPECT_TRUE(mHwApi->setActivate(true));
+
+    EXPECT_TRUE(mHwApi->pollActivate(false, 1000));
+    auto elapsed = Clock::now() - start;
+
+    EXPECT_GE(elapsed, std::chrono::milliseconds(durationMs));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(500));
+    EXPECT_EQ("0", mSimulator->load("activate"));
+}
+
+TEST_F(SimulatorTest, pollActivate_timeout) {
+    EXPECT_TRUE(mHwApi->setDuration(1000));
+    EXPECT_TRUE(mHwApi->setActivate(true));
+
+    EXPECT_FALSE(mHwApi->pollActivate(false, 20));
+    EXPECT_EQ("1", mSimulator->load("activate"));
+}
+
+TEST_F(SimulatorTest, deactivateCancelsAutoClear) {
+    EXPECT_TRUE(mHwApi->setDuration(20));
+    EXPECT_TRUE(mHwApi->setActivate(true));
+    EXPECT_TRUE(mHwApi->setActivate(false));
+    EXPECT_TRUE(mHwApi->setDuration(1000));
+    EXPECT_TRUE(mHwApi->setActivate(true));
+
+    // the first activation would have been cleared by now
+    EXPECT_FALSE(mHwApi->pollActivate(false, 100));
+    EXPECT_EQ("1", mSimulator->load("activate"));
+}
+
+TEST_F(SimulatorTest, writes) {
+    uint32_t count = std::rand() % 16 + 1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        EXPECT_TRUE(mHwApi->setScale(i));
+    }
+
+    EXPECT_EQ(count, mSimulator->writes("device/scale"));
+    EXPECT_EQ(0, mSimulator->writes("device/mode"));
+    EXPECT_EQ(std::to_string(count - 1), mSimulator->load("device/scale"));
+}
+
+TEST_F(SimulatorTest, writeLatency) {
+    static constexpr auto LATENCY = std::chrono::milliseconds(10);
+    static constexpr uint32_t COUNT = 3;
+    std::vector<Clock::time_point> completions;
+    std::promise<void> done;
+
+    mSimulator->setWriteLatency(LATENCY);
+    mSimulator->onWrite("device/scale", [&](const std::string &value) {
+        completions.push_back(Clock::now());
+        if (completions.size() == COUNT) {
+            done.set_value();
+        }
+    });
+
+    auto start = Clock::now();
+    for (uint32_t i = 0; i < COUNT; i++) {
+        EXPECT_TRUE(mHwApi->setScale(i));
+    }
+    // writers are not held up, the device works through them in order
+    EXPECT_LT(Clock::now() - start, LATENCY);
+
+    ASSERT_EQ(std::future_status::ready, done.get_future().wait_for(std::chrono::seconds(1)));
+    for (uint32_t i = 0; i < COUNT; i++) {
+        EXPECT_GE(completions[i] - start, LATENCY * (i + 1));
+    }
+    EXPECT_EQ(LATENCY * COUNT, mSimulator->busTime());
+}
+
+TEST_F(SimulatorTest, vibratorOnCompletes) {
+    TemporaryFile calFile;
+    auto callback = ndk::SharedRefBase::make<MockVibratorCallback>();
+    std::promise<Clock::time_point> completed;
+    auto durationMs = 30;
+
+    setenv("CALIBRATION_FILEPATH", calFile.path, true);
+    // the Vibrator opens the deferred attributes itself
+    mHwApi.reset();
+    auto vibrator = ndk::SharedRefBase::make<Vibrator>(HwApi::Create(), std::make_unique<HwCal>());
+    vibrator->waitReady();
+
+    EXPECT_CALL(*callback, onComplete()).WillOnce([&completed] {
+        completed.set_value(Clock::now());
+        return ndk::ScopedAStatus::ok();
+    });
+
+    auto start = Clock::now();
+    EXPECT_EQ(EX_NONE, vibrator->on(durationMs, callback).getExceptionCode());
+
+    auto future = completed.get_future();
+    ASSERT_EQ(std::future_status::ready, future.wait_for(std::chrono::seconds(1)));
+    // completed by the driver clearing activate
+    EXPECT_GE(future.get() - start, std::chrono::milliseconds(durationMs));
+    EXPECT_EQ("0", mSimulator->load("activate"));
+    EXPECT_EQ(durationMs, std::stoi(mSimulator->load("duration")));
+}
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
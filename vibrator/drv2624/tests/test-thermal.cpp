@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <thread>
+
+#include "ThermalWatcher.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace vibrator {
+
+using ::testing::Test;
+
+using State = ThermalWatcher::State;
+
+static constexpr int32_t LOWER_BOUND = 5000;
+static constexpr int32_t UPPER_BOUND = 10000;
+
+// Stands in for the thermal zone with a regular file holding the temperature
+// in millidegrees Celsius.
+class ThermalWatcherTest : public Test {
+  protected:
+    void setTemp(const std::string &value) {
+        std::ofstream(mTempFile.path, std::ios::trunc) << value << std::endl;
+    }
+
+    std::unique_ptr<ThermalWatcher> createWatcher(std::chrono::milliseconds period) {
+        return std::make_unique<ThermalWatcher>(
+                [this](int32_t *value) {
+                    mReads++;
+                    std::ifstream stream{mTempFile.path};
+                    return !!(stream >> *value);
+                },
+                LOWER_BOUND, UPPER_BOUND, period);
+    }
+
+  protected:
+    TemporaryFile mTempFile;
+    std::atomic<uint32_t> mReads{0};
+};
+
+TEST_F(ThermalWatcherTest, initialSample) {
+    setTemp("20000");
+
+    auto watcher = createWatcher(std::chrono::hours(1));
+
+    EXPECT_EQ(1, mReads);
+    EXPECT_EQ(State::HOT, watcher->state());
+    EXPECT_EQ(20000, watcher->temperature());
+}
+
+TEST_F(ThermalWatcherTest, refreshTransitions) {
+    const std::vector<std::pair<int32_t, State>> steps = {
+            {7500, State::NORMAL},           {LOWER_BOUND - 1, State::COLD},
+            {LOWER_BOUND, State::NORMAL},    {UPPER_BOUND, State::NORMAL},
+            {UPPER_BOUND + 1, State::HOT},   {-2000, State::COLD},
+            {UPPER_BOUND + 500, State::HOT},
+    };
+
+    setTemp("7500");
+    auto watcher = createWatcher(std::chrono::hours(1));
+
+    for (auto &[temp, state] : steps) {
+        setTemp(std::to_string(temp));
+        watcher->refresh();
+        EXPECT_EQ(state, watcher->state()) << temp;
+        EXPECT_EQ(temp, watcher->temperature());
+    }
+
+    EXPECT_EQ(1 + steps.size(), mReads);
+}
+
+TEST_F(ThermalWatcherTest, readFailureKeepsState) {
+    setTemp("0");
+    auto watcher = createWatcher(std::chrono::hours(1));
+
+    setTemp("garbage");
+    watcher->refresh();
+
+    EXPECT_EQ(State::COLD, watcher->state());
+    EXPECT_EQ(0, watcher->temperature());
+}
+
+TEST_F(ThermalWatcherTest, periodicSample) {
+    setTemp("7500");
+    auto watcher = createWatcher(std::chrono::milliseconds(1));
+
+    setTemp("30000");
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (watcher->state() != State::HOT && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    EXPECT_EQ(State::HOT, watcher->state());
+    EXPECT_EQ(30000, watcher->temperature());
+}
+
+}  // namespace vibrator
+}  // namespace hardware
+}  // namespace android
+}  // namespace aidl
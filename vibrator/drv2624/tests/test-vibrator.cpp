@@ -14,10 +14,17 @@
  * limitations under the License.
  */
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <poll.h>
 
+#include <cmath>
+#include <future>
+#include <thread>
+
+#include "HapticCalibration.h"
 #include "Vibrator.h"
 #include "mocks.h"
 #include "types.h"
@@ -37,6 +44,8 @@ using ::testing::DoAll;
 using ::testing::DoDefault;
 using ::testing::Exactly;
 using ::testing::ExpectationSet;
+using ::testing::Ge;
+using ::testing::InvokeWithoutArgs;
 using ::testing::Mock;
 using ::testing::Return;
 using ::testing::Sequence;
@@ -44,6 +53,7 @@ using ::testing::SetArgPointee;
 using ::testing::SetArgReferee;
 using ::testing::Test;
 using ::testing::TestParamInfo;
+using ::testing::UnorderedElementsAre;
 using ::testing::ValuesIn;
 using ::testing::WithParamInterface;
 
@@ -135,8 +145,11 @@ class VibratorTestTemplate : public Test, public WithParamInterface<std::tuple<b
         ON_CALL(*mMockApi, destructor()).WillByDefault(Assign(&mMockApi, nullptr));
         ON_CALL(*mMockApi, setOlLraPeriod(_)).WillByDefault(Return(true));
         ON_CALL(*mMockApi, setActivate(_)).WillByDefault(Return(true));
+        ON_CALL(*mMockApi, pollActivate(_, _, _)).WillByDefault(Return(true));
         ON_CALL(*mMockApi, setDuration(_)).WillByDefault(Return(true));
         ON_CALL(*mMockApi, setMode(_)).WillByDefault(Return(true));
+        ON_CALL(*mMockApi, setSequencer(_)).WillByDefault(Return(true));
+        ON_CALL(*mMockApi, setScale(_)).WillByDefault(Return(true));
         ON_CALL(*mMockApi, setCtrlLoop(_)).WillByDefault(Return(true));
         ON_CALL(*mMockApi, setLraWaveShape(_)).WillByDefault(Return(true));
         ON_CALL(*mMockApi, setOdClamp(_)).WillByDefault(Return(true));
@@ -168,16 +181,36 @@ class VibratorTestTemplate : public Test, public WithParamInterface<std::tuple<b
         ON_CALL(*mMockCal, getHeavyClickDuration(_))
             .WillByDefault(
                 DoAll(SetArgPointee<0>(mEffectDurations[Effect::HEAVY_CLICK]), Return(true)));
+        ON_CALL(*mMockCal, getTriggerEffectSupport(_))
+            .WillByDefault(DoAll(SetArgPointee<0>(1), Return(true)));
 
         relaxMock(false);
     }
 
+    // Recreates the vibrator with effect durations short enough to be played
+    // out in real time.
+    void shortenEffectDurations() {
+        std::unique_ptr<MockApi> mockapi;
+        std::unique_ptr<MockCal> mockcal;
+
+        deleteVibrator();
+
+        for (auto &duration : mEffectDurations) {
+            duration.second = 1 + std::rand() % 10;
+        }
+        mEffectDurations[Effect::TEXTURE_TICK] = mEffectDurations[Effect::TICK];
+
+        createMock(&mockapi, &mockcal);
+        createVibrator(std::move(mockapi), std::move(mockcal));
+    }
+
     void createVibrator(std::unique_ptr<MockApi> mockapi, std::unique_ptr<MockCal> mockcal,
                         bool relaxed = true) {
         if (relaxed) {
             relaxMock(true);
         }
         mVibrator = ndk::SharedRefBase::make<Vibrator>(std::move(mockapi), std::move(mockcal));
+        std::static_pointer_cast<Vibrator>(mVibrator)->waitReady();
         if (relaxed) {
             relaxMock(false);
         }
@@ -197,13 +230,17 @@ class VibratorTestTemplate : public Test, public WithParamInterface<std::tuple<b
         Mock::VerifyAndClearExpectations(mMockCal);
 
         EXPECT_CALL(*mMockApi, destructor()).Times(times);
+        EXPECT_CALL(*mMockApi, openDeferred()).Times(times);
         EXPECT_CALL(*mMockApi, setAutocal(_)).Times(times);
         EXPECT_CALL(*mMockApi, setOlLraPeriod(_)).Times(times);
         EXPECT_CALL(*mMockApi, setActivate(_)).Times(times);
+        EXPECT_CALL(*mMockApi, pollActivate(_, _, _)).Times(times);
         EXPECT_CALL(*mMockApi, setDuration(_)).Times(times);
         EXPECT_CALL(*mMockApi, setState(_)).Times(times);
         EXPECT_CALL(*mMockApi, hasRtpInput()).Times(times);
         EXPECT_CALL(*mMockApi, setRtpInput(_)).Times(times);
+        EXPECT_CALL(*mMockApi, streamRtpInput(_)).Times(times);
+        EXPECT_CALL(*mMockApi, streamOlLraPeriod(_)).Times(times);
         EXPECT_CALL(*mMockApi, setMode(_)).Times(times);
         EXPECT_CALL(*mMockApi, setSequencer(_)).Times(times);
         EXPECT_CALL(*mMockApi, setScale(_)).Times(times);
@@ -211,7 +248,10 @@ class VibratorTestTemplate : public Test, public WithParamInterface<std::tuple<b
         EXPECT_CALL(*mMockApi, setLpTriggerEffect(_)).Times(times);
         EXPECT_CALL(*mMockApi, setLraWaveShape(_)).Times(times);
         EXPECT_CALL(*mMockApi, setOdClamp(_)).Times(times);
+        // sampled from the thermal watcher thread, whenever it wakes up
+        EXPECT_CALL(*mMockApi, getUsbTemp(_)).Times(AnyNumber());
         EXPECT_CALL(*mMockApi, debug(_)).Times(times);
+        EXPECT_CALL(*mMockApi, resetLatencies()).Times(times);
 
         EXPECT_CALL(*mMockCal, destructor()).Times(times);
         EXPECT_CALL(*mMockCal, getAutocal(_)).Times(times);
@@ -225,6 +265,7 @@ class VibratorTestTemplate : public Test, public WithParamInterface<std::tuple<b
         EXPECT_CALL(*mMockCal, getTickDuration(_)).Times(times);
         EXPECT_CALL(*mMockCal, getDoubleClickDuration(_)).Times(times);
         EXPECT_CALL(*mMockCal, getHeavyClickDuration(_)).Times(times);
+        EXPECT_CALL(*mMockCal, getTriggerEffectSupport(_)).Times(times);
         EXPECT_CALL(*mMockCal, debug(_)).Times(times);
     }
 
@@ -258,6 +299,7 @@ TEST_P(BasicTest, Constructor) {
 
     createMock(&mockapi, &mockcal);
 
+    EXPECT_CALL(*mMockApi, openDeferred()).InSequence(autocalSeq, lraPeriodSeq);
     EXPECT_CALL(*mMockApi, setState(true)).WillOnce(Return(true));
 
     EXPECT_CALL(*mMockCal, getAutocal(_))
@@ -274,6 +316,7 @@ TEST_P(BasicTest, Constructor) {
         EXPECT_CALL(*mMockCal, getLongFrequencyShift(_)).WillOnce(DoDefault());
         EXPECT_CALL(*mMockCal, getShortVoltageMax(_)).WillOnce(DoDefault());
         EXPECT_CALL(*mMockCal, getLongVoltageMax(_)).WillOnce(DoDefault());
+        EXPECT_CALL(*mMockApi, getUsbTemp(_)).WillOnce(DoDefault());
     } else {
         EXPECT_CALL(*mMockApi, setOlLraPeriod(mShortLraPeriod))
             .InSequence(lraPeriodSeq)
@@ -285,11 +328,39 @@ TEST_P(BasicTest, Constructor) {
     EXPECT_CALL(*mMockCal, getDoubleClickDuration(_)).WillOnce(DoDefault());
     EXPECT_CALL(*mMockCal, getHeavyClickDuration(_)).WillOnce(DoDefault());
 
+    EXPECT_CALL(*mMockCal, getTriggerEffectSupport(_)).WillOnce(DoDefault());
     EXPECT_CALL(*mMockApi, setLpTriggerEffect(1)).WillOnce(Return(true));
 
     createVibrator(std::move(mockapi), std::move(mockcal), false);
 }
 
+TEST_P(BasicTest, apiWaitsForInit) {
+    std::unique_ptr<MockApi> mockapi;
+    std::unique_ptr<MockCal> mockcal;
+    std::promise<void> release;
+    auto released = release.get_future();
+
+    deleteVibrator();
+    createMock(&mockapi, &mockcal);
+
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, openDeferred()).WillOnce([&released] { released.wait(); });
+
+    mVibrator = ndk::SharedRefBase::make<Vibrator>(std::move(mockapi), std::move(mockcal));
+
+    auto capabilities = std::async(std::launch::async, [this] {
+        int32_t value = 0;
+        mVibrator->getCapabilities(&value);
+        return value;
+    });
+
+    EXPECT_EQ(std::future_status::timeout, capabilities.wait_for(std::chrono::milliseconds(50)));
+    release.set_value();
+    ASSERT_EQ(std::future_status::ready, capabilities.wait_for(std::chrono::seconds(1)));
+    EXPECT_TRUE(capabilities.get() & IVibrator::CAP_ALWAYS_ON_CONTROL);
+}
+
 TEST_P(BasicTest, on) {
     EffectDuration duration = std::rand();
     ExpectationSet e;
@@ -329,12 +400,577 @@ TEST_P(BasicTest, on_closeLoop) {
     EXPECT_EQ(EX_NONE, mVibrator->on(duration, nullptr).getExceptionCode());
 }
 
+TEST_P(BasicTest, on_usbTempHot) {
+    std::unique_ptr<MockApi> mockapi;
+    std::unique_ptr<MockCal> mockcal;
+
+    if (!getDynamicConfig()) {
+        GTEST_SKIP();
+    }
+
+    deleteVibrator();
+    createMock(&mockapi, &mockcal);
+    ON_CALL(*mMockApi, getUsbTemp(_)).WillByDefault(DoAll(SetArgPointee<0>(20000), Return(true)));
+    createVibrator(std::move(mockapi), std::move(mockcal));
+
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, getUsbTemp(_)).Times(0);
+    EXPECT_CALL(*mMockApi, setOdClamp(mLongVoltageMax)).WillOnce(DoDefault());
+    EXPECT_CALL(*mMockApi, setOlLraPeriod(mShortLraPeriod)).WillOnce(DoDefault());
+
+    EXPECT_EQ(EX_NONE, mVibrator->on(std::rand(), nullptr).getExceptionCode());
+}
+
+TEST_P(BasicTest, on_usbTempCold) {
+    std::unique_ptr<MockApi> mockapi;
+    std::unique_ptr<MockCal> mockcal;
+
+    if (!getDynamicConfig()) {
+        GTEST_SKIP();
+    }
+
+    deleteVibrator();
+    createMock(&mockapi, &mockcal);
+    ON_CALL(*mMockApi, getUsbTemp(_)).WillByDefault(DoAll(SetArgPointee<0>(0), Return(true)));
+    createVibrator(std::move(mockapi), std::move(mockcal));
+
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, getUsbTemp(_)).Times(0);
+    EXPECT_CALL(*mMockApi, setOdClamp(90)).WillOnce(DoDefault());
+    EXPECT_CALL(*mMockApi, setOlLraPeriod(mLongLraPeriod)).WillOnce(DoDefault());
+
+    EXPECT_EQ(EX_NONE, mVibrator->on(std::rand(), nullptr).getExceptionCode());
+}
+
+TEST_P(BasicTest, on_callback) {
+    EffectDuration duration = std::rand() % 1000;
+    auto callback = ndk::SharedRefBase::make<MockVibratorCallback>();
+    std::promise<void> completed;
+
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, pollActivate(false, Ge(duration), _)).WillOnce(Return(true));
+    EXPECT_CALL(*callback, onComplete()).WillOnce([&completed] {
+        completed.set_value();
+        return ndk::ScopedAStatus::ok();
+    });
+
+    EXPECT_EQ(EX_NONE, mVibrator->on(duration, callback).getExceptionCode());
+    EXPECT_EQ(std::future_status::ready,
+              completed.get_future().wait_for(std::chrono::seconds(1)));
+}
+
+TEST_P(BasicTest, on_callbackTimeout) {
+    EffectDuration duration = std::rand() % 1000;
+    auto callback = ndk::SharedRefBase::make<MockVibratorCallback>();
+    std::promise<void> completed;
+
+    relaxMock(true);
+
+    // the driver never reports completion, so the duration-based timeout does
+    EXPECT_CALL(*mMockApi, pollActivate(false, Ge(duration), _)).WillOnce(Return(false));
+    EXPECT_CALL(*callback, onComplete()).WillOnce([&completed] {
+        completed.set_value();
+        return ndk::ScopedAStatus::ok();
+    });
+
+    EXPECT_EQ(EX_NONE, mVibrator->on(duration, callback).getExceptionCode());
+    EXPECT_EQ(std::future_status::ready,
+              completed.get_future().wait_for(std::chrono::seconds(1)));
+}
+
+TEST_P(BasicTest, perform_callback) {
+    auto callback = ndk::SharedRefBase::make<MockVibratorCallback>();
+    std::promise<void> completed;
+    int32_t lengthMs;
+
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, pollActivate(false, Ge(mEffectDurations[Effect::CLICK]), _))
+        .WillOnce(Return(true));
+    EXPECT_CALL(*callback, onComplete()).WillOnce([&completed] {
+        completed.set_value();
+        return ndk::ScopedAStatus::ok();
+    });
+
+    EXPECT_EQ(EX_NONE,
+              mVibrator->perform(Effect::CLICK, EffectStrength::MEDIUM, callback, &lengthMs)
+                  .getExceptionCode());
+    EXPECT_EQ(std::future_status::ready,
+              completed.get_future().wait_for(std::chrono::seconds(1)));
+}
+
+// Stands in for a driver that keeps the vibration running until the HAL ends it.
+static bool pollUntilWoken(bool /*value*/, int32_t timeoutMs, int wakeFd) {
+    pollfd wake{.fd = wakeFd, .events = POLLIN};
+    poll(&wake, 1, timeoutMs);
+    return false;
+}
+
+TEST_P(BasicTest, on_offCompletesPromptly) {
+    auto callback = ndk::SharedRefBase::make<MockVibratorCallback>();
+    std::promise<void> completed;
+
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, pollActivate(false, Ge(10000), Ge(0))).WillOnce(pollUntilWoken);
+    EXPECT_CALL(*callback, onComplete()).WillOnce([&completed] {
+        completed.set_value();
+        return ndk::ScopedAStatus::ok();
+    });
+
+    EXPECT_EQ(EX_NONE, mVibrator->on(10000, callback).getExceptionCode());
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(EX_NONE, mVibrator->off().getExceptionCode());
+    EXPECT_EQ(std::future_status::ready,
+              completed.get_future().wait_for(std::chrono::milliseconds(100)));
+}
+
+TEST_P(BasicTest, on_replacedCompletesPromptly) {
+    auto first = ndk::SharedRefBase::make<MockVibratorCallback>();
+    auto second = ndk::SharedRefBase::make<MockVibratorCallback>();
+    std::promise<void> completed;
+
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, pollActivate(false, Ge(10000), Ge(0)))
+        .WillRepeatedly(pollUntilWoken);
+    EXPECT_CALL(*first, onComplete()).WillOnce([&completed] {
+        completed.set_value();
+        return ndk::ScopedAStatus::ok();
+    });
+    // completed when the vibrator is torn down
+    EXPECT_CALL(*second, onComplete()).WillOnce([] { return ndk::ScopedAStatus::ok(); });
+
+    EXPECT_EQ(EX_NONE, mVibrator->on(10000, first).getExceptionCode());
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(EX_NONE, mVibrator->on(10000, second).getExceptionCode());
+    EXPECT_EQ(std::future_status::ready,
+              completed.get_future().wait_for(std::chrono::milliseconds(100)));
+}
+
+TEST_P(BasicTest, supportsCallbacks) {
+    int32_t capabilities;
+
+    relaxMock(true);
+
+    EXPECT_TRUE(mVibrator->getCapabilities(&capabilities).isOk());
+    EXPECT_GT(capabilities & IVibrator::CAP_ON_CALLBACK, 0);
+    EXPECT_GT(capabilities & IVibrator::CAP_PERFORM_CALLBACK, 0);
+}
+
+TEST_P(BasicTest, supportsCompose) {
+    int32_t capabilities;
+    int32_t maxDelayMs;
+    int32_t maxSize;
+    std::vector<CompositePrimitive> supported;
+
+    relaxMock(true);
+
+    EXPECT_TRUE(mVibrator->getCapabilities(&capabilities).isOk());
+    EXPECT_GT(capabilities & IVibrator::CAP_COMPOSE_EFFECTS, 0);
+    EXPECT_TRUE(mVibrator->getCompositionDelayMax(&maxDelayMs).isOk());
+    EXPECT_GT(maxDelayMs, 0);
+    EXPECT_TRUE(mVibrator->getCompositionSizeMax(&maxSize).isOk());
+    EXPECT_GT(maxSize, 0);
+    EXPECT_TRUE(mVibrator->getSupportedPrimitives(&supported).isOk());
+    EXPECT_THAT(supported,
+                UnorderedElementsAre(CompositePrimitive::NOOP, CompositePrimitive::CLICK,
+                                     CompositePrimitive::LIGHT_TICK));
+}
+
+TEST_P(BasicTest, getPrimitiveDuration) {
+    int32_t durationMs;
+
+    EXPECT_TRUE(mVibrator->getPrimitiveDuration(CompositePrimitive::CLICK, &durationMs).isOk());
+    EXPECT_EQ(mEffectDurations[Effect::CLICK], durationMs);
+    EXPECT_TRUE(
+        mVibrator->getPrimitiveDuration(CompositePrimitive::LIGHT_TICK, &durationMs).isOk());
+    EXPECT_EQ(mEffectDurations[Effect::TICK], durationMs);
+    EXPECT_TRUE(mVibrator->getPrimitiveDuration(CompositePrimitive::NOOP, &durationMs).isOk());
+    EXPECT_EQ(0, durationMs);
+    EXPECT_EQ(EX_UNSUPPORTED_OPERATION,
+              mVibrator->getPrimitiveDuration(CompositePrimitive::THUD, &durationMs)
+                  .getExceptionCode());
+}
+
+TEST_P(BasicTest, compose_mergedSlots) {
+    auto callback = ndk::SharedRefBase::make<MockVibratorCallback>();
+    std::promise<void> completed;
+    ExpectationSet e;
+
+    shortenEffectDurations();
+    relaxMock(true);
+
+    e += EXPECT_CALL(*mMockApi, setSequencer("1 0 2 0 1 0")).WillOnce(Return(true));
+    e += EXPECT_CALL(*mMockApi, setScale(0)).WillOnce(Return(true));
+    e += EXPECT_CALL(*mMockApi, setMode("waveform")).WillOnce(Return(true));
+    e += EXPECT_CALL(*mMockApi, setDuration(2 * mEffectDurations[Effect::CLICK] +
+                                            mEffectDurations[Effect::TICK]))
+             .WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setActivate(true)).After(e).WillOnce(Return(true));
+    EXPECT_CALL(*callback, onComplete()).WillOnce([&completed] {
+        completed.set_value();
+        return ndk::ScopedAStatus::ok();
+    });
+
+    EXPECT_EQ(EX_NONE, mVibrator
+                           ->compose(
+                               {
+                                   {0, CompositePrimitive::CLICK, 1.0f},
+                                   {0, CompositePrimitive::LIGHT_TICK, 1.0f},
+                                   {0, CompositePrimitive::CLICK, 1.0f},
+                               },
+                               callback)
+                           .getExceptionCode());
+    EXPECT_EQ(std::future_status::ready,
+              completed.get_future().wait_for(std::chrono::seconds(1)));
+}
+
+TEST_P(BasicTest, compose_delayedSteps) {
+    auto callback = ndk::SharedRefBase::make<MockVibratorCallback>();
+    std::promise<void> completed;
+    int32_t delayMs = 1 + std::rand() % 20;
+    std::chrono::steady_clock::time_point start, activated;
+    Sequence s;
+
+    shortenEffectDurations();
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, setSequencer("1 0")).InSequence(s).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setActivate(true)).InSequence(s).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setSequencer("2 0")).InSequence(s).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setActivate(true)).InSequence(s).WillOnce([&activated] {
+        activated = std::chrono::steady_clock::now();
+        return true;
+    });
+    EXPECT_CALL(*callback, onComplete()).WillOnce([&completed] {
+        completed.set_value();
+        return ndk::ScopedAStatus::ok();
+    });
+
+    start = std::chrono::steady_clock::now();
+    EXPECT_EQ(EX_NONE, mVibrator
+                           ->compose(
+                               {
+                                   {0, CompositePrimitive::CLICK, 1.0f},
+                                   {delayMs, CompositePrimitive::LIGHT_TICK, 1.0f},
+                               },
+                               callback)
+                           .getExceptionCode());
+    ASSERT_EQ(std::future_status::ready,
+              completed.get_future().wait_for(std::chrono::seconds(1)));
+    EXPECT_GE(activated - start,
+              std::chrono::milliseconds(mEffectDurations[Effect::CLICK] + delayMs));
+}
+
+TEST_P(BasicTest, compose_offCompletesPromptly) {
+    auto callback = ndk::SharedRefBase::make<MockVibratorCallback>();
+    std::promise<void> started, completed;
+
+    shortenEffectDurations();
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, setActivate(true)).WillOnce([&started] {
+        started.set_value();
+        return true;
+    });
+    EXPECT_CALL(*mMockApi, pollActivate(false, _, Ge(0))).WillRepeatedly(pollUntilWoken);
+    EXPECT_CALL(*callback, onComplete()).WillOnce([&completed] {
+        completed.set_value();
+        return ndk::ScopedAStatus::ok();
+    });
+
+    EXPECT_EQ(EX_NONE, mVibrator
+                           ->compose(
+                               {
+                                   {0, CompositePrimitive::CLICK, 1.0f},
+                                   {1000, CompositePrimitive::LIGHT_TICK, 1.0f},
+                               },
+                               callback)
+                           .getExceptionCode());
+    ASSERT_EQ(std::future_status::ready, started.get_future().wait_for(std::chrono::seconds(1)));
+    EXPECT_EQ(EX_NONE, mVibrator->off().getExceptionCode());
+    EXPECT_EQ(std::future_status::ready,
+              completed.get_future().wait_for(std::chrono::milliseconds(100)));
+}
+
+TEST_P(BasicTest, compose_scaledSteps) {
+    auto callback = ndk::SharedRefBase::make<MockVibratorCallback>();
+    std::promise<void> completed;
+    Sequence s;
+
+    shortenEffectDurations();
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, setScale(0)).InSequence(s).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setScale(2)).InSequence(s).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setScale(3)).InSequence(s).WillOnce(Return(true));
+    EXPECT_CALL(*callback, onComplete()).WillOnce([&completed] {
+        completed.set_value();
+        return ndk::ScopedAStatus::ok();
+    });
+
+    EXPECT_EQ(EX_NONE, mVibrator
+                           ->compose(
+                               {
+                                   {0, CompositePrimitive::CLICK, 1.0f},
+                                   {0, CompositePrimitive::CLICK, 0.5f},
+                                   {0, CompositePrimitive::CLICK, 0.0f},
+                               },
+                               callback)
+                           .getExceptionCode());
+    EXPECT_EQ(std::future_status::ready,
+              completed.get_future().wait_for(std::chrono::seconds(1)));
+}
+
+TEST_P(BasicTest, compose_invalid) {
+    int32_t maxDelayMs;
+    int32_t maxSize;
+
+    relaxMock(true);
+
+    EXPECT_TRUE(mVibrator->getCompositionDelayMax(&maxDelayMs).isOk());
+    EXPECT_TRUE(mVibrator->getCompositionSizeMax(&maxSize).isOk());
+
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT, mVibrator->compose({}, nullptr).getExceptionCode());
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT,
+              mVibrator->compose({{maxDelayMs + 1, CompositePrimitive::CLICK, 1.0f}}, nullptr)
+                  .getExceptionCode());
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT,
+              mVibrator->compose({{-1, CompositePrimitive::CLICK, 1.0f}}, nullptr)
+                  .getExceptionCode());
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT,
+              mVibrator->compose({{0, CompositePrimitive::CLICK, 1.5f}}, nullptr)
+                  .getExceptionCode());
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT,
+              mVibrator->compose({{0, CompositePrimitive::CLICK, NAN}}, nullptr)
+                  .getExceptionCode());
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT,
+              mVibrator
+                  ->compose(std::vector<CompositeEffect>(maxSize + 1,
+                                                         {0, CompositePrimitive::CLICK, 1.0f}),
+                            nullptr)
+                  .getExceptionCode());
+    EXPECT_EQ(EX_UNSUPPORTED_OPERATION,
+              mVibrator->compose({{0, CompositePrimitive::THUD, 1.0f}}, nullptr)
+                  .getExceptionCode());
+}
+
+TEST_P(BasicTest, dump_latency) {
+    TemporaryFile dump;
+    std::string content;
+
+    relaxMock(true);
+
+    EXPECT_EQ(EX_NONE, mVibrator->on(std::rand() % 1000, nullptr).getExceptionCode());
+    EXPECT_EQ(EX_NONE, mVibrator->off().getExceptionCode());
+    EXPECT_EQ(STATUS_OK, mVibrator->dump(dump.fd, nullptr, 0));
+    ::android::base::ReadFileToString(dump.path, &content);
+
+    EXPECT_NE(std::string::npos, content.find("API Latency:"));
+    EXPECT_NE(std::string::npos, content.find(" on                              1 "));
+    EXPECT_NE(std::string::npos, content.find(" off                             1 "));
+    EXPECT_NE(std::string::npos, content.find(" perform                         0 "));
+}
+
+TEST_P(BasicTest, dump_resetLatency) {
+    TemporaryFile dump;
+    std::string content;
+    const char *args[] = {"--reset-latency"};
+
+    relaxMock(true);
+
+    EXPECT_EQ(EX_NONE, mVibrator->off().getExceptionCode());
+
+    EXPECT_CALL(*mMockApi, resetLatencies()).WillOnce(Return());
+    EXPECT_EQ(STATUS_OK, mVibrator->dump(dump.fd, args, 1));
+    EXPECT_EQ(STATUS_OK, mVibrator->dump(dump.fd, nullptr, 0));
+    ::android::base::ReadFileToString(dump.path, &content);
+
+    EXPECT_NE(std::string::npos, content.find("Latency histograms reset"));
+    EXPECT_NE(std::string::npos, content.find(" off                             0 "));
+}
+
 TEST_P(BasicTest, off) {
     EXPECT_CALL(*mMockApi, setActivate(false)).WillOnce(DoDefault());
 
     EXPECT_EQ(EX_NONE, mVibrator->off().getExceptionCode());
 }
 
+TEST_P(BasicTest, prime) {
+    auto vibrator = std::static_pointer_cast<Vibrator>(mVibrator);
+
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, setSequencer("1 0")).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setMode("waveform")).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setDuration(_)).Times(0);
+    EXPECT_CALL(*mMockApi, setActivate(_)).Times(0);
+
+    EXPECT_EQ(EX_NONE, vibrator->prime(Effect::CLICK, EffectStrength::MEDIUM).getExceptionCode());
+}
+
+TEST_P(BasicTest, prime_unsupported) {
+    auto vibrator = std::static_pointer_cast<Vibrator>(mVibrator);
+
+    EXPECT_EQ(EX_UNSUPPORTED_OPERATION,
+              vibrator->prime(Effect::RINGTONE_1, EffectStrength::MEDIUM).getExceptionCode());
+}
+
+TEST_P(BasicTest, off_restagesAfterOn) {
+    int32_t lengthMs;
+
+    relaxMock(true);
+    EXPECT_EQ(EX_NONE,
+              mVibrator->perform(Effect::TICK, EffectStrength::LIGHT, nullptr, &lengthMs)
+                      .getExceptionCode());
+    EXPECT_EQ(EX_NONE, mVibrator->on(100, nullptr).getExceptionCode());
+
+    relaxMock(true);
+    EXPECT_CALL(*mMockApi, setActivate(false)).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setSequencer("2 0")).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setMode("waveform")).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setDuration(_)).Times(0);
+
+    EXPECT_EQ(EX_NONE, mVibrator->off().getExceptionCode());
+}
+
+TEST_P(BasicTest, off_keepsStagedEffect) {
+    int32_t lengthMs;
+
+    relaxMock(true);
+    EXPECT_EQ(EX_NONE,
+              mVibrator->perform(Effect::TICK, EffectStrength::LIGHT, nullptr, &lengthMs)
+                      .getExceptionCode());
+
+    relaxMock(false);
+    EXPECT_CALL(*mMockApi, setActivate(false)).WillOnce(Return(true));
+
+    EXPECT_EQ(EX_NONE, mVibrator->off().getExceptionCode());
+}
+
+TEST_P(BasicTest, off_restagesAfterFailedPerform) {
+    int32_t lengthMs;
+
+    relaxMock(true);
+    EXPECT_EQ(EX_NONE,
+              mVibrator->perform(Effect::TICK, EffectStrength::LIGHT, nullptr, &lengthMs)
+                      .getExceptionCode());
+
+    relaxMock(true);
+    EXPECT_CALL(*mMockApi, setSequencer("1 0")).WillOnce(Return(false));
+    EXPECT_CALL(*mMockApi, setActivate(true)).Times(0);
+    EXPECT_EQ(EX_ILLEGAL_STATE,
+              mVibrator->perform(Effect::CLICK, EffectStrength::LIGHT, nullptr, &lengthMs)
+                      .getExceptionCode());
+
+    // the failed effect neither counts as staged nor replaces the prediction
+    relaxMock(true);
+    EXPECT_CALL(*mMockApi, setActivate(false)).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setSequencer("2 0")).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setDuration(_)).Times(0);
+
+    EXPECT_EQ(EX_NONE, mVibrator->off().getExceptionCode());
+}
+
+TEST_P(BasicTest, prime_failure) {
+    auto vibrator = std::static_pointer_cast<Vibrator>(mVibrator);
+    int32_t lengthMs;
+
+    relaxMock(true);
+    EXPECT_EQ(EX_NONE,
+              vibrator->perform(Effect::TICK, EffectStrength::LIGHT, nullptr, &lengthMs)
+                      .getExceptionCode());
+
+    relaxMock(true);
+    EXPECT_CALL(*mMockApi, setSequencer("1 0")).WillOnce(Return(false));
+    EXPECT_EQ(EX_ILLEGAL_STATE,
+              vibrator->prime(Effect::CLICK, EffectStrength::MEDIUM).getExceptionCode());
+
+    // the registers may hold part of either effect, so off() restages the last one played
+    relaxMock(true);
+    EXPECT_CALL(*mMockApi, setSequencer("2 0")).WillOnce(Return(true));
+    EXPECT_EQ(EX_NONE, vibrator->off().getExceptionCode());
+}
+
+TEST_P(BasicTest, concurrentCalls) {
+    static constexpr int THREADS = 8;
+    static constexpr int CALLS = 200;
+    std::atomic<int> inside{0}, overlaps{0}, pending{0};
+    std::promise<void> completed;
+
+    relaxMock(true);
+
+    // every register write checks that no other is in flight
+    auto guard = [&] {
+        if (inside++ != 0) {
+            overlaps++;
+        }
+        std::this_thread::yield();
+        inside--;
+        return true;
+    };
+    ON_CALL(*mMockApi, setActivate(_)).WillByDefault(InvokeWithoutArgs(guard));
+    ON_CALL(*mMockApi, setDuration(_)).WillByDefault(InvokeWithoutArgs(guard));
+    ON_CALL(*mMockApi, setMode(_)).WillByDefault(InvokeWithoutArgs(guard));
+    ON_CALL(*mMockApi, setSequencer(_)).WillByDefault(InvokeWithoutArgs(guard));
+    ON_CALL(*mMockApi, setScale(_)).WillByDefault(InvokeWithoutArgs(guard));
+    ON_CALL(*mMockApi, setRtpInput(_)).WillByDefault(InvokeWithoutArgs(guard));
+    ON_CALL(*mMockApi, setOlLraPeriod(_)).WillByDefault(InvokeWithoutArgs(guard));
+    ON_CALL(*mMockApi, setCtrlLoop(_)).WillByDefault(InvokeWithoutArgs(guard));
+
+    auto callback = ndk::SharedRefBase::make<MockVibratorCallback>();
+    // each on() completes exactly once, whether it played or was cancelled
+    EXPECT_CALL(*callback, onComplete()).WillRepeatedly([&] {
+        if (--pending == 0) {
+            completed.set_value();
+        }
+        return ndk::ScopedAStatus::ok();
+    });
+
+    std::vector<std::thread> threads;
+    pending = 1;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&, t] {
+            int32_t lengthMs;
+
+            for (int i = 0; i < CALLS; i++) {
+                switch ((t + i) % 4) {
+                    case 0:
+                        pending++;
+                        EXPECT_EQ(EX_NONE, mVibrator->on(1, callback).getExceptionCode());
+                        break;
+                    case 1:
+                        EXPECT_EQ(EX_NONE, mVibrator->setAmplitude(0.5f).getExceptionCode());
+                        break;
+                    case 2:
+                        EXPECT_EQ(EX_NONE, mVibrator->off().getExceptionCode());
+                        break;
+                    case 3: {
+                        auto status = mVibrator->perform(Effect::CLICK, EffectStrength::LIGHT,
+                                                         nullptr, &lengthMs);
+                        EXPECT_EQ(EX_NONE, status.getExceptionCode());
+                        break;
+                    }
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    if (--pending == 0) {
+        completed.set_value();
+    }
+
+    EXPECT_EQ(0, overlaps);
+    EXPECT_EQ(std::future_status::ready,
+              completed.get_future().wait_for(std::chrono::seconds(5)));
+}
+
 TEST_P(BasicTest, supportsAmplitudeControl_supported) {
     EXPECT_CALL(*mMockApi, hasRtpInput()).WillOnce(Return(true));
 
@@ -359,6 +995,232 @@ TEST_P(BasicTest, setAmplitude) {
     EXPECT_EQ(EX_NONE, mVibrator->setAmplitude(amplitude).getExceptionCode());
 }
 
+TEST_P(BasicTest, streamAmplitude_interpolated) {
+    auto vibrator = std::static_pointer_cast<Vibrator>(mVibrator);
+    std::promise<void> streamed;
+    std::chrono::steady_clock::time_point start, last;
+    Sequence s;
+
+    EXPECT_CALL(*mMockApi, hasRtpInput()).WillOnce(Return(true));
+    for (int8_t value : {0, 32, 64, 95, 127}) {
+        EXPECT_CALL(*mMockApi, streamRtpInput(value)).InSequence(s).WillOnce(Return(true));
+    }
+    // flat sections are not rewritten
+    EXPECT_CALL(*mMockApi, streamRtpInput(64)).InSequence(s).WillOnce([&] {
+        last = std::chrono::steady_clock::now();
+        streamed.set_value();
+        return true;
+    });
+
+    start = std::chrono::steady_clock::now();
+    EXPECT_EQ(EX_NONE, vibrator
+                           ->streamAmplitude({
+                               {0.0f, 0},
+                               {1.0f, 20},
+                               {1.0f, 40},
+                               {0.5f, 40},
+                           })
+                           .getExceptionCode());
+    ASSERT_EQ(std::future_status::ready, streamed.get_future().wait_for(std::chrono::seconds(1)));
+    EXPECT_GE(last - start, std::chrono::milliseconds(40));
+}
+
+TEST_P(BasicTest, streamAmplitude_stoppedByOff) {
+    auto vibrator = std::static_pointer_cast<Vibrator>(mVibrator);
+    std::promise<void> started;
+
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, hasRtpInput()).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, streamRtpInput(0)).WillOnce([&started] {
+        started.set_value();
+        return true;
+    });
+    EXPECT_CALL(*mMockApi, streamRtpInput(127)).Times(0);
+
+    EXPECT_EQ(EX_NONE,
+              vibrator->streamAmplitude({{0.0f, 0}, {0.0f, 50}, {1.0f, 50}}).getExceptionCode());
+    ASSERT_EQ(std::future_status::ready, started.get_future().wait_for(std::chrono::seconds(1)));
+    EXPECT_EQ(EX_NONE, vibrator->off().getExceptionCode());
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+}
+
+TEST_P(BasicTest, composePwle_segmentsStreamed) {
+    float resonantHz;
+    std::promise<void> streamed;
+
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, hasRtpInput()).WillRepeatedly(Return(true));
+    EXPECT_EQ(EX_NONE, mVibrator->getResonantFrequency(&resonantHz).getExceptionCode());
+    uint32_t period = HapticCalibration::frequencyToPeriod(resonantHz + 40.0f);
+
+    // only the activation goes through the command queue
+    EXPECT_CALL(*mMockApi, setOlLraPeriod(period)).Times(0);
+    EXPECT_CALL(*mMockApi, streamOlLraPeriod(period)).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, streamRtpInput(amplitudeToRtpInput(0.5f))).WillOnce([&streamed] {
+        streamed.set_value();
+        return true;
+    });
+
+    EXPECT_EQ(EX_NONE,
+              mVibrator
+                      ->composePwle({ActivePwle{.startAmplitude = 1.0f,
+                                                .startFrequency = resonantHz + 10.0f,
+                                                .endAmplitude = 1.0f,
+                                                .endFrequency = resonantHz + 10.0f,
+                                                .duration = 10},
+                                     ActivePwle{.startAmplitude = 0.5f,
+                                                .startFrequency = resonantHz + 40.0f,
+                                                .endAmplitude = 0.5f,
+                                                .endFrequency = resonantHz + 40.0f,
+                                                .duration = 10}},
+                                    nullptr)
+                      .getExceptionCode());
+    EXPECT_EQ(std::future_status::ready, streamed.get_future().wait_for(std::chrono::seconds(1)));
+}
+
+TEST_P(BasicTest, composePwle_stoppedByOff) {
+    float resonantHz;
+    std::promise<void> started;
+
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, hasRtpInput()).WillRepeatedly(Return(true));
+    EXPECT_EQ(EX_NONE, mVibrator->getResonantFrequency(&resonantHz).getExceptionCode());
+
+    EXPECT_CALL(*mMockApi, setActivate(true)).WillOnce([&started] {
+        started.set_value();
+        return true;
+    });
+    EXPECT_CALL(*mMockApi, streamOlLraPeriod(_)).Times(0);
+
+    EXPECT_EQ(EX_NONE,
+              mVibrator
+                      ->composePwle({ActivePwle{.startAmplitude = 1.0f,
+                                                .startFrequency = resonantHz + 10.0f,
+                                                .endAmplitude = 1.0f,
+                                                .endFrequency = resonantHz + 10.0f,
+                                                .duration = 50},
+                                     ActivePwle{.startAmplitude = 0.5f,
+                                                .startFrequency = resonantHz + 40.0f,
+                                                .endAmplitude = 0.5f,
+                                                .endFrequency = resonantHz + 40.0f,
+                                                .duration = 10}},
+                                    nullptr)
+                      .getExceptionCode());
+    ASSERT_EQ(std::future_status::ready, started.get_future().wait_for(std::chrono::seconds(1)));
+    EXPECT_EQ(EX_NONE, mVibrator->off().getExceptionCode());
+    std::this_thread::sleep_for(std::chrono::milliseconds(70));
+}
+
+TEST_P(BasicTest, streamAmplitude_invalid) {
+    auto vibrator = std::static_pointer_cast<Vibrator>(mVibrator);
+    relaxMock(true);
+
+    EXPECT_CALL(*mMockApi, streamRtpInput(_)).Times(0);
+
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT, vibrator->streamAmplitude({}).getExceptionCode());
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT,
+              vibrator->streamAmplitude({{0.5f, 10}, {1.0f, 5}}).getExceptionCode());
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT, vibrator->streamAmplitude({{1.5f, 0}}).getExceptionCode());
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT, vibrator->streamAmplitude({{-0.5f, 0}}).getExceptionCode());
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT, vibrator->streamAmplitude({{NAN, 0}}).getExceptionCode());
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT,
+              vibrator->streamAmplitude(std::vector<Vibrator::AmplitudePoint>(1000, {0.5f, 0}))
+                      .getExceptionCode());
+}
+
+TEST_P(BasicTest, streamAmplitude_unsupported) {
+    auto vibrator = std::static_pointer_cast<Vibrator>(mVibrator);
+    EXPECT_CALL(*mMockApi, hasRtpInput()).WillOnce(Return(false));
+
+    EXPECT_EQ(EX_UNSUPPORTED_OPERATION,
+              vibrator->streamAmplitude({{0.5f, 0}}).getExceptionCode());
+}
+
+TEST_P(BasicTest, supportsAlwaysOn) {
+    std::vector<Effect> supported;
+    int32_t capabilities;
+
+    EXPECT_CALL(*mMockApi, hasRtpInput()).WillOnce(Return(true));
+
+    EXPECT_TRUE(mVibrator->getCapabilities(&capabilities).isOk());
+    EXPECT_GT(capabilities & IVibrator::CAP_ALWAYS_ON_CONTROL, 0);
+    EXPECT_TRUE(mVibrator->getSupportedAlwaysOnEffects(&supported).isOk());
+    EXPECT_THAT(supported, UnorderedElementsAre(Effect::CLICK, Effect::DOUBLE_CLICK, Effect::TICK,
+                                                Effect::HEAVY_CLICK, Effect::TEXTURE_TICK));
+}
+
+TEST_P(BasicTest, supportsAlwaysOn_disabledByConfig) {
+    std::unique_ptr<MockApi> mockapi;
+    std::unique_ptr<MockCal> mockcal;
+    std::vector<Effect> supported;
+    int32_t capabilities;
+
+    deleteVibrator();
+    createMock(&mockapi, &mockcal);
+    ON_CALL(*mMockCal, getTriggerEffectSupport(_))
+            .WillByDefault(DoAll(SetArgPointee<0>(0), Return(true)));
+    createVibrator(std::move(mockapi), std::move(mockcal));
+
+    EXPECT_CALL(*mMockApi, hasRtpInput()).WillOnce(Return(true));
+    EXPECT_CALL(*mMockApi, setLpTriggerEffect(_)).Times(0);
+
+    EXPECT_TRUE(mVibrator->getCapabilities(&capabilities).isOk());
+    EXPECT_EQ(capabilities & IVibrator::CAP_ALWAYS_ON_CONTROL, 0);
+    EXPECT_EQ(EX_UNSUPPORTED_OPERATION,
+              mVibrator->getSupportedAlwaysOnEffects(&supported).getExceptionCode());
+    EXPECT_EQ(EX_UNSUPPORTED_OPERATION,
+              mVibrator->alwaysOnEnable(0, Effect::CLICK, EffectStrength::LIGHT)
+                      .getExceptionCode());
+    EXPECT_EQ(EX_UNSUPPORTED_OPERATION, mVibrator->alwaysOnDisable(0).getExceptionCode());
+}
+
+TEST_P(BasicTest, alwaysOnEnable) {
+    std::vector<std::pair<Effect, uint32_t>> slots = {
+            {Effect::CLICK, 1},        {Effect::TICK, 2},         {Effect::TEXTURE_TICK, 2},
+            {Effect::DOUBLE_CLICK, 3}, {Effect::HEAVY_CLICK, 4},
+    };
+
+    for (auto &slot : slots) {
+        for (auto strength : ndk::enum_range<EffectStrength>()) {
+            EXPECT_CALL(*mMockApi, setLpTriggerEffect(slot.second)).WillOnce(Return(true));
+
+            EXPECT_EQ(EX_NONE,
+                      mVibrator->alwaysOnEnable(0, slot.first, strength).getExceptionCode());
+        }
+    }
+}
+
+TEST_P(BasicTest, alwaysOnEnable_invalid) {
+    EXPECT_CALL(*mMockApi, setLpTriggerEffect(_)).Times(0);
+
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT,
+              mVibrator->alwaysOnEnable(1, Effect::CLICK, EffectStrength::LIGHT)
+                      .getExceptionCode());
+    EXPECT_EQ(EX_UNSUPPORTED_OPERATION,
+              mVibrator->alwaysOnEnable(0, Effect::RINGTONE_1, EffectStrength::LIGHT)
+                      .getExceptionCode());
+    EXPECT_EQ(EX_UNSUPPORTED_OPERATION,
+              mVibrator->alwaysOnEnable(0, Effect::CLICK, static_cast<EffectStrength>(-1))
+                      .getExceptionCode());
+}
+
+TEST_P(BasicTest, alwaysOnEnable_failure) {
+    EXPECT_CALL(*mMockApi, setLpTriggerEffect(1)).WillOnce(Return(false));
+
+    EXPECT_EQ(EX_ILLEGAL_STATE, mVibrator->alwaysOnEnable(0, Effect::CLICK, EffectStrength::STRONG)
+                                        .getExceptionCode());
+}
+
+TEST_P(BasicTest, alwaysOnDisable) {
+    EXPECT_CALL(*mMockApi, setLpTriggerEffect(0)).WillOnce(Return(true));
+
+    EXPECT_EQ(EX_NONE, mVibrator->alwaysOnDisable(0).getExceptionCode());
+    EXPECT_EQ(EX_ILLEGAL_ARGUMENT, mVibrator->alwaysOnDisable(1).getExceptionCode());
+}
+
 TEST_P(BasicTest, supportsExternalControl_unsupported) {
     EXPECT_CALL(*mMockApi, hasRtpInput()).WillOnce(Return(false));
 